@@ -0,0 +1,98 @@
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include "pipe_clust.h"
+#include "util.h"
+
+/*
+    Benchmark harness for the PipeClust de-replication. Runs either
+    serial_dereplication (single process) or the parallel de-replication
+    over the input files and prints a JSON line with the measurements.
+*/
+
+static char* USAGE = "USAGE: mpiexec -n <NUM PROCS> bench_derep [--serial | --parallel] [--label TEXT] FILE1 FILE2 ...";
+
+/*
+    Returns the peak resident set size of this process, in KiB
+*/
+long peak_rss_kb(void){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char** argv){
+    MPI_Init(&argc, &argv);
+    int my_rank;
+    int comm_sz;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+    // Parse the command line
+    int serial = 0;
+    char* label = "";
+    int first = 1;
+    while(first < argc && strncmp(argv[first], "--", 2) == 0){
+        if(strcmp(argv[first], "--serial") == 0)
+            serial = 1;
+        else if(strcmp(argv[first], "--parallel") == 0)
+            serial = 0;
+        else if(strcmp(argv[first], "--label") == 0 && first + 1 < argc)
+            label = argv[++first];
+        else
+            error_handler(FATAL_ERROR, "Unknown option %s\n%s", argv[first], USAGE);
+        ++first;
+    }
+    int num_files = argc - first;
+    if(num_files == 0)
+        error_handler(FATAL_ERROR, "Input files not provided!\n%s", USAGE);
+    if(serial && comm_sz != 1)
+        error_handler(FATAL_ERROR, "Serial mode must be run with a single process");
+
+    // De-replicate, timing the read phase and the gather separately
+    derep_db* db;
+    double read_time;
+    double gather_time = 0.0;
+    MPI_Barrier(MPI_COMM_WORLD);
+    double start = MPI_Wtime();
+    if(serial){
+        db = serial_dereplication(&argv[first], num_files);
+        read_time = MPI_Wtime() - start;
+    }
+    else{
+        db = local_dereplication(&argv[first], num_files, my_rank, comm_sz);
+        read_time = MPI_Wtime() - start;
+        // The gather starts when the slowest process is done reading
+        double max_read_time;
+        MPI_Allreduce(&read_time, &max_read_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+        read_time = max_read_time;
+        double gather_start = MPI_Wtime();
+        gather_derep_db(db, my_rank, comm_sz);
+        gather_time = MPI_Wtime() - gather_start;
+    }
+    double total_time = MPI_Wtime() - start;
+
+    // Collect the peak memory of all the processes
+    long rss = peak_rss_kb();
+    long max_rss;
+    long sum_rss;
+    MPI_Reduce(&rss, &max_rss, 1, MPI_LONG, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&rss, &sum_rss, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+
+    if(my_rank == 0){
+        printf("{\"label\": \"%s\", \"mode\": \"%s\", \"ranks\": %d, \"files\": %d, "
+               "\"reads\": %d, \"uniques\": %d, \"seconds\": %.6f, \"read_seconds\": %.6f, "
+               "\"gather_seconds\": %.6f, \"reads_per_second\": %.1f, "
+               "\"peak_rss_kb_rank0\": %ld, \"peak_rss_kb_max\": %ld, \"peak_rss_kb_total\": %ld}\n",
+               label, serial ? "serial" : "parallel", comm_sz, num_files,
+               db->count, db->unique, total_time, read_time, gather_time,
+               total_time > 0 ? db->count / total_time : 0.0,
+               rss, max_rss, sum_rss);
+        fflush(stdout);
+    }
+    destroy_derep_db(db);
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+/*
+    Deterministic synthetic amplicon FASTA generator for the PipeClust
+    benchmarks. Reads are drawn from a set of template sequences following a
+    Zipf abundance distribution, optionally mutated with sequencing errors,
+    and spread over a number of files whose sizes can be skewed.
+*/
+
+static char* USAGE = "USAGE: gen_amplicons -o OUTDIR [options]\n\n"
+                     "    -o DIR     Output directory (created if needed)\n"
+                     "    -n NUM     Total number of reads [100000]\n"
+                     "    -u NUM     Number of template (true) sequences [1000]\n"
+                     "    -z FLOAT   Zipf exponent of the template abundances [1.2]\n"
+                     "    -l NUM     Mean read length [250]\n"
+                     "    -d NUM     Standard deviation of the read length [10]\n"
+                     "    -e FLOAT   Per-base substitution error rate [0.002]\n"
+                     "    -f NUM     Number of output files [4]\n"
+                     "    -k FLOAT   Skew (lognormal sigma) of the file sizes, 0 is even [0]\n"
+                     "    -L FMT     Label format: qiime, illumina or plain [qiime]\n"
+                     "    -s NUM     Random seed [42]\n";
+
+// Maximum read length the PipeClust reader accepts on a single line
+#define MAX_LENGTH 1900
+
+// xorshift64* state
+static uint64_t RNG_STATE;
+
+/*
+    Returns the next 64-bit pseudo-random number
+*/
+uint64_t rng_next(void){
+    RNG_STATE ^= RNG_STATE >> 12;
+    RNG_STATE ^= RNG_STATE << 25;
+    RNG_STATE ^= RNG_STATE >> 27;
+    return RNG_STATE * 0x2545F4914F6CDD1DULL;
+}
+
+/*
+    Returns a pseudo-random double in [0, 1)
+*/
+double rng_uniform(void){
+    return (rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+    Returns a pseudo-random normally distributed double (Box-Muller)
+*/
+double rng_normal(double mean, double sd){
+    double u1 = rng_uniform();
+    double u2 = rng_uniform();
+    if(u1 < 1e-300)
+        u1 = 1e-300;
+    return mean + sd * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/*
+    Returns the index of the first element of the cumulative distribution
+    cdf (of length n) that is greater than or equal to x
+*/
+int sample_cdf(double* cdf, int n, double x){
+    int lo = 0;
+    int hi = n - 1;
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(cdf[mid] < x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+    Writes the label of the read `read` of sample `sample` in the given format
+*/
+void write_label(FILE* fd, char* format, int sample, long read){
+    if(strcmp(format, "illumina") == 0)
+        fprintf(fd, ">M00176:65:000000000-A41FB:1:%d:%ld:%ld 1:N:0:%d\n",
+                1101 + sample, read % 30000, read / 30000, sample + 1);
+    else if(strcmp(format, "plain") == 0)
+        fprintf(fd, ">read%ld\n", read);
+    else
+        fprintf(fd, ">Sample%d_%ld orig_bc=ACGTACGTACGT new_bc=ACGTACGTACGT bc_diffs=0\n", sample, read);
+}
+
+int main(int argc, char** argv){
+    char* outdir = NULL;
+    long num_reads = 100000;
+    int num_templates = 1000;
+    double zipf = 1.2;
+    int mean_length = 250;
+    int sd_length = 10;
+    double error_rate = 0.002;
+    int num_files = 4;
+    double size_skew = 0.0;
+    char* format = "qiime";
+    uint64_t seed = 42;
+    int c;
+    int i;
+    long r;
+
+    // Parse the command line options
+    while((c = getopt(argc, argv, "o:n:u:z:l:d:e:f:k:L:s:h")) != -1){
+        switch(c){
+            case 'o': outdir = optarg; break;
+            case 'n': num_reads = atol(optarg); break;
+            case 'u': num_templates = atoi(optarg); break;
+            case 'z': zipf = atof(optarg); break;
+            case 'l': mean_length = atoi(optarg); break;
+            case 'd': sd_length = atoi(optarg); break;
+            case 'e': error_rate = atof(optarg); break;
+            case 'f': num_files = atoi(optarg); break;
+            case 'k': size_skew = atof(optarg); break;
+            case 'L': format = optarg; break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            default:
+                fprintf(stderr, "%s", USAGE);
+                return 1;
+        }
+    }
+    if(!outdir || num_templates <= 0 || num_files <= 0 || num_reads < 0){
+        fprintf(stderr, "%s", USAGE);
+        return 1;
+    }
+    mkdir(outdir, 0755);
+    RNG_STATE = seed ? seed : 1;
+
+    // Generate the templates, with a normally distributed length
+    char** templates = (char**) malloc(sizeof(char*) * num_templates);
+    for(i = 0; i < num_templates; i++){
+        int length = (int) rng_normal(mean_length, sd_length);
+        if(length < 20)
+            length = 20;
+        if(length > MAX_LENGTH)
+            length = MAX_LENGTH;
+        templates[i] = (char*) malloc(length + 1);
+        for(c = 0; c < length; c++)
+            templates[i][c] = "ACGT"[rng_next() >> 62];
+        templates[i][length] = '\0';
+    }
+    // Cumulative Zipf distribution of the template abundances
+    double* abundance = (double*) malloc(sizeof(double) * num_templates);
+    double total = 0.0;
+    for(i = 0; i < num_templates; i++){
+        total += 1.0 / pow(i + 1, zipf);
+        abundance[i] = total;
+    }
+    for(i = 0; i < num_templates; i++)
+        abundance[i] /= total;
+    // Cumulative distribution of the file sizes
+    double* sizes = (double*) malloc(sizeof(double) * num_files);
+    total = 0.0;
+    for(i = 0; i < num_files; i++){
+        total += exp(rng_normal(0.0, size_skew));
+        sizes[i] = total;
+    }
+    // Number of reads of each file
+    long* file_reads = (long*) calloc(num_files, sizeof(long));
+    long assigned = 0;
+    for(i = 0; i < num_files; i++){
+        long upto = (long) llround(num_reads * sizes[i] / total);
+        file_reads[i] = upto - assigned;
+        assigned = upto;
+    }
+
+    // Write the files
+    char path[4096];
+    char read_seq[MAX_LENGTH + 1];
+    long read_id = 0;
+    for(i = 0; i < num_files; i++){
+        snprintf(path, sizeof(path), "%s/sample_%d.fna", outdir, i);
+        FILE* fd = fopen(path, "w");
+        if(fd == NULL){
+            fprintf(stderr, "Error opening %s\n", path);
+            return 1;
+        }
+        for(r = 0; r < file_reads[i]; r++){
+            char* t = templates[sample_cdf(abundance, num_templates, rng_uniform())];
+            int length = strlen(t);
+            memcpy(read_seq, t, length + 1);
+            // Sprinkle substitution errors
+            if(error_rate > 0.0){
+                for(c = 0; c < length; c++){
+                    if(rng_uniform() < error_rate)
+                        read_seq[c] = "ACGT"[(strchr("ACGT", read_seq[c]) - "ACGT" + 1 + (rng_next() % 3)) % 4];
+                }
+            }
+            write_label(fd, format, i, read_id++);
+            fprintf(fd, "%s\n", read_seq);
+        }
+        fclose(fd);
+    }
+
+    // Clean up
+    for(i = 0; i < num_templates; i++)
+        free(templates[i]);
+    free(templates);
+    free(abundance);
+    free(sizes);
+    free(file_reads);
+    return 0;
+}
@@ -0,0 +1,52 @@
+#!/bin/bash
+#-------------------------
+# PipeClust benchmark driver
+#
+# Generates the synthetic datasets and runs the serial and parallel
+# de-replication on 1..MAX_RANKS local processes, printing one JSON line per
+# configuration.
+#
+# Usage: bench/run_bench.sh [MAX_RANKS] [WORKDIR]
+#
+# Environment:
+#   BENCH_READS   total reads per dataset (default 200000)
+#   MPIEXEC       MPI launcher (default "mpiexec")
+#   MPIEXEC_ARGS  extra launcher arguments (e.g. "--oversubscribe")
+#-------------------------
+
+set -e
+
+MAX_RANKS=${1:-4}
+WORKDIR=${2:-$(mktemp -d)}
+BINDIR=$(dirname "$0")/../bin
+READS=${BENCH_READS:-200000}
+MPIEXEC=${MPIEXEC:-mpiexec}
+
+GEN=${BINDIR}/gen_amplicons
+BENCH=${BINDIR}/bench_derep
+
+# name|generator options
+DATASETS=(
+    "even_4files|-n ${READS} -u 2000 -z 1.2 -f 4 -L qiime"
+    "skewed_64files|-n ${READS} -u 2000 -z 1.2 -f 64 -k 1.5 -L qiime"
+    "flat_abundance|-n ${READS} -u 50000 -z 0.5 -f 8 -L plain"
+    "long_reads|-n ${READS} -u 2000 -z 1.2 -l 450 -d 40 -f 8 -L illumina"
+    "single_file|-n ${READS} -u 2000 -z 1.2 -f 1 -L qiime"
+)
+
+for dataset in "${DATASETS[@]}"; do
+    name=${dataset%%|*}
+    opts=${dataset#*|}
+    dir=${WORKDIR}/${name}
+    if [ ! -d "${dir}" ]; then
+        mkdir -p "${dir}"
+        ${GEN} -o "${dir}" ${opts}
+    fi
+    files=$(ls "${dir}"/*.fna)
+    # Serial baseline
+    ${MPIEXEC} ${MPIEXEC_ARGS} -n 1 ${BENCH} --serial --label "${name}" ${files}
+    # Parallel runs
+    for ((ranks = 1; ranks <= MAX_RANKS; ranks++)); do
+        ${MPIEXEC} ${MPIEXEC_ARGS} -n ${ranks} ${BENCH} --parallel --label "${name}" ${files}
+    done
+done
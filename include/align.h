@@ -0,0 +1,40 @@
+#ifndef __ALIGN_H__
+#define __ALIGN_H__
+
+/*
+    Computes the edit distance (substitutions, insertions and deletions)
+    between the sequences a and b if it is at most max_dist, filling only
+    the band of the dynamic programming matrix within max_dist of its
+    diagonal and stopping as soon as every cell of a row exceeds max_dist
+
+    Inputs:
+        a: the first sequence
+        length_a: the length of a
+        b: the second sequence
+        length_b: the length of b
+        max_dist: the largest distance of interest
+
+    Returns the edit distance between a and b, or max_dist + 1 if it is
+    larger than max_dist
+*/
+int bounded_edit_distance(char* a, int length_a, char* b, int length_b, int max_dist);
+
+/*
+    Computes the smallest edit distance between query and any substring of
+    ref (i.e. the gaps before and after the query in ref are free), with
+    Myers' bit-vector algorithm: each 64-bit word holds the vertical
+    differences of 64 cells of a column of the dynamic programming matrix,
+    so a column costs a few word operations per 64 query bases. Only A, C,
+    G and T match; any other character is a mismatch.
+
+    Inputs:
+        query: the sequence to place in ref
+        length_query: the length of query
+        ref: the reference sequence
+        length_ref: the length of ref
+
+    Returns the edit distance of the best placement of query in ref
+*/
+int semiglobal_edit_distance(char* query, int length_query, char* ref, int length_ref);
+
+#endif
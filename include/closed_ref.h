@@ -0,0 +1,42 @@
+#ifndef __CLOSED_REF_H__
+#define __CLOSED_REF_H__
+
+#include "derep_db.h"
+
+// Number of candidate references aligned for each unique
+#define CLOSED_REF_CANDIDATES 16
+// Largest piece of the uniques sent at once
+#define CLOSED_REF_PIECE (1 << 30)
+
+/*
+    Sets the smallest identity (1 - edit distance / unique length) of a
+    unique to the reference it is assigned to
+
+    Inputs:
+        similarity: the identity threshold, in (0, 1]
+*/
+void set_ref_similarity(double similarity);
+
+/*
+    Closed-reference clustering of the de-replication database db (complete
+    in rank 0) against the reference index file index (see ref_index.h):
+    rank 0 deals the uniques to all the processes, each of them maps its
+    share against the index, and rank 0 collects the assignments. Each
+    unique goes to the closest reference, among the k-mer candidates, that
+    holds it within the identity threshold, the one sharing the most k-mers
+    on a tie. Rank 0 writes the reference-OTU table (an OTU map with the
+    reference labels or, with per-sample counts, a reference x sample count
+    table) and removes the mapped uniques from db, which keeps the ones
+    that failed. Must be called by all the processes.
+
+    Inputs:
+        db: the de-replication database - will be modified in place in
+            rank 0
+        index: path to the reference index file
+        otus: path to the output reference-OTU table
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void closed_ref_derep_db(derep_db* db, char* index, char* otus, int my_rank, int comm_sz);
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include "mpi.h"
+#include "derep_db.h"
+
+// Size of the encoded records compressed and sent as one message
+#define COMPRESS_CHUNK (1 << 20)
+// Tag of the compressed gather messages
+#define COMPRESS_TAG 42
+
+/*
+    Sets whether the de-replication databases are compressed when they are
+    sent during the gather
+
+    Inputs:
+        compress: 1 to compress the gather messages, 0 otherwise
+*/
+void set_gather_compression(int compress);
+
+/*
+    Returns whether the gather messages are compressed
+*/
+int gather_compression_enabled(void);
+
+/*
+    Sends the de-replication database db to process dest in compressed
+    chunks. The sequences are packed in 2 bits per base when possible, the
+    labels are front-coded and the counts are varints; each chunk is then
+    compressed with zlib and sent while the next one is encoded.
+
+    Inputs:
+        db: de-replication database to send
+        dest: the rank of the destination process
+        comm: the communicator of dest
+*/
+void send_compressed_derep_db(derep_db* db, int dest, MPI_Comm comm);
+
+/*
+    Receives a de-replication database sent by send_compressed_derep_db
+    and merges it with db, chunk by chunk
+
+    Inputs:
+        db: pointer to the local de-replication database structure
+        source: the rank of the source process
+        comm: the communicator of source
+*/
+void recv_compressed_derep_db(derep_db* db, int source, MPI_Comm comm);
+
+/*
+    Reports the compression ratio achieved by the gather messages of all
+    the processes, or that none was sent, as with --node-gather on a
+    single node. Must be called by all the processes; rank 0 prints it.
+
+    Inputs:
+        my_rank: process rank
+*/
+void report_gather_compression(int my_rank);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef __DENOISE_H__
+#define __DENOISE_H__
+
+#include "derep_db.h"
+
+// Seed of the k-mer index used to find the candidate parents
+#define DENOISE_SEED "11111111"
+// Number of candidate parents aligned for each unique
+#define DENOISE_CANDIDATES 16
+// Smallest batch split among the threads of a process
+#define DENOISE_MIN_THREADED_BATCH 64
+// Fraction of the expected sketch similarity below which a candidate
+// parent is dropped without aligning it
+#define DENOISE_SKETCH_SLACK 0.5
+
+/*
+    Sets the parameters of the denoising
+
+    Inputs:
+        minsize: the smallest abundance of the uniques kept; the smaller
+            ones are discarded
+        alpha: the alpha of the UNOISE abundance skew criterion
+        threads: the number of threads of each process
+*/
+void set_denoise_params(int minsize, double alpha, int threads);
+
+/*
+    Sets whether the candidate parents are first compared with their MinHash
+    sketches (see sketch.h): a candidate whose estimated Jaccard similarity
+    to the query is below DENOISE_SKETCH_SLACK times the one expected at
+    the largest distance accepted is dropped before the alignment. The
+    estimate is approximate, so a few true parents may be missed.
+
+    Inputs:
+        enable: 1 to filter the candidates, 0 to align all of them
+*/
+void set_denoise_sketch_filter(int enable);
+
+/*
+    Denoises the de-replication database db (complete in rank 0) with the
+    UNOISE criterion: a unique Q is a noisy variant of a more abundant
+    unique P, already accepted, if
+
+        abundance(Q) / abundance(P) <= 1 / 2^(alpha * d + 1)
+
+    where d is their edit distance. Its reads are then merged into P. The
+    candidate parents are the uniques that share the most k-mers with Q.
+
+    The uniques are processed by decreasing abundance, in batches whose
+    possible parents are all at least 2^(alpha + 1) times more abundant,
+    and hence decided by the previous batches. The queries of a batch are
+    split across the processes and their threads, and the decisions are
+    shared by all of them, so the result is the one of a sequential pass.
+    Must be called by all the processes.
+
+    Inputs:
+        db: the de-replication database - will be modified in place in
+            rank 0
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void denoise_derep_db(derep_db* db, int my_rank, int comm_sz);
+
+#endif
@@ -1,23 +1,115 @@
 #ifndef __DEREP_DB_H__
 #define __DEREP_DB_H__
 
+#include <stdint.h>
 #include "sequence.h"
+#include "huge_alloc.h"
+// The bucket arrays of the tables follow the huge page settings
+#define uthash_malloc(sz) huge_malloc(sz)
+#define uthash_free(ptr, sz) huge_free(ptr, sz)
 #include "uthash.h"
 #include "utarray.h"
 
+// Largest number of sequences de-replicated together by dereplicate_db_batch
+#define DEREP_BATCH 32
+
+// Estimated memory used by a unique sequence of length `len`, including
+// the hash handle, the bucket share and the malloc overheads
+#define REPLICA_BYTES(len) (sizeof(seq_replicas) + sizeof(UT_array) + sizeof(UT_hash_bucket) + (len) + 64)
+// Estimated memory used by a label of length `len`
+#define LABEL_BYTES(len) (sizeof(char*) + (len) + 17)
+
 typedef struct seq_replicas_str {
     char* sequence __attribute__ ((aligned (16)));
     int count;
+    // Whether sequence lives in the key arena (see huge_alloc.h)
+    int arena_key;
     UT_array *labels;
+    UT_array *samples;
+    uint16_t* sketch;
     UT_hash_handle hh;
 } seq_replicas;
 
 typedef struct derep_db_str {
     int count;
     int unique;
+    char sample_sep;
+    long expected;
+    size_t bytes;
     seq_replicas* seqs;
 } derep_db;
 
+/*
+    Creates a new seq_replicas structure with `sequence` but with no labels on it
+
+    Inputs:
+        sequence: char array of the sequence
+        seq_length: the length of the sequence
+
+    Returns a pointer to the new seq_replicas structure
+*/
+seq_replicas* create_empty_seq_replica(char* sequence, int seq_length);
+
+/*
+    Adds the label as a replica of r
+
+    Inputs:
+        r: pointer to the seq_replicas structure
+        label: the label of the replica
+*/
+void add_replica(seq_replicas* r, char* label);
+
+/*
+    Computes the MinHash sketch (see sketch.h) of the replica r, which is
+    freed with it
+
+    Inputs:
+        r: pointer to the seq_replicas structure
+*/
+void sketch_seq_replica(seq_replicas* r);
+
+/*
+    Destroy the replica structure r
+
+    Inputs:
+        r: pointer to the seq_replicas structure
+*/
+void destroy_seq_replica(seq_replicas* r);
+
+/*
+    Adds `count` reads of sample `sample` to the replica r. Only used by
+    databases that keep per-sample counts instead of labels.
+
+    Inputs:
+        r: pointer to the seq_replicas structure
+        sample: the sample id (see samples.h)
+        count: the number of reads to add
+
+    Returns 1 if the sample is new for this replica, 0 otherwise
+*/
+int add_sample_replica(seq_replicas* r, int sample, int count);
+
+/*
+    Adds the reads of the replica src (its labels or its per-sample counts)
+    to the replica dst. src is left untouched.
+
+    Inputs:
+        dst: pointer to the seq_replicas structure receiving the reads
+        src: pointer to the seq_replicas structure whose reads are added
+*/
+void merge_seq_replica(seq_replicas* dst, seq_replicas* src);
+
+/*
+    Inserts the replica r in the database db, without checking if its
+    sequence is already present. The unique counter and the memory estimate
+    are updated; the sequence counter is left to the caller.
+
+    Inputs:
+        db: pointer to the derep_db structure
+        r: pointer to the seq_replicas structure to insert
+*/
+void insert_seq_replica(derep_db* db, seq_replicas* r);
+
 /*
     Creates a new de-replication database
 
@@ -26,6 +118,17 @@ typedef struct derep_db_str {
 */
 derep_db* create_derep_db(void);
 
+/*
+    Pre-sizes the hash table of db for `expected` unique sequences, so it
+    does not need to grow while they are inserted. An empty table is sized
+    on its first insertion; a non-empty one is rehashed once right away.
+
+    Inputs:
+        db: pointer to the derep_db structure
+        expected: the expected number of unique sequences
+*/
+void presize_derep_db(derep_db* db, long expected);
+
 /*
     Destroys the de-replication database db
 
@@ -46,6 +149,20 @@ void destroy_derep_db(derep_db* db);
 */
 void dereplicate_db(derep_db* db, sequence* seq);
 
+/*
+    De-replicates the n sequences of seqs against the de-replication
+    database db, with the same result as calling dereplicate_db on each of
+    them in order. The keys are hashed first and their buckets and first
+    entries prefetched, so the cache misses of the probes overlap instead
+    of following one another.
+
+    Inputs:
+        db: pointer to the derep_db structure
+        seqs: array of pointers to the sequence structures
+        n: the number of sequences, at most DEREP_BATCH
+*/
+void dereplicate_db_batch(derep_db* db, sequence** seqs, int n);
+
 /*
     Sorts the de-replication database by sequence abundance
 
@@ -61,10 +178,22 @@ void sort_db(derep_db* db);
     Inputs:
         db: pointer to the derep_db struct
         fasta: string with the output fasta filename
-        map: string with the output OTU map filename
+        map: string with the output OTU map filename - NULL to skip it
 */
 void write_output(derep_db* db, char* fasta, char* map);
 
+/*
+    Writes the sample x unique abundance table of the de-replication
+    database db as a tab-separated file, one row per unique sequence
+    (named as in the FASTA output) and one column per sample. The database
+    must keep per-sample counts (see samples.h).
+
+    Inputs:
+        db: pointer to the derep_db struct
+        table: string with the output table filename
+*/
+void write_sample_table(derep_db* db, char* table);
+
 /*
     Collects all the information about the derep_db spread across multiple
     processes in the process with rank 0
@@ -76,6 +205,31 @@ void write_output(derep_db* db, char* fasta, char* map);
 */
 void gather_derep_db(derep_db* db, int my_rank, int comm_sz);
 
+/*
+    Collects all the information about the derep_db spread across multiple
+    processes in the process with rank 0 in two levels: the processes of
+    each node merge their databases through shared memory windows, without
+    messages, and only the first process of each node takes part in the
+    gather across the nodes
+
+    Inputs:
+        db: the local derep_db - will be modified in place
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void node_gather_derep_db(derep_db* db, int my_rank, int comm_sz);
+
+/*
+    Returns the number of processes whose databases end up merged in the
+    one of process my_rank with node_gather_derep_db (itself included): 1
+    for the processes that only send. Must be called by all the processes.
+
+    Inputs:
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+int node_gather_subtree(int my_rank, int comm_sz);
+
 // void merge_derep_dbs(derep_db* db1, derep_db* db2);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef __DIST_OUTPUT_H__
+#define __DIST_OUTPUT_H__
+
+#include "derep_db.h"
+
+// Largest piece written by a single MPI-IO call
+#define DIST_WRITE_PIECE (1 << 30)
+
+/*
+    Writes the FASTA and OTU map outputs from the local, not gathered,
+    de-replication databases of all the processes, without collecting them
+    in a single process:
+        1. The uniques are redistributed by sequence hash, so each sequence
+           ends up merged in a single process.
+        2. If sort is set, a sample sort orders them globally by abundance
+           (descending) and sequence, leaving each process a contiguous
+           range of that order.
+        3. The OTU ids and the file offsets of each process are prefix sums
+           (MPI_Exscan) of the number of uniques and the bytes before it.
+        4. Each process writes its slice of the files with MPI-IO.
+    Must be called by all the processes. The uniques of db are consumed;
+    on return, the counters of db in rank 0 hold the totals of all the
+    processes.
+
+    Inputs:
+        db: the local derep_db
+        fasta: string with the output fasta filename
+        map: string with the output OTU map filename - NULL to skip it
+        sort: 1 to order the output by abundance, 0 otherwise
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void write_distributed_output(derep_db* db, char* fasta, char* map, int sort, int my_rank, int comm_sz);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __FILTER_H__
+#define __FILTER_H__
+
+#include "sequence.h"
+
+// Offset of the Phred quality characters
+#define PHRED_OFFSET 33
+// Longest primer handled
+#define PRIMER_MAX_LENGTH 64
+// Largest number of bases before the forward primer (or after the reverse
+// one) that are trimmed with it, such as heterogeneity spacers
+#define PRIMER_MAX_OFFSET 8
+
+/*
+    Sets the maximum number of expected errors of the reads that are kept.
+    The expected errors of a read are the sum of the error probabilities
+    given by its quality scores.
+
+    Inputs:
+        max_ee: the maximum expected errors - negative to disable the filter
+*/
+void set_max_expected_errors(double max_ee);
+
+/*
+    Sets the quality score at which the reads are truncated: each read is
+    cut before its first base with a quality score <= truncqual
+
+    Inputs:
+        truncqual: the Phred quality score, at most 93 - negative to disable
+            truncation
+*/
+void set_truncqual(int truncqual);
+
+/*
+    Sets the primers trimmed from the reads. The forward primer is looked
+    for at the start of each read and the reverse complement of the reverse
+    primer at its end, both up to PRIMER_MAX_OFFSET bases away, and each one
+    is removed with the bases beyond it. The primers may hold IUPAC
+    degenerate codes; a read base matching none of the bases of the code is
+    a mismatch. The reads without a primer are kept as they are.
+
+    Inputs:
+        forward: the forward primer - NULL for none
+        reverse: the reverse primer, as synthesized - NULL for none
+        max_mismatches: the largest number of mismatches of a primer match
+
+    Returns 1 if the primers are IUPAC sequences of at most
+    PRIMER_MAX_LENGTH bases and longer than max_mismatches, 0 otherwise
+    (and nothing is set)
+*/
+int set_primers(char* forward, char* reverse, int max_mismatches);
+
+/*
+    Sets the length filters of the reads, applied after the primers are
+    trimmed and the quality truncation
+
+    Inputs:
+        trunclen: the length the reads are truncated to - the shorter ones
+            are dropped. 0 to disable truncation
+        minlen: the shortest read kept - 0 for no limit
+        maxlen: the longest read kept - 0 for no limit
+*/
+void set_length_filters(int trunclen, int minlen, int maxlen);
+
+/*
+    Returns 1 if any read filter is enabled, 0 otherwise
+*/
+int read_filter_enabled(void);
+
+/*
+    Applies the read filters to seq, in order: primer trimming, truncation
+    at the first low quality base, truncation to the fixed length, expected
+    errors limit and length limits. The quality filters need the read to
+    carry its quality string (FASTQ input).
+
+    Inputs:
+        seq: pointer to the sequence structure - may be trimmed in place
+
+    Returns 1 if the read passes the filters, 0 if it must be dropped
+*/
+int read_filter(sequence* seq);
+
+#endif
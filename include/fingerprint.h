@@ -0,0 +1,73 @@
+#ifndef __FINGERPRINT_H__
+#define __FINGERPRINT_H__
+
+#include <stdint.h>
+#include "mpi.h"
+#include "derep_db.h"
+
+// Tag of the messages of the fingerprint-first transfers
+#define FINGERPRINT_TAG 43
+// Largest piece of a message sent at once, as the MPI counts are ints
+#define FINGERPRINT_PIECE (1 << 30)
+
+typedef struct fingerprint_str {
+    uint64_t key[2];
+    int64_t count;
+} fingerprint;
+
+/*
+    Sets whether the de-replication databases are sent fingerprint-first
+    during the gather
+
+    Inputs:
+        enable: 1 to send the fingerprints first, 0 otherwise
+*/
+void set_fingerprint_gather(int enable);
+
+/*
+    Returns whether the gather sends the fingerprints first
+*/
+int fingerprint_gather_enabled(void);
+
+/*
+    Sends the de-replication database db to process dest fingerprint-first:
+    the 128-bit fingerprints and counts of its uniques go first, the
+    receiver answers with a bitmap of the fingerprints it lacks and only
+    those sequences are sent, together with the labels of all of them
+
+    Inputs:
+        db: de-replication database to send
+        dest: the rank of the destination process
+        comm: the communicator of dest
+*/
+void send_fingerprinted_derep_db(derep_db* db, int dest, MPI_Comm comm);
+
+/*
+    Receives a de-replication database sent by send_fingerprinted_derep_db
+    and merges it with db. The fingerprints of db are indexed on the first
+    call and the index is kept up to date by the following ones, until
+    release_fingerprint_index is called.
+
+    Inputs:
+        db: pointer to the local de-replication database structure
+        source: the rank of the source process
+        comm: the communicator of source
+*/
+void recv_fingerprinted_derep_db(derep_db* db, int source, MPI_Comm comm);
+
+/*
+    Frees the fingerprint index built by recv_fingerprinted_derep_db
+*/
+void release_fingerprint_index(void);
+
+/*
+    Reports how many sequence bodies the fingerprint-first gather avoided
+    sending across all the processes. Must be called by all the processes;
+    rank 0 prints it.
+
+    Inputs:
+        my_rank: process rank
+*/
+void report_fingerprint_gather(int my_rank);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef __HASH_H__
+#define __HASH_H__
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+    Mixes the bits of x (splitmix64 finalizer). Good enough to turn packed
+    k-mers or counters into uniformly distributed 64-bit hashes.
+
+    Inputs:
+        x: the value to hash
+
+    Returns the 64-bit hash of x
+*/
+static inline uint64_t mix64(uint64_t x){
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/*
+    Hashes the first `length` bytes of data, consuming 8 bytes per round
+
+    Inputs:
+        data: pointer to the bytes to hash
+        length: the number of bytes to hash
+        seed: seed of the hash function
+
+    Returns the 64-bit hash of data
+*/
+static inline uint64_t hash_bytes64(const char* data, size_t length, uint64_t seed){
+    uint64_t h = mix64(seed ^ (length * 0x9e3779b97f4a7c15ULL));
+    uint64_t w;
+    size_t i;
+    for(i = 0; i + 8 <= length; i += 8){
+        memcpy(&w, data + i, 8);
+        h = mix64(h ^ w) + 0x9e3779b97f4a7c15ULL;
+    }
+    if(i < length){
+        w = 0;
+        memcpy(&w, data + i, length - i);
+        h = mix64(h ^ w) + 0x9e3779b97f4a7c15ULL;
+    }
+    return mix64(h);
+}
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef __HLL_H__
+#define __HLL_H__
+
+#include <stdint.h>
+
+// Number of bits of the hash that select the register
+#define HLL_PRECISION 14
+// Number of registers - the standard error of the estimate is 1.04/sqrt(HLL_REGISTERS)
+#define HLL_REGISTERS (1 << HLL_PRECISION)
+
+typedef struct hll_str {
+    uint8_t registers[HLL_REGISTERS];
+} hll;
+
+/*
+    Creates a new, empty HyperLogLog sketch
+
+    Returns:
+        the new hll structure
+*/
+hll* create_hll(void);
+
+/*
+    Destroys the HyperLogLog sketch h
+
+    Inputs:
+        h: pointer to the hll structure to destroy
+*/
+void destroy_hll(hll* h);
+
+/*
+    Adds the sequence to the HyperLogLog sketch h
+
+    Inputs:
+        h: pointer to the hll structure
+        sequence: the sequence string
+        length: the length of the sequence
+*/
+void hll_add(hll* h, char* sequence, int length);
+
+/*
+    Estimates the number of distinct sequences added to h
+
+    Inputs:
+        h: pointer to the hll structure
+
+    Returns the estimated cardinality
+*/
+double hll_estimate(hll* h);
+
+/*
+    Merges in place the sketches of all the processes (register-wise
+    maximum), so every process ends up with the sketch of the union
+
+    Inputs:
+        h: pointer to the local hll structure
+*/
+void allreduce_hll(hll* h);
+
+#endif
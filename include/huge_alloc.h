@@ -0,0 +1,87 @@
+#ifndef __HUGE_ALLOC_H__
+#define __HUGE_ALLOC_H__
+
+#include <stddef.h>
+
+// Page backing of the large table allocations
+#define HUGE_PAGES_OFF 0
+// Transparent huge pages, requested with madvise
+#define HUGE_PAGES_TRANSPARENT 1
+// Explicit (hugetlbfs) huge pages, transparent ones if none are reserved
+#define HUGE_PAGES_EXPLICIT 2
+
+// NUMA placement of the large table allocations
+#define NUMA_FIRST_TOUCH 0
+#define NUMA_INTERLEAVE 1
+
+#define HUGE_PAGE_SIZE (2UL << 20)
+// Smallest allocation that gets its own mapping - smaller ones use malloc
+#define HUGE_ALLOC_MIN HUGE_PAGE_SIZE
+// Size of the blocks of the key arena, aligned to their size so a key
+// finds its block header
+#define KEY_ARENA_BLOCK (64UL << 20)
+
+/*
+    Sets how the large tables (the hash bucket arrays and the key arena) are
+    allocated from now on. With NUMA_FIRST_TOUCH the pages are placed on the
+    node of the thread that first writes them, which for the tables is the
+    one inserting in them; NUMA_INTERLEAVE spreads them over all the nodes
+    the process may use.
+
+    Inputs:
+        pages: one of the HUGE_PAGES_* modes
+        numa: one of the NUMA_* placements
+*/
+void set_huge_pages(int pages, int numa);
+
+/*
+    Returns whether the key arena is used for the new sequences
+*/
+int key_arena_enabled(void);
+
+/*
+    Allocates size bytes for a table. The allocations of at least
+    HUGE_ALLOC_MIN bytes get their own anonymous mapping, backed and placed
+    as set with set_huge_pages; the smaller ones come from malloc.
+
+    Inputs:
+        size: the number of bytes
+
+    Returns:
+        a pointer to the new memory
+*/
+void* huge_malloc(size_t size);
+
+/*
+    Releases the memory ptr, allocated with huge_malloc(size)
+
+    Inputs:
+        ptr: pointer to the memory
+        size: the size given to huge_malloc
+*/
+void huge_free(void* ptr, size_t size);
+
+/*
+    Allocates size bytes, 16-byte aligned, for a key in the key arena:
+    blocks of KEY_ARENA_BLOCK bytes allocated as the tables, carved in
+    order, which packs the keys inserted together in the same huge pages.
+    A block is released once all its keys are freed. Not thread-safe: the
+    keys are created by the main thread.
+
+    Inputs:
+        size: the number of bytes
+
+    Returns:
+        a pointer to the new memory, or NULL if size does not fit in a block
+*/
+char* key_arena_alloc(size_t size);
+
+/*
+    Releases the key allocated with key_arena_alloc
+
+    Inputs:
+        key: pointer to the key
+*/
+void key_arena_free(char* key);
+
+#endif
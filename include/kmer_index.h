@@ -0,0 +1,158 @@
+#ifndef __KMER_INDEX_H__
+#define __KMER_INDEX_H__
+
+#include "derep_db.h"
+
+// Maximum number of care positions ('1') in a seed
+#define KMER_MAX_WEIGHT 13
+// Maximum span of a seed (care and don't care positions)
+#define KMER_MAX_SPAN 32
+
+typedef struct kmer_hit_str {
+    int id;
+    int shared;
+    seq_replicas* seq;
+} kmer_hit;
+
+typedef struct kmer_index_str {
+    // Seed description
+    int span;
+    int weight;
+    int care[KMER_MAX_SPAN];
+    int num_kmers;
+    // Indexed sequences - local index -> global id and replica
+    int num_seqs;
+    int capacity;
+    int* ids;
+    seq_replicas** seqs;
+    // Compacted posting lists, in CSR format
+    int* offsets;
+    int* postings;
+    int num_postings;
+    // Postings added after the last compaction, as (kmer, local index) pairs
+    int* pending;
+    int num_pending;
+    int pending_capacity;
+} kmer_index;
+
+typedef struct kmer_search_str {
+    int* shared;
+    int* touched;
+    int capacity;
+    int* kmers;
+    int kmers_capacity;
+} kmer_search;
+
+/*
+    Creates a new empty k-mer index
+
+    Inputs:
+        seed: string describing the seed, with a '1' in the positions that are
+            part of the k-mer and a '0' in the don't care positions
+            (e.g. "11111111" is a contiguous 8-mer and "1101101" a spaced seed)
+
+    Returns:
+        the new kmer_index structure
+*/
+kmer_index* create_kmer_index(char* seed);
+
+/*
+    Creates a k-mer index over the unique sequences of the de-replication
+    database db. Unique ids are assigned following the database iteration
+    order, starting at 0.
+
+    Inputs:
+        db: pointer to the derep_db structure
+        seed: seed description (see create_kmer_index)
+
+    Returns:
+        the new kmer_index structure
+*/
+kmer_index* build_kmer_index(derep_db* db, char* seed);
+
+/*
+    Creates the shard `shard` out of `num_shards` of the k-mer index over the
+    unique sequences of the de-replication database db. The shard holds the
+    uniques whose id modulo num_shards is shard, so every rank of a run can
+    hold its own piece of the index by passing its rank and the number of
+    processes.
+
+    Inputs:
+        db: pointer to the derep_db structure
+        seed: seed description (see create_kmer_index)
+        shard: the index of the shard to build
+        num_shards: the total number of shards
+
+    Returns:
+        the new kmer_index structure
+*/
+kmer_index* build_kmer_index_shard(derep_db* db, char* seed, int shard, int num_shards);
+
+/*
+    Destroys the k-mer index idx. The indexed seq_replicas are not freed.
+
+    Inputs:
+        idx: pointer to the kmer_index structure to destroy
+*/
+void destroy_kmer_index(kmer_index* idx);
+
+/*
+    Computes the sorted list of distinct k-mers of sequence under the seed of
+    the index idx. Windows with a base other than A, C, G, T or U do not
+    produce any k-mer.
+
+    Inputs:
+        idx: pointer to the kmer_index structure
+        sequence: the sequence string
+        kmers: in/out parameter - buffer that holds the k-mers, grown if needed
+        capacity: in/out parameter - the number of ints allocated in kmers
+
+    Returns:
+        the number of distinct k-mers stored in kmers
+*/
+int sequence_kmers(kmer_index* idx, char* sequence, int** kmers, int* capacity);
+
+/*
+    Adds the sequence r (e.g. a new centroid) to the k-mer index with id `id`
+
+    Inputs:
+        idx: pointer to the kmer_index structure
+        r: pointer to the seq_replicas structure to index
+        id: the id to report for this sequence in the query results
+*/
+void kmer_index_add(kmer_index* idx, seq_replicas* r, int id);
+
+/*
+    Creates the scratch space needed to query a k-mer index. Each thread
+    querying the same index needs its own kmer_search structure.
+
+    Returns:
+        the new kmer_search structure
+*/
+kmer_search* create_kmer_search(void);
+
+/*
+    Destroys the query scratch space search
+
+    Inputs:
+        search: pointer to the kmer_search structure to destroy
+*/
+void destroy_kmer_search(kmer_search* search);
+
+/*
+    Looks for the indexed sequences that share the most k-mers with sequence
+
+    Inputs:
+        idx: pointer to the kmer_index structure
+        search: pointer to the kmer_search scratch space
+        sequence: the query sequence
+        n: the maximum number of candidates to return
+        hits: output parameter - array of at least n kmer_hit structures that
+            will hold the candidates, sorted by number of shared k-mers
+
+    Returns:
+        the number of candidates stored in hits
+*/
+int kmer_index_query(kmer_index* idx, kmer_search* search, char* sequence, int n, kmer_hit* hits);
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __LIBPIPECLUST_H__
+#define __LIBPIPECLUST_H__
+
+/*
+    In-process de-replication API of PipeClust (libpipeclust.a)
+
+    Feeds records held in memory to a de-replication database and iterates
+    the unique sequences afterwards, without going through files. A single
+    process can use it without calling MPI_Init; the program is still linked
+    against the MPI library (e.g. with mpicc).
+
+    Different databases are independent, but a database must not be used
+    from several threads at the same time.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Return codes
+#define PIPECLUST_OK 0
+#define PIPECLUST_EINVALID -1
+#define PIPECLUST_EFINALIZED -2
+
+// Flags of pipeclust_create
+#define PIPECLUST_NO_NORMALIZE 0x01
+#define PIPECLUST_NO_SORT 0x02
+
+typedef struct pipeclust_str pipeclust;
+
+typedef struct pipeclust_record_str {
+    const char* label;
+    const char* sequence;
+    // Length of the sequence - negative if it is NUL-terminated
+    int length;
+} pipeclust_record;
+
+typedef struct pipeclust_unique_str {
+    const char* sequence;
+    int length;
+    int count;
+    int num_labels;
+    // The labels of the records with this sequence - owned by the database
+    char** labels;
+} pipeclust_unique;
+
+/*
+    Creates a new, empty de-replication database
+
+    Inputs:
+        flags: PIPECLUST_NO_NORMALIZE to keep the sequences byte-exact
+            instead of uppercasing them and mapping U to T, and
+            PIPECLUST_NO_SORT to iterate the uniques in insertion order
+            instead of by decreasing abundance. 0 for the defaults.
+
+    Returns:
+        the new database, or NULL if it could not be allocated
+*/
+pipeclust* pipeclust_create(int flags);
+
+/*
+    De-replicates a batch of records against the database. The records are
+    copied, so the caller can reuse them as soon as this call returns.
+
+    Inputs:
+        pc: pointer to the database
+        records: array of records
+        num_records: the number of records
+
+    Returns PIPECLUST_OK, PIPECLUST_EINVALID if a sequence holds a character
+    that is not an IUPAC nucleotide code (the records before it have been
+    added) or PIPECLUST_EFINALIZED if the database was already finalized
+*/
+int pipeclust_add(pipeclust* pc, const pipeclust_record* records, int num_records);
+
+/*
+    Finalizes the database: no more records can be added, and the uniques
+    are sorted by decreasing abundance unless PIPECLUST_NO_SORT was given
+
+    Inputs:
+        pc: pointer to the database
+*/
+void pipeclust_finalize(pipeclust* pc);
+
+/*
+    Returns the number of records added to the database
+*/
+long pipeclust_num_records(pipeclust* pc);
+
+/*
+    Returns the number of unique sequences in the database
+*/
+int pipeclust_num_uniques(pipeclust* pc);
+
+/*
+    Fetches the next unique sequence of a finalized database. The first
+    call returns the first unique, and pipeclust_rewind starts over. The
+    pointers in unique are valid until the database is destroyed.
+
+    Inputs:
+        pc: pointer to the finalized database
+        unique: output parameter - the next unique sequence
+
+    Returns 1 if a unique was fetched, 0 if there are no more uniques
+*/
+int pipeclust_next_unique(pipeclust* pc, pipeclust_unique* unique);
+
+/*
+    Makes pipeclust_next_unique start again from the first unique
+*/
+void pipeclust_rewind(pipeclust* pc);
+
+/*
+    Destroys the database and everything it holds
+
+    Inputs:
+        pc: pointer to the database
+*/
+void pipeclust_destroy(pipeclust* pc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
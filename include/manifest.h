@@ -0,0 +1,51 @@
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+/*
+    Reads the manifest file `manifest`: one input path per line. Empty
+    lines and lines starting with '#' are skipped, and anything after a tab
+    is ignored.
+
+    Inputs:
+        manifest: the manifest path
+        num_files: output parameter - the number of input paths
+
+    Returns the array of input paths
+*/
+char** read_manifest(char* manifest, int* num_files);
+
+/*
+    Assigns each file to a process with the LPT (longest processing time
+    first) rule: the files are taken from the largest to the smallest and
+    each one goes to the process with the fewest bytes assigned so far
+
+    Inputs:
+        sizes: the size of each file, in bytes
+        num_files: the number of files
+        comm_sz: the number of processes
+
+    Returns the array with the process assigned to each file
+*/
+int* plan_bundles(long long* sizes, int num_files, int comm_sz);
+
+/*
+    Reads the manifest in the process with rank 0, looks up the size of each
+    input there and sends each process its bundle of inputs, planned with
+    plan_bundles. The inputs of a bundle keep their manifest order.
+
+    Inputs:
+        manifest: the manifest path - only used in rank 0
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+        num_files: output parameter - the number of inputs in my bundle
+
+    Returns the array of input paths of my bundle - free with free_bundle
+*/
+char** scatter_manifest(char* manifest, int my_rank, int comm_sz, int* num_files);
+
+/*
+    Frees the bundle returned by scatter_manifest
+*/
+void free_bundle(char** bundle);
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef __OUT_WRITER_H__
+#define __OUT_WRITER_H__
+
+#include <string.h>
+#include <pthread.h>
+
+// Size of each of the two buffers of a writer
+#define WRITER_BUFFER_SIZE (1 << 22)
+
+typedef struct out_writer_str {
+    int fd;
+    char* path;
+    char* buffers[2];
+    int current;
+    size_t used;
+    size_t pending;
+    int done;
+    int error;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} out_writer;
+
+/*
+    Opens the file path for writing through a buffered writer. The output is
+    formatted into one buffer while a background thread writes the other.
+
+    Inputs:
+        path: the output filename
+
+    Returns:
+        the new out_writer structure
+*/
+out_writer* create_out_writer(char* path);
+
+/*
+    Writes out everything still buffered in w, closes its file and destroys
+    the writer. Any write error is fatal.
+
+    Inputs:
+        w: pointer to the out_writer structure
+*/
+void destroy_out_writer(out_writer* w);
+
+/*
+    Hands the current buffer of w to the background thread, waiting for the
+    previous one to be written first
+
+    Inputs:
+        w: pointer to the out_writer structure
+*/
+void flush_out_writer(out_writer* w);
+
+/*
+    Makes sure there is room for n more bytes in the current buffer of w.
+    n must not exceed WRITER_BUFFER_SIZE.
+*/
+static inline char* writer_reserve(out_writer* w, size_t n){
+    if(w->used + n > WRITER_BUFFER_SIZE)
+        flush_out_writer(w);
+    return w->buffers[w->current] + w->used;
+}
+
+/*
+    Appends the character c to w
+*/
+static inline void writer_put_char(out_writer* w, char c){
+    *writer_reserve(w, 1) = c;
+    ++w->used;
+}
+
+/*
+    Appends the len bytes of data to w
+*/
+static inline void writer_put(out_writer* w, const char* data, size_t len){
+    // Longer strings than the buffer are copied in pieces
+    while(len > WRITER_BUFFER_SIZE){
+        writer_put(w, data, WRITER_BUFFER_SIZE);
+        data += WRITER_BUFFER_SIZE;
+        len -= WRITER_BUFFER_SIZE;
+    }
+    memcpy(writer_reserve(w, len), data, len);
+    w->used += len;
+}
+
+/*
+    Appends the string s to w
+*/
+static inline void writer_put_str(out_writer* w, const char* s){
+    writer_put(w, s, strlen(s));
+}
+
+/*
+    Appends the decimal representation of the non-negative integer value to w
+*/
+static inline void writer_put_int(out_writer* w, long value){
+    char digits[24];
+    int i = sizeof(digits);
+    // Build the digits backwards
+    do{
+        digits[--i] = '0' + (value % 10);
+        value /= 10;
+    }while(value);
+    writer_put(w, digits + i, sizeof(digits) - i);
+}
+
+#endif
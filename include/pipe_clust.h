@@ -1,8 +1,82 @@
 #ifndef __PIPECLUST_H__
 #define __PIPECLUST_H__
 
+#include <stddef.h>
 #include "derep_db.h"
 
+// De-replication engines
+#define DEREP_ENGINE_HASH 0
+#define DEREP_ENGINE_SORT 1
+#define DEREP_ENGINE_RMA 2
+
+/*
+    Sets the de-replication engine used by the following de-replications
+
+    Inputs:
+        engine: DEREP_ENGINE_HASH to insert every sequence in a hash table,
+            DEREP_ENGINE_SORT to radix sort batches of sequences and collapse
+            the runs of equal sequences, gathering with a parallel sample sort,
+            DEREP_ENGINE_RMA to de-replicate locally in a hash table and
+            merge the tables in a distributed table over MPI one-sided
+            operations instead of gathering them
+*/
+void set_derep_engine(int engine);
+
+/*
+    Sets whether the de-replication tables are pre-sized. If set, the input
+    is read twice: a first pass estimates the number of unique sequences
+    with a HyperLogLog sketch, merged across the processes, so the local
+    tables and the tables receiving the gather are created with enough
+    buckets to never grow.
+
+    Inputs:
+        presize: 1 to run the cardinality estimation pass, 0 otherwise
+*/
+void set_presize(int presize);
+
+/*
+    Sets whether the hash engine merges the tables of the processes of each
+    node through shared memory before gathering them across the nodes,
+    where only one process per node takes part. Disabled by default.
+
+    Inputs:
+        node_gather: 1 for the node-aware gather, 0 for a flat one
+*/
+void set_node_gather(int node_gather);
+
+/*
+    Sets whether the de-replications leave the local databases in their
+    processes instead of gathering them in rank 0, so they can be written
+    with write_distributed_output (see dist_output.h)
+
+    Inputs:
+        distributed: 1 to skip the gather, 0 otherwise
+*/
+void set_distributed_output(int distributed);
+
+/*
+    Sets whether the runs of regular input files of each process are read
+    through an io_uring reader, which submits the opens and reads of the
+    next files ahead of the parser (see uring_reader.h). Falls back to
+    blocking reads if the kernel does not provide io_uring.
+
+    Inputs:
+        io_uring: 1 to submit the opens and reads ahead, 0 for blocking reads
+*/
+void set_io_uring(int io_uring);
+
+/*
+    Sets the memory budget of the de-replication table of each process.
+    When a table grows beyond the budget while reading, it is spilled to
+    disk and merged back, partition by partition, once all the input has
+    been read.
+
+    Inputs:
+        bytes: the memory budget, in bytes - 0 means no limit
+        spill_dir: directory where the spilled tables are written
+*/
+void set_memory_limit(size_t bytes, char* spill_dir);
+
 /*
     Serially de-replicates the list of files fasta_fps.
 
@@ -14,6 +88,20 @@
 */
 derep_db* serial_dereplication(char** fasta_fps, int count);
 
+/*
+    De-replicates the share of the list of files fasta_fps that corresponds
+    to the process my_rank, without gathering the results.
+
+    Inputs:
+        fasta_fps: list of fasta filepaths
+        count: the number of fasta filepaths
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+
+    Returns a pointer to the local de-replication database
+*/
+derep_db* local_dereplication(char** fasta_fps, int count, int my_rank, int comm_sz);
+
 /*
     De-replicates the list of files fasta_fps in parallel.
 
@@ -27,4 +115,19 @@ derep_db* serial_dereplication(char** fasta_fps, int count);
 */
 derep_db* parallel_dereplication(char** fasta_fps, int count, int my_rank, int comm_sz);
 
+/*
+    De-replicates the files listed in a manifest in parallel. Rank 0 reads
+    the manifest (one path per line), looks up the size of every file and
+    assigns them to the processes with LPT bin packing, so each process
+    reads a bundle of about the same number of bytes.
+
+    Inputs:
+        manifest: path of the manifest - only read by rank 0
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+
+    Returns a pointer to the de-replication database
+*/
+derep_db* manifest_dereplication(char* manifest, int my_rank, int comm_sz);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,151 @@
+#ifndef __REF_INDEX_H__
+#define __REF_INDEX_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include "kmer_index.h"
+
+// Identifies the reference index files and their layout version
+#define REF_INDEX_MAGIC "PCREFIDX"
+#define REF_INDEX_VERSION 1
+// Length of the k-mers indexed (4^k posting lists)
+#define REF_INDEX_K 8
+#define REF_INDEX_NUM_KMERS (1 << (2 * REF_INDEX_K))
+// Contiguous seed of REF_INDEX_K positions, for sequence_kmers
+#define REF_INDEX_SEED "11111111"
+
+/*
+    Layout of a reference index file, mapped as is in memory. The header is
+    followed by these sections, each one starting at a multiple of 8 bytes:
+        uint64_t name_offsets[num_refs + 1]      into names
+        uint64_t seq_offsets[num_refs + 1]       into seqs
+        uint64_t kmer_offsets[REF_INDEX_NUM_KMERS + 1]  into postings
+        uint32_t postings[num_postings]          the references holding
+                                                 each k-mer, in order
+        char names[names_bytes]                  NUL-terminated labels
+        char seqs[seqs_bytes]                    NUL-terminated sequences
+*/
+typedef struct ref_index_header_str {
+    char magic[8];
+    uint32_t version;
+    uint32_t k;
+    uint64_t num_refs;
+    uint64_t num_postings;
+    uint64_t names_bytes;
+    uint64_t seqs_bytes;
+} ref_index_header;
+
+typedef struct ref_index_str {
+    // The mapping of the whole file
+    void* map;
+    size_t map_size;
+    // Views of its sections
+    ref_index_header* header;
+    uint64_t* name_offsets;
+    uint64_t* seq_offsets;
+    uint64_t* kmer_offsets;
+    uint32_t* postings;
+    char* names;
+    char* seqs;
+} ref_index;
+
+typedef struct ref_hit_str {
+    int ref;
+    int shared;
+} ref_hit;
+
+typedef struct ref_search_str {
+    // Seed only k-mer index giving the k-mers of the queries
+    kmer_index* seed;
+    int* shared;
+    int* touched;
+    int* kmers;
+    int kmers_capacity;
+} ref_search;
+
+/*
+    Builds the reference index of the (single line) FASTA file fasta and
+    writes it to the file index
+
+    Inputs:
+        fasta: path to the reference FASTA file
+        index: path to the output index file
+*/
+void build_ref_index(char* fasta, char* index);
+
+/*
+    Maps the reference index file index in memory, read-only and shared,
+    so the processes of a node use a single copy from the page cache
+
+    Inputs:
+        index: path to the index file
+
+    Returns:
+        the new ref_index structure
+*/
+ref_index* open_ref_index(char* index);
+
+/*
+    Unmaps the reference index idx
+
+    Inputs:
+        idx: pointer to the ref_index structure
+*/
+void close_ref_index(ref_index* idx);
+
+/*
+    Returns the label of the reference ref of the index idx
+*/
+char* ref_name(ref_index* idx, int ref);
+
+/*
+    Returns the sequence of the reference ref of the index idx
+*/
+char* ref_sequence(ref_index* idx, int ref);
+
+/*
+    Returns the length of the sequence of the reference ref of the index idx
+*/
+int ref_length(ref_index* idx, int ref);
+
+/*
+    Creates the scratch space needed to query the reference index idx
+
+    Inputs:
+        idx: pointer to the ref_index structure
+
+    Returns:
+        the new ref_search structure
+*/
+ref_search* create_ref_search(ref_index* idx);
+
+/*
+    Destroys the ref_search structure search
+
+    Inputs:
+        search: pointer to the ref_search structure
+*/
+void destroy_ref_search(ref_search* search);
+
+/*
+    Looks for the references that share the most distinct k-mers with
+    sequence, among those that may hold it with at most max_edits edits:
+    an edit breaks at most REF_INDEX_K k-mers, so such a reference shares
+    all but REF_INDEX_K * max_edits of the distinct k-mers of sequence
+
+    Inputs:
+        idx: pointer to the ref_index structure
+        search: pointer to the ref_search scratch space
+        sequence: the query sequence
+        max_edits: the largest edit distance of interest
+        n: the maximum number of candidates to return
+        hits: output parameter - array of at least n ref_hit structures that
+            will hold the candidates, by decreasing number of shared k-mers
+            and then increasing reference index
+
+    Returns:
+        the number of candidates stored in hits
+*/
+int ref_index_query(ref_index* idx, ref_search* search, char* sequence, int max_edits, int n, ref_hit* hits);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __RMA_TABLE_H__
+#define __RMA_TABLE_H__
+
+#include "derep_db.h"
+
+// Number of local uniques published per round of remote operations
+#define RMA_BATCH 4096
+// Slots of the distributed table per global unique sequence (1 / load factor)
+#define RMA_SLOTS_PER_UNIQUE 2
+
+/*
+    Builds the global de-replication table with MPI one-sided operations and
+    materializes it in the process with rank 0. This replaces
+    gather_derep_db for the RMA engine.
+
+    The table is open addressing over MPI windows spread across the
+    processes, each one hosting the slots of the fingerprints it is the
+    target of, sized for the most loaded one. Each slot holds a 64-bit
+    fingerprint of a sequence and the head of a chain of the blocks that
+    hold its sequence and labels. Every process serializes its local
+    uniques as blocks in its own arena. It then publishes them in batches:
+    it claims a slot with MPI_Compare_and_swap on the fingerprint and
+    pushes its block onto the chain with an atomic MPI_Fetch_and_op swap of
+    the head. Once every process has published, the global view (the
+    chains) is complete across the windows. Rank 0 then walks the chains
+    a batch of slots at a time with MPI_Get, reading the labels of every
+    block but each sequence only once, and streams them into the database
+    without copying any table or arena. When all the processes share a
+    node, the table is a shared memory window.
+
+    Inputs:
+        db: the local derep_db - will be modified in place; it ends up
+            empty in every process but rank 0
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void rma_derep_db(derep_db* db, int my_rank, int comm_sz);
+
+#endif
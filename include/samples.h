@@ -0,0 +1,73 @@
+#ifndef __SAMPLES_H__
+#define __SAMPLES_H__
+
+#include "utarray.h"
+
+typedef struct sample_count_str {
+    int sample;
+    int count;
+} sample_count;
+
+// utarray description of the sample_count pairs
+extern UT_icd sample_count_icd;
+
+/*
+    Sets the separator between the sample id and the read id in the
+    sequence labels (e.g. '_' for labels like `SampleID_readnum`). When it is
+    set, new de-replication databases keep a sparse (sample, count) list per
+    unique sequence instead of all the labels.
+
+    Inputs:
+        sep: the separator character - '\0' keeps all the labels
+*/
+void set_sample_separator(char sep);
+
+/*
+    Returns the current sample separator, '\0' if labels are kept
+*/
+char get_sample_separator(void);
+
+/*
+    Returns the integer id of the sample of label, interning the sample name
+    if it has not been seen before. The sample name is the label up to the
+    last occurrence of the separator, or the whole label if it has none.
+
+    Inputs:
+        label: the sequence label
+*/
+int intern_sample_label(char* label);
+
+/*
+    Returns the integer id of the sample name, interning it if it has not
+    been seen before
+
+    Inputs:
+        name: the sample name
+        length: the length of the sample name
+*/
+int intern_sample(char* name, int length);
+
+/*
+    Returns the name of the sample with id `id`
+*/
+char* get_sample_name(int id);
+
+/*
+    Returns the number of samples interned by this process
+*/
+int get_num_samples(void);
+
+/*
+    Adds `count` reads of sample `sample` to the sparse list samples, which
+    is kept sorted by sample id
+
+    Inputs:
+        samples: utarray of sample_count
+        sample: the sample id
+        count: the number of reads to add
+
+    Returns 1 if a new pair was added to the list, 0 otherwise
+*/
+int add_sample_count(UT_array* samples, int sample, int count);
+
+#endif
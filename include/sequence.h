@@ -3,15 +3,51 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include "stream.h"
 
 struct sequence_str{
     char* sequence __attribute__ ((aligned (16)));
     char* label;
+    char* quality;
     int seq_length;
     int label_length;
 };
 typedef struct sequence_str sequence;
 
+/*
+    Sets whether the sequences are normalized while reading. Normalized
+    sequences are uppercased, with 'U' mapped to 'T' and the trailing '\r'
+    of Windows line endings removed. Enabled by default.
+
+    Inputs:
+        normalize: 1 to normalize the sequences, 0 to keep them as they are
+*/
+void set_normalize(int normalize);
+
+/*
+    Sets whether any character of a normalized sequence that is not an
+    IUPAC nucleotide code (such as the '-' or '.' of alignment gaps) is a
+    fatal error. Disabled by default.
+
+    Inputs:
+        strict: 1 to check the sequences, 0 to keep those characters
+*/
+void set_strict_iupac(int strict);
+
+/*
+    Normalizes the `length` characters of sequence in place: lowercase
+    letters are uppercased and 'U' is mapped to 'T'
+
+    Inputs:
+        sequence: the sequence string
+        length: the number of characters of the sequence
+        strict: 1 to check the characters, 0 to keep them as they are
+
+    Returns the position of the first character that is not an IUPAC
+    nucleotide code, or -1 if all the characters are valid or strict is 0
+*/
+int normalize_sequence(char* sequence, int length, int strict);
+
 /*
     Allocates the memory for a new sequence structure
 
@@ -20,13 +56,24 @@ typedef struct sequence_str sequence;
 sequence* new_sequence();
 
 /*
-    Reads the next sequence present in the file pointed by fd
+    Reads the next sequence present in the file pointed by fd. Both FASTA
+    (single line sequences) and FASTQ records are accepted; the quality
+    string of FASTQ records is kept in seq->quality, NULL for FASTA.
 
     Returns a pointer to the read sequence structure or NULL if no
     more sequences are present on the file
 */
 sequence* read_sequence(FILE *fd);
 
+/*
+    Reads the next sequence present in the stream s, with the same formats
+    as read_sequence
+
+    Returns a pointer to the read sequence structure or NULL if no
+    more sequences are present on the stream
+*/
+sequence* read_stream_sequence(stream* s);
+
 /*
     Reads the sequence number `idx` present in the file pointed by fd
 
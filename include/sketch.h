@@ -0,0 +1,74 @@
+#ifndef __SKETCH_H__
+#define __SKETCH_H__
+
+#include <stdint.h>
+#include "derep_db.h"
+
+// Number of bins of a sketch - must be a multiple of 8
+#define SKETCH_SIZE 64
+// Length of the k-mers hashed into the sketch
+#define SKETCH_K 12
+// Value of the bins that did not receive any k-mer
+#define SKETCH_EMPTY 0xFFFF
+// Largest number of sketches broadcast at once
+#define SKETCH_BCAST_PIECE (1 << 20)
+
+/*
+    Computes the one-permutation MinHash sketch of sequence: the k-mers are
+    hashed into SKETCH_SIZE bins and each bin keeps the lowest 16 bits of the
+    minimum hash it received. A sketch takes 2 * SKETCH_SIZE bytes.
+
+    Inputs:
+        sequence: the sequence string
+        sketch: output parameter - array of SKETCH_SIZE values, 16-byte aligned
+*/
+void compute_sketch(char* sequence, uint16_t* sketch);
+
+/*
+    Estimates the Jaccard similarity between the k-mer sets of two sequences
+    from their sketches, comparing 8 bins per SSE2 instruction
+
+    Inputs:
+        a, b: the sketches to compare, 16-byte aligned
+
+    Returns the estimated Jaccard similarity, in [0, 1]
+*/
+float sketch_jaccard(uint16_t* a, uint16_t* b);
+
+/*
+    Computes the Jaccard similarity expected between the k-mer sets of two
+    sequences with the given identity, assuming uniformly spread differences.
+    Pairs whose estimate falls well below this value can be dropped before
+    running any alignment.
+
+    Inputs:
+        identity: the sequence identity, in [0, 1]
+
+    Returns the expected Jaccard similarity
+*/
+float sketch_jaccard_threshold(float identity);
+
+/*
+    Collects the sketches of the uniques in a contiguous array, in the
+    order of the array. The uniques without a sketch get it computed.
+
+    Inputs:
+        uniques: array of pointers to the seq_replicas structures
+        n: the number of uniques
+
+    Returns a pointer to an array of n * SKETCH_SIZE values, 16-byte aligned
+*/
+uint16_t* collect_sketches(seq_replicas** uniques, int n);
+
+/*
+    Broadcasts an array of sketches from process root to all the processes
+
+    Inputs:
+        sketches: in/out parameter - the array of sketches. Only meaningful in
+            root, allocated by this function in the rest of processes
+        num_sketches: in/out parameter - the number of sketches in the array
+        root: the rank of the process that holds the sketches
+*/
+void bcast_sketches(uint16_t** sketches, int* num_sketches, int root);
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef __SORT_DEREP_H__
+#define __SORT_DEREP_H__
+
+#include <stdint.h>
+#include "derep_db.h"
+
+// Number of records buffered before each sort
+#define SORT_BATCH_SIZE (1 << 20)
+// Largest piece of the key ranges sent at once, as the MPI counts are ints
+#define SORT_PIECE (1 << 30)
+
+typedef struct sort_record_str {
+    uint64_t key;
+    char* sequence;
+    char* label;
+} sort_record;
+
+typedef struct sorted_uniques_str {
+    int num;
+    int capacity;
+    uint64_t* keys;
+    seq_replicas** seqs;
+} sorted_uniques;
+
+typedef struct sort_derep_str {
+    int count;
+    int num_records;
+    sort_record* records;
+    sort_record* scratch;
+    sorted_uniques* uniques;
+} sort_derep;
+
+/*
+    Returns the sort key of sequence: a 64-bit fingerprint of the sequence.
+    Uniques are ordered by (key, sequence).
+
+    Inputs:
+        sequence: the sequence string
+        length: the length of the sequence
+*/
+uint64_t sort_key(char* sequence, int length);
+
+/*
+    Creates a new sort-based de-replication engine
+
+    Returns:
+        the new sort_derep structure
+*/
+sort_derep* create_sort_derep(void);
+
+/*
+    Adds the sequence seq to the sort-based de-replication engine s. The
+    engine takes ownership of seq, which must not be used afterwards.
+
+    Inputs:
+        s: pointer to the sort_derep structure
+        seq: pointer to the sequence structure
+*/
+void sort_derep_add(sort_derep* s, sequence* seq);
+
+/*
+    Sorts the records still buffered in s and moves all the unique sequences
+    into db, in (key, sequence) order. The engine is destroyed.
+
+    Inputs:
+        s: pointer to the sort_derep structure
+        db: pointer to the derep_db structure that receives the uniques
+*/
+void finish_sort_derep(sort_derep* s, derep_db* db);
+
+/*
+    Collects the de-replication databases of all the processes in the
+    process with rank 0 using a parallel sample sort: the uniques are
+    partitioned by key range across the processes, each process merges its
+    range, and the disjoint ranges are concatenated in rank 0. This replaces
+    gather_derep_db for the sort-based engine.
+
+    Inputs:
+        db: the local derep_db - will be modified in place
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void sample_sort_derep_db(derep_db* db, int my_rank, int comm_sz);
+
+#endif
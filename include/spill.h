@@ -0,0 +1,58 @@
+#ifndef __SPILL_H__
+#define __SPILL_H__
+
+#include "derep_db.h"
+
+// Number of hash partitions of the spilled runs
+#define SPILL_PARTITIONS 16
+
+typedef struct spill_str {
+    char* dir;
+    int my_rank;
+    int num_runs;
+} spill;
+
+/*
+    Creates a new spill area for the de-replication tables of this process
+
+    Inputs:
+        dir: directory where the runs are written
+        my_rank: process rank, used to name the run files
+
+    Returns:
+        the new spill structure
+*/
+spill* create_spill(char* dir, int my_rank);
+
+/*
+    Destroys the spill area s, removing all its run files
+
+    Inputs:
+        s: pointer to the spill structure to destroy
+*/
+void destroy_spill(spill* s);
+
+/*
+    Writes the contents of the de-replication database db to disk as a new
+    run of SPILL_PARTITIONS files, one per hash partition, with the records
+    sorted by sequence. The unique sequences are removed from db, but its
+    sequence counter is kept.
+
+    Inputs:
+        s: pointer to the spill structure
+        db: pointer to the derep_db structure to spill
+*/
+void spill_derep_db(spill* s, derep_db* db);
+
+/*
+    Merges all the spilled runs with the contents of the de-replication
+    database db, one partition at a time, so db ends up holding all the
+    unique sequences. Only one partition of the runs is read at once.
+
+    Inputs:
+        s: pointer to the spill structure
+        db: pointer to the derep_db structure
+*/
+void merge_spilled_runs(spill* s, derep_db* db);
+
+#endif
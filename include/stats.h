@@ -0,0 +1,89 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <time.h>
+
+// Execution phases that are timed
+typedef enum {
+    PHASE_READ = 0,
+    PHASE_DEREP,
+    PHASE_GATHER,
+    PHASE_SORT,
+    PHASE_WRITE,
+    PHASE_PRESIZE,
+    PHASE_DENOISE,
+    PHASE_CLOSED_REF,
+    NUM_PHASES
+} stats_phase;
+
+typedef struct run_stats_str {
+    double phase_time[NUM_PHASES];
+    double reads;
+    double bytes_read;
+    double hash_probes;
+    double bytes_sent;
+    double bytes_recv;
+    double local_unique;
+    double load_factor;
+    double filtered;
+    double bytes_uncompressed;
+    double huge_page_bytes;
+    double dtlb_load_misses;
+    double tlb_counted;
+    double page_faults;
+    double primers_trimmed;
+    double sketch_rejects;
+} run_stats;
+
+// Whether the counters are being collected - checked before touching them
+extern int STATS_ENABLED;
+// The counters of this process
+extern run_stats STATS;
+
+/*
+    Returns the current value of a monotonic clock, in seconds
+*/
+static inline double stats_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Adds value to the counter `field` if the counters are enabled
+#define STATS_ADD(field, value)                                                  \
+do {                                                                             \
+    if(STATS_ENABLED)                                                            \
+        STATS.field += (value);                                                  \
+} while(0)
+
+// Starts a timer stored in the double `var`
+#define STATS_TIC(var)                                                           \
+    double var = STATS_ENABLED ? stats_now() : 0.0
+
+// Adds the time elapsed since `var` to the phase `phase`
+#define STATS_TOC(phase, var)                                                    \
+do {                                                                             \
+    if(STATS_ENABLED)                                                            \
+        STATS.phase_time[phase] += stats_now() - (var);                          \
+} while(0)
+
+/*
+    Enables the collection of the performance counters and resets them. The
+    data TLB load misses are counted by the CPU when the kernel exposes its
+    counter (tlb_counted is then 1), and the minor page faults always.
+*/
+void enable_stats(void);
+
+/*
+    Collects the performance counters of all the processes in the process
+    with rank 0, which writes them as a JSON report to the file `path`.
+    Must be called by all the processes.
+
+    Inputs:
+        path: path to the output JSON file
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void write_stats_report(char* path, int my_rank, int comm_sz);
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stddef.h>
+
+// Size of the read buffer of a stream
+#define STREAM_BUFFER_SIZE (1 << 22)
+// Size of the blocks requested to the kernel on each read
+#define STREAM_BLOCK_SIZE (1 << 20)
+
+// Source of the blocks of a stream that is not read from a descriptor:
+// copies up to size bytes to dst, returns how many (0 at the end)
+typedef size_t (*stream_source)(void* source, char* dst, size_t size);
+
+typedef struct stream_str {
+    int fd;
+    stream_source fill;
+    void* source;
+    char* path;
+    char* buffer;
+    size_t start;
+    size_t end;
+    int eof;
+} stream;
+
+/*
+    Returns 1 if the input path can only be read sequentially: '-' (the
+    standard input), a named pipe or a character device. 0 otherwise.
+
+    Inputs:
+        path: the input path
+*/
+int is_stream_input(char* path);
+
+/*
+    Opens the input path for sequential reading in large blocks. '-'
+    stands for the standard input.
+
+    Inputs:
+        path: the input path
+
+    Returns:
+        the new stream structure
+*/
+stream* open_stream(char* path);
+
+/*
+    Opens a stream over the blocks handed by fill (e.g. the buffers of an
+    asynchronous reader) instead of a file descriptor
+
+    Inputs:
+        path: the input path, for the error messages
+        fill: the function that hands the blocks of the input
+        source: the first argument of fill
+
+    Returns:
+        the new stream structure
+*/
+stream* open_source_stream(char* path, stream_source fill, void* source);
+
+/*
+    Closes the stream s and frees its memory. The standard input and the
+    sources of open_source_stream are not closed.
+
+    Inputs:
+        s: pointer to the stream structure
+*/
+void close_stream(stream* s);
+
+/*
+    Returns the next line of the stream s, including its '\n' if present,
+    as a pointer inside the stream buffer, valid until the next call. The
+    line is not NUL-terminated.
+
+    Inputs:
+        s: pointer to the stream structure
+        length: output parameter - the length of the line
+
+    Returns a pointer to the line or NULL at the end of the stream
+*/
+char* stream_getline(stream* s, size_t* length);
+
+#endif
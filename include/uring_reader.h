@@ -0,0 +1,117 @@
+#ifndef __URING_READER_H__
+#define __URING_READER_H__
+
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+#include "stream.h"
+
+// Number of entries of the submission queue
+#define URING_ENTRIES 64
+// Number of files opened ahead of the one being parsed
+#define URING_FILES_AHEAD 8
+// Number of read buffers and their size
+#define URING_BUFFERS 16
+#define URING_CHUNK STREAM_BLOCK_SIZE
+// Largest number of buffers held by the file being parsed. The files ahead
+// hold at most one, so URING_FILES_AHEAD - 1 + URING_FILE_DEPTH <=
+// URING_BUFFERS keeps buffers available for the file being parsed
+#define URING_FILE_DEPTH 4
+
+typedef struct uring_str {
+    int fd;
+    // Submission queue
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned to_submit;
+    // Requests submitted or queued whose completion is not handled yet
+    unsigned in_flight;
+    // Completion queue
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+    // The mappings of the rings
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+} uring;
+
+typedef struct uring_file_str {
+    char* path;
+    int fd;
+    int state;
+    // Requests of the open (the open and the statx) not completed yet
+    int opening;
+    // Result of the statx, and the size of the file when it was opened
+    struct statx stx;
+    long size;
+    // Next chunk to request and to hand to the parser
+    int next_chunk;
+    int next_consume;
+    // Buffers requested or holding data of this file
+    int held;
+    // First chunk past the end of the file - -1 until it is open
+    int eof_chunk;
+} uring_file;
+
+typedef struct uring_buffer_str {
+    char* data;
+    int state;
+    int file;
+    int chunk;
+    size_t length;
+    size_t consumed;
+} uring_buffer;
+
+typedef struct uring_reader_str {
+    uring ring;
+    uring_file* files;
+    int num_files;
+    // File being parsed and its stream
+    int current;
+    stream* s;
+    // Next parsed file to close
+    int next_close;
+    uring_buffer buffers[URING_BUFFERS];
+} uring_reader;
+
+/*
+    Creates a reader of the regular files paths, in order, that submits the
+    opens and reads of the next URING_FILES_AHEAD files to an io_uring
+    instance ahead of the parser and keeps the completed reads in a pool of
+    buffers
+
+    Inputs:
+        paths: the list of file paths
+        num_files: the number of file paths
+
+    Returns:
+        the new uring_reader structure, or NULL if the kernel does not
+        provide io_uring
+*/
+uring_reader* create_uring_reader(char** paths, int num_files);
+
+/*
+    Destroys the reader r
+
+    Inputs:
+        r: pointer to the uring_reader structure
+*/
+void destroy_uring_reader(uring_reader* r);
+
+/*
+    Returns a stream over the next file of the reader r, valid until the
+    next call, or NULL after the last file. The stream is fed from the
+    completed reads; it only waits on the ring when none is ready.
+
+    Inputs:
+        r: pointer to the uring_reader structure
+*/
+stream* uring_next_stream(uring_reader* r);
+
+#endif
@@ -6,6 +6,15 @@
 #define WARN_ERROR 1
 #define FATAL_ERROR 2
 
+#include <stddef.h>
+
+// Growable array of bytes, used to serialize messages
+typedef struct byte_buffer_str {
+    char* data;
+    size_t size;
+    size_t capacity;
+} byte_buffer;
+
 /*
     Prints an error through stderr
     
@@ -19,4 +28,14 @@
 */
 void error_handler(int level, char* format, ...);
 
+/*
+    Appends `size` bytes from data to the buffer b, growing it as needed
+
+    Inputs:
+        b: pointer to the byte_buffer structure
+        data: the bytes to append
+        size: the number of bytes to append
+*/
+void buffer_append(byte_buffer* b, void* data, size_t size);
+
 #endif
\ No newline at end of file
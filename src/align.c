@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "align.h"
+
+/*
+    Computes the edit distance between the sequences a and b if it is at
+    most max_dist
+
+    Inputs:
+        a: the first sequence
+        length_a: the length of a
+        b: the second sequence
+        length_b: the length of b
+        max_dist: the largest distance of interest
+
+    Returns the edit distance between a and b, or max_dist + 1 if it is
+    larger than max_dist
+*/
+int bounded_edit_distance(char* a, int length_a, char* b, int length_b, int max_dist){
+    int i;
+    int j;
+    int over = max_dist + 1;
+    // The length difference alone needs that many insertions
+    if(abs(length_a - length_b) > max_dist)
+        return over;
+    // Two rows of the matrix over b; the cells outside the band are over
+    int* previous = (int*) malloc(sizeof(int) * (length_b + 1));
+    int* current = (int*) malloc(sizeof(int) * (length_b + 1));
+    for(j = 0; j <= length_b; j++)
+        previous[j] = (j <= max_dist) ? j : over;
+    for(i = 1; i <= length_a; i++){
+        int first = (i - max_dist > 1) ? i - max_dist : 1;
+        int last = (i + max_dist < length_b) ? i + max_dist : length_b;
+        int row_min = over;
+        current[0] = (i <= max_dist) ? i : over;
+        if(first > 1)
+            current[first - 1] = over;
+        for(j = first; j <= last; j++){
+            int best = previous[j-1] + (a[i-1] != b[j-1]);
+            if(previous[j] + 1 < best)
+                best = previous[j] + 1;
+            if(current[j-1] + 1 < best)
+                best = current[j-1] + 1;
+            current[j] = (best < over) ? best : over;
+            if(current[j] < row_min)
+                row_min = current[j];
+        }
+        if(last < length_b)
+            current[last + 1] = over;
+        if(row_min > max_dist && current[0] > max_dist){
+            free(previous);
+            free(current);
+            return over;
+        }
+        int* tmp = previous;
+        previous = current;
+        current = tmp;
+    }
+    int distance = previous[length_b];
+    free(previous);
+    free(current);
+    return distance;
+}
+
+/*
+    Maps a nucleotide to its row of the match masks - anything but A, C, G
+    and T goes to the last row, which never matches
+
+    Inputs:
+        c: the nucleotide
+
+    Returns the row of c
+*/
+int _base_row(char c){
+    switch(c){
+        case 'A': return 0;
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default: return 4;
+    }
+}
+
+/*
+    Computes the smallest edit distance between query and any substring of
+    ref, with Myers' bit-vector algorithm
+
+    Inputs:
+        query: the sequence to place in ref
+        length_query: the length of query
+        ref: the reference sequence
+        length_ref: the length of ref
+
+    Returns the edit distance of the best placement of query in ref
+*/
+int semiglobal_edit_distance(char* query, int length_query, char* ref, int length_ref){
+    int i;
+    int j;
+    int b;
+    if(length_query == 0)
+        return 0;
+    int num_blocks = (length_query + 63) / 64;
+    // Match masks of each base over the query, 64 rows per block
+    uint64_t* peq = (uint64_t*) calloc(5 * num_blocks, sizeof(uint64_t));
+    for(i = 0; i < length_query; i++){
+        int row = _base_row(query[i]);
+        if(row < 4)
+            peq[row * num_blocks + i / 64] |= (uint64_t) 1 << (i % 64);
+    }
+    // Vertical deltas of the current column: +1 everywhere at the start
+    uint64_t* pv = (uint64_t*) malloc(sizeof(uint64_t) * num_blocks);
+    uint64_t* mv = (uint64_t*) calloc(num_blocks, sizeof(uint64_t));
+    for(b = 0; b < num_blocks; b++)
+        pv[b] = ~(uint64_t) 0;
+    uint64_t last = (uint64_t) 1 << ((length_query - 1) % 64);
+    int score = length_query;
+    int best = score;
+    for(j = 0; j < length_ref; j++){
+        uint64_t* eq_column = &peq[_base_row(ref[j]) * num_blocks];
+        // The first row is all zeros: the query may start anywhere in ref
+        int h_in = 0;
+        for(b = 0; b < num_blocks; b++){
+            uint64_t high = (b == num_blocks - 1) ? last : (uint64_t) 1 << 63;
+            uint64_t eq = eq_column[b];
+            uint64_t xv = eq | mv[b];
+            if(h_in < 0)
+                eq |= 1;
+            uint64_t xh = (((eq & pv[b]) + pv[b]) ^ pv[b]) | eq;
+            uint64_t ph = mv[b] | ~(xh | pv[b]);
+            uint64_t mh = pv[b] & xh;
+            int h_out = (ph & high) ? 1 : ((mh & high) ? -1 : 0);
+            ph <<= 1;
+            mh <<= 1;
+            if(h_in < 0)
+                mh |= 1;
+            else if(h_in > 0)
+                ph |= 1;
+            pv[b] = mh | ~(xv | ph);
+            mv[b] = ph & xv;
+            h_in = h_out;
+        }
+        // The carry out of the last block is the change of the last row
+        score += h_in;
+        if(score < best)
+            best = score;
+    }
+    free(peq);
+    free(pv);
+    free(mv);
+    return best;
+}
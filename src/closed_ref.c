@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+#include "closed_ref.h"
+#include "ref_index.h"
+#include "align.h"
+#include "out_writer.h"
+#include "samples.h"
+#include "stats.h"
+#include "util.h"
+
+// Identity threshold of the assignments
+static double SIMILARITY = 0.97;
+
+/*
+    Sets the identity threshold of the assignments to the references
+
+    Inputs:
+        similarity: the identity threshold, in (0, 1]
+*/
+void set_ref_similarity(double similarity){
+    SIMILARITY = similarity;
+}
+
+/*
+    Finds the reference of the unique sequence
+
+    Inputs:
+        idx: pointer to the ref_index structure
+        search: the ref_search scratch space
+        hits: array of CLOSED_REF_CANDIDATES ref_hit structures
+        sequence: the unique sequence
+
+    Returns the index of the reference, or -1 if none holds it within the
+    identity threshold
+*/
+int _map_unique(ref_index* idx, ref_search* search, ref_hit* hits, char* sequence){
+    int i;
+    int best = -1;
+    int best_dist = 0;
+    int length = strlen(sequence);
+    int max_dist = (int) floor((1.0 - SIMILARITY) * length + 1e-9);
+    int num_hits = ref_index_query(idx, search, sequence, max_dist, CLOSED_REF_CANDIDATES, hits);
+    for(i = 0; i < num_hits; i++){
+        int ref = hits[i].ref;
+        int dist = semiglobal_edit_distance(sequence, length, ref_sequence(idx, ref), ref_length(idx, ref));
+        // The hits come by decreasing shared k-mers, so the ties keep the first
+        if(dist <= max_dist && (best < 0 || dist < best_dist)){
+            best = ref;
+            best_dist = dist;
+            if(dist == 0)
+                break;
+        }
+    }
+    return best;
+}
+
+/*
+    Returns the first unique of the share of process rank, out of n
+*/
+int _share_start(int n, int rank, int comm_sz){
+    return (int) ((long) n * rank / comm_sz);
+}
+
+/*
+    Sends the size bytes of buffer to process dest, in pieces, as the MPI
+    counts are ints
+
+    Inputs:
+        buffer: the bytes to send
+        size: the number of bytes
+        dest: the receiving process
+*/
+void _send_share(char* buffer, long size, int dest){
+    long offset;
+    MPI_Send(&size, 1, MPI_LONG, dest, 0, MPI_COMM_WORLD);
+    for(offset = 0; offset < size; offset += CLOSED_REF_PIECE){
+        int piece = (size - offset < CLOSED_REF_PIECE) ? size - offset : CLOSED_REF_PIECE;
+        MPI_Send(buffer + offset, piece, MPI_CHAR, dest, 0, MPI_COMM_WORLD);
+    }
+}
+
+/*
+    Receives the bytes sent by rank 0 with _send_share
+
+    Returns the new buffer with the bytes
+*/
+char* _recv_share(void){
+    long size;
+    long offset;
+    MPI_Recv(&size, 1, MPI_LONG, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    char* buffer = (char*) malloc(size + 1);
+    for(offset = 0; offset < size; offset += CLOSED_REF_PIECE){
+        int piece = (size - offset < CLOSED_REF_PIECE) ? size - offset : CLOSED_REF_PIECE;
+        MPI_Recv(buffer + offset, piece, MPI_CHAR, 0, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    }
+    return buffer;
+}
+
+/*
+    Auxiliary function that compares two sample ids by sample name
+*/
+int _compare_ref_sample_names(const void* a, const void* b){
+    return strcmp(get_sample_name(*(int*)a), get_sample_name(*(int*)b));
+}
+
+/*
+    Writes the reference-OTU table: one line per reference with reads, in
+    index order, with its label and either the labels of its reads or its
+    count on each sample
+
+    Inputs:
+        idx: pointer to the ref_index structure
+        refs: the reads of each reference - NULL for the ones without reads
+        otus: path to the output table
+*/
+void _write_ref_table(ref_index* idx, seq_replicas** refs, char* otus){
+    int i;
+    int ref;
+    int num_samples = get_num_samples();
+    int samples = (get_sample_separator() != '\0');
+    out_writer* w = create_out_writer(otus);
+    // Columns are sorted by sample name
+    int* order = (int*) malloc(sizeof(int) * (num_samples + 1));
+    int* column = (int*) malloc(sizeof(int) * (num_samples + 1));
+    int* row = (int*) calloc(num_samples + 1, sizeof(int));
+    if(samples){
+        for(i = 0; i < num_samples; i++)
+            order[i] = i;
+        qsort(order, num_samples, sizeof(int), _compare_ref_sample_names);
+        for(i = 0; i < num_samples; i++)
+            column[order[i]] = i;
+        writer_put_str(w, "#OTU ID");
+        for(i = 0; i < num_samples; i++){
+            writer_put_char(w, '\t');
+            writer_put_str(w, get_sample_name(order[i]));
+        }
+        writer_put_char(w, '\n');
+    }
+    for(ref = 0; ref < (int) idx->header->num_refs; ref++){
+        if(!refs[ref])
+            continue;
+        writer_put_str(w, ref_name(idx, ref));
+        if(samples){
+            sample_count* pair = NULL;
+            while((pair = (sample_count*) utarray_next(refs[ref]->samples, pair)))
+                row[column[pair->sample]] = pair->count;
+            for(i = 0; i < num_samples; i++){
+                writer_put_char(w, '\t');
+                writer_put_int(w, row[i]);
+                row[i] = 0;
+            }
+        }
+        else{
+            char** l = NULL;
+            while((l = (char**) utarray_next(refs[ref]->labels, l))){
+                writer_put_char(w, '\t');
+                writer_put_str(w, *l);
+            }
+        }
+        writer_put_char(w, '\n');
+    }
+    destroy_out_writer(w);
+    free(order);
+    free(column);
+    free(row);
+}
+
+/*
+    Maps the uniques of db (held in rank 0) to the references of the index
+    file index, sharing the work among all the processes, and writes the
+    reference-OTU table from rank 0. The mapped uniques are removed from db.
+
+    Inputs:
+        db: the de-replication database - will be modified in place in
+            rank 0
+        index: path to the reference index file
+        otus: path to the output reference-OTU table
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void closed_ref_derep_db(derep_db* db, char* index, char* otus, int my_rank, int comm_sz){
+    int i;
+    int r;
+    int n = 0;
+    ref_hit hits[CLOSED_REF_CANDIDATES];
+    seq_replicas** uniques = NULL;
+    char** sequences = NULL;
+    char* buffer = NULL;
+    STATS_TIC(t_map);
+    // Every process maps the same index file
+    ref_index* idx = open_ref_index(index);
+    if(my_rank == 0){
+        seq_replicas* current;
+        n = db->unique;
+        uniques = (seq_replicas**) malloc(sizeof(seq_replicas*) * (n + 1));
+        i = 0;
+        for(current = db->seqs; current != NULL; current = current->hh.next)
+            uniques[i++] = current;
+    }
+    MPI_Bcast(&n, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    // Deal contiguous shares of the uniques
+    int first = _share_start(n, my_rank, comm_sz);
+    int num_mine = _share_start(n, my_rank + 1, comm_sz) - first;
+    sequences = (char**) malloc(sizeof(char*) * (num_mine + 1));
+    if(my_rank == 0){
+        for(r = 1; r < comm_sz; r++){
+            int start = _share_start(n, r, comm_sz);
+            int end = _share_start(n, r + 1, comm_sz);
+            long size = 0;
+            for(i = start; i < end; i++)
+                size += strlen(uniques[i]->sequence) + 1;
+            char* share = (char*) malloc(size + 1);
+            char* out = share;
+            for(i = start; i < end; i++){
+                int length = strlen(uniques[i]->sequence);
+                memcpy(out, uniques[i]->sequence, length + 1);
+                out += length + 1;
+            }
+            _send_share(share, size, r);
+            free(share);
+        }
+        for(i = 0; i < num_mine; i++)
+            sequences[i] = uniques[i]->sequence;
+    }
+    else{
+        buffer = _recv_share();
+        char* in = buffer;
+        for(i = 0; i < num_mine; i++){
+            sequences[i] = in;
+            in += strlen(in) + 1;
+        }
+    }
+    // Map the share of this process
+    ref_search* search = create_ref_search(idx);
+    int* assigned = (int*) malloc(sizeof(int) * (num_mine + 1));
+    for(i = 0; i < num_mine; i++)
+        assigned[i] = _map_unique(idx, search, hits, sequences[i]);
+    destroy_ref_search(search);
+    free(sequences);
+    free(buffer);
+    // Collect the assignments in rank 0
+    int* all = NULL;
+    int* counts = NULL;
+    int* displs = NULL;
+    if(my_rank == 0){
+        all = (int*) malloc(sizeof(int) * (n + 1));
+        counts = (int*) malloc(sizeof(int) * comm_sz);
+        displs = (int*) malloc(sizeof(int) * comm_sz);
+        for(r = 0; r < comm_sz; r++){
+            displs[r] = _share_start(n, r, comm_sz);
+            counts[r] = _share_start(n, r + 1, comm_sz) - displs[r];
+        }
+    }
+    MPI_Gatherv(assigned, num_mine, MPI_INT, all, counts, displs, MPI_INT, 0, MPI_COMM_WORLD);
+    free(assigned);
+    if(my_rank == 0){
+        int num_refs = idx->header->num_refs;
+        seq_replicas** refs = (seq_replicas**) calloc(num_refs + 1, sizeof(seq_replicas*));
+        int mapped = 0;
+        int hit_refs = 0;
+        long mapped_reads = 0;
+        // Move the reads of the mapped uniques to their references
+        for(i = 0; i < n; i++){
+            int ref = all[i];
+            if(ref < 0)
+                continue;
+            if(!refs[ref]){
+                char* name = ref_name(idx, ref);
+                refs[ref] = create_empty_seq_replica(name, strlen(name));
+                if(uniques[i]->samples)
+                    utarray_new(refs[ref]->samples, &sample_count_icd);
+                ++hit_refs;
+            }
+            merge_seq_replica(refs[ref], uniques[i]);
+            ++mapped;
+            mapped_reads += uniques[i]->count;
+            HASH_DEL(db->seqs, uniques[i]);
+            destroy_seq_replica(uniques[i]);
+            --db->unique;
+        }
+        db->count -= mapped_reads;
+        _write_ref_table(idx, refs, otus);
+        error_handler(INFO_MSG, "Closed-reference: %d of %d uniques (%ld reads) mapped to %d references at %.2f identity",
+                      mapped, n, mapped_reads, hit_refs, SIMILARITY);
+        for(i = 0; i < num_refs; i++){
+            if(refs[i])
+                destroy_seq_replica(refs[i]);
+        }
+        free(refs);
+        free(all);
+        free(counts);
+        free(displs);
+        free(uniques);
+    }
+    close_ref_index(idx);
+    STATS_TOC(PHASE_CLOSED_REF, t_map);
+}
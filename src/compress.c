@@ -0,0 +1,414 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
+#include "compress.h"
+#include "samples.h"
+#include "stats.h"
+#include "util.h"
+
+// Ways a sequence is stored in a record
+#define SEQ_RAW 0
+#define SEQ_2BIT 1
+
+// Whether the gather messages are compressed
+static int COMPRESS = 0;
+// Bytes the messages of this process would have taken uncompressed
+static double PLAIN_BYTES = 0.0;
+// Bytes the messages of this process took compressed
+static double WIRE_BYTES = 0.0;
+
+// 2-bit code of each base plus one, 0 for the characters that cannot be packed
+static const signed char BASE_CODES[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4
+};
+// Base of each 2-bit code
+static const char CODE_BASES[4] = {'A', 'C', 'G', 'T'};
+
+typedef struct chunk_sender_str {
+    int dest;
+    MPI_Comm comm;
+    // Encoded records of the chunk being filled
+    byte_buffer raw;
+    // Last label of the chunk, the reference of the front coding
+    char* previous;
+    // Compressed chunks, one being sent while the other is filled
+    char* out[2];
+    size_t capacity[2];
+    MPI_Request requests[2];
+    int current;
+} chunk_sender;
+
+/*
+    Appends the unsigned integer value to b as a varint: 7 bits per byte,
+    with the high bit set on all the bytes but the last
+*/
+void _put_varint(byte_buffer* b, uint64_t value){
+    unsigned char bytes[10];
+    int n = 0;
+    while(value >= 0x80){
+        bytes[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[n++] = (unsigned char) value;
+    buffer_append(b, bytes, n);
+}
+
+/*
+    Reads a varint at *in and moves *in past it
+*/
+uint64_t _get_varint(unsigned char** in){
+    uint64_t value = 0;
+    int shift = 0;
+    unsigned char byte;
+    do{
+        byte = *(*in)++;
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        shift += 7;
+    }while(byte & 0x80);
+    return value;
+}
+
+/*
+    Appends the sequence of the given length to b, packed in 2 bits per
+    base if it only holds A, C, G and T
+*/
+void _put_sequence(byte_buffer* b, char* sequence, int length){
+    int i;
+    unsigned char kind = SEQ_2BIT;
+    for(i = 0; i < length; i++){
+        if(!BASE_CODES[(unsigned char) sequence[i]]){
+            kind = SEQ_RAW;
+            break;
+        }
+    }
+    _put_varint(b, length);
+    buffer_append(b, &kind, 1);
+    if(kind == SEQ_RAW){
+        buffer_append(b, sequence, length);
+        return;
+    }
+    // 4 bases per byte, the first one in the lowest bits
+    unsigned char packed = 0;
+    for(i = 0; i < length; i++){
+        packed |= (BASE_CODES[(unsigned char) sequence[i]] - 1) << (2 * (i & 3));
+        if((i & 3) == 3){
+            buffer_append(b, &packed, 1);
+            packed = 0;
+        }
+    }
+    if(length & 3)
+        buffer_append(b, &packed, 1);
+}
+
+/*
+    Reads a sequence written by _put_sequence at *in into sequence, which
+    is grown as needed, and moves *in past it
+
+    Returns the length of the sequence
+*/
+int _get_sequence(unsigned char** in, char** sequence, int* capacity){
+    int i;
+    int length = (int) _get_varint(in);
+    unsigned char kind = *(*in)++;
+    if(length + 1 > *capacity){
+        *capacity = 2 * (length + 1);
+        *sequence = (char*) realloc(*sequence, *capacity);
+    }
+    if(kind == SEQ_RAW){
+        memcpy(*sequence, *in, length);
+        *in += length;
+    }
+    else{
+        for(i = 0; i < length; i++)
+            (*sequence)[i] = CODE_BASES[((*in)[i >> 2] >> (2 * (i & 3))) & 3];
+        *in += (length + 3) / 4;
+    }
+    (*sequence)[length] = '\0';
+    return length;
+}
+
+/*
+    Appends label to b front-coded against the previous label of the chunk:
+    the length of their common prefix, followed by the rest of the label
+*/
+void _put_label(chunk_sender* s, char* label){
+    int prefix = 0;
+    if(s->previous){
+        while(label[prefix] && label[prefix] == s->previous[prefix])
+            ++prefix;
+    }
+    int suffix = strlen(label + prefix);
+    _put_varint(&s->raw, prefix);
+    _put_varint(&s->raw, suffix);
+    buffer_append(&s->raw, label + prefix, suffix);
+    s->previous = label;
+}
+
+/*
+    Compresses the encoded records of s and sends them as a chunk, made of
+    the encoded size followed by the zlib stream. The chunk is sent while
+    the next one is filled; an empty raw buffer sends the empty message
+    that ends the transfer.
+*/
+void _send_chunk(chunk_sender* s){
+    char* out;
+    uLongf size = 0;
+    // Wait until the buffer we are about to reuse has been sent
+    MPI_Wait(&s->requests[s->current], MPI_STATUS_IGNORE);
+    if(s->raw.size > 0){
+        uint32_t raw_size = s->raw.size;
+        size_t bound = compressBound(s->raw.size) + sizeof(uint32_t);
+        if(bound > s->capacity[s->current]){
+            s->capacity[s->current] = bound;
+            s->out[s->current] = (char*) realloc(s->out[s->current], bound);
+        }
+        out = s->out[s->current];
+        memcpy(out, &raw_size, sizeof(uint32_t));
+        size = bound - sizeof(uint32_t);
+        if(compress2((Bytef*)(out + sizeof(uint32_t)), &size, (Bytef*) s->raw.data, s->raw.size, Z_BEST_SPEED) != Z_OK)
+            error_handler(FATAL_ERROR, "Error compressing a gather message");
+        size += sizeof(uint32_t);
+    }
+    MPI_Isend(s->out[s->current], size, MPI_BYTE, s->dest, COMPRESS_TAG, s->comm, &s->requests[s->current]);
+    STATS_ADD(bytes_sent, size);
+    WIRE_BYTES += size;
+    s->current = 1 - s->current;
+    // Each chunk is decoded on its own
+    s->raw.size = 0;
+    s->previous = NULL;
+}
+
+/*
+    Decodes the records of a chunk and merges them with db
+
+    Inputs:
+        db: pointer to the local de-replication database structure
+        in: the encoded records
+        end: the end of the encoded records
+        sample_map: the ids of the samples of the sender in db
+*/
+void _merge_chunk(derep_db* db, unsigned char* in, unsigned char* end, int* sample_map){
+    int j;
+    int length;
+    int seq_capacity = 0;
+    int label_capacity = 0;
+    char* sequence = NULL;
+    char* label = NULL;
+    while(in < end){
+        length = _get_sequence(&in, &sequence, &seq_capacity);
+        int count = (int) _get_varint(&in);
+        seq_replicas* r;
+        HASH_FIND(hh, db->seqs, sequence, length, r);
+        STATS_ADD(hash_probes, 1);
+        if(!r){
+            r = create_empty_seq_replica(sequence, length);
+            insert_seq_replica(db, r);
+        }
+        if(db->sample_sep){
+            int num_pairs = (int) _get_varint(&in);
+            for(j = 0; j < num_pairs; j++){
+                int sample = (int) _get_varint(&in);
+                int reads = (int) _get_varint(&in);
+                if(add_sample_replica(r, sample_map[sample], reads))
+                    db->bytes += sizeof(sample_count);
+            }
+            continue;
+        }
+        for(j = 0; j < count; j++){
+            // Keep the common prefix of the previous label, add the rest
+            int prefix = (int) _get_varint(&in);
+            int suffix = (int) _get_varint(&in);
+            if(prefix + suffix + 1 > label_capacity){
+                label_capacity = 2 * (prefix + suffix + 1);
+                label = (char*) realloc(label, label_capacity);
+            }
+            memcpy(label + prefix, in, suffix);
+            in += suffix;
+            label[prefix + suffix] = '\0';
+            add_replica(r, label);
+            db->bytes += LABEL_BYTES(prefix + suffix);
+        }
+    }
+    free(sequence);
+    free(label);
+}
+
+/*
+    Sets whether the de-replication databases are compressed when they are
+    sent during the gather
+
+    Inputs:
+        compress: 1 to compress the gather messages, 0 otherwise
+*/
+void set_gather_compression(int compress){
+    COMPRESS = compress;
+}
+
+/*
+    Returns whether the gather messages are compressed
+*/
+int gather_compression_enabled(void){
+    return COMPRESS;
+}
+
+/*
+    Sends the de-replication database db to process dest in compressed
+    chunks
+
+    Inputs:
+        db: de-replication database to send
+        dest: the rank of the destination process
+        comm: the communicator of dest
+*/
+void send_compressed_derep_db(derep_db* db, int dest, MPI_Comm comm){
+    int i;
+    char** label;
+    seq_replicas* current;
+    chunk_sender s;
+    s.dest = dest;
+    s.comm = comm;
+    s.raw.data = NULL;
+    s.raw.size = 0;
+    s.raw.capacity = 0;
+    s.previous = NULL;
+    s.out[0] = s.out[1] = NULL;
+    s.capacity[0] = s.capacity[1] = 0;
+    s.requests[0] = s.requests[1] = MPI_REQUEST_NULL;
+    s.current = 0;
+    // Size of the same database in a pack_derep_db message
+    double plain = 2 * sizeof(int);
+    // The first chunk starts with the number of reads and the samples
+    _put_varint(&s.raw, db->count);
+    if(db->sample_sep){
+        int num_samples = get_num_samples();
+        _put_varint(&s.raw, num_samples);
+        for(i = 0; i < num_samples; i++){
+            int length = strlen(get_sample_name(i));
+            _put_varint(&s.raw, length);
+            buffer_append(&s.raw, get_sample_name(i), length);
+            plain += sizeof(int) + length;
+        }
+    }
+    for(current = db->seqs; current != NULL; current = (seq_replicas*) current->hh.next){
+        int length = strlen(current->sequence);
+        _put_sequence(&s.raw, current->sequence, length);
+        _put_varint(&s.raw, current->count);
+        plain += 2 * sizeof(int) + length;
+        if(db->sample_sep){
+            sample_count* pair = NULL;
+            _put_varint(&s.raw, utarray_len(current->samples));
+            while((pair=(sample_count*)utarray_next(current->samples, pair))){
+                _put_varint(&s.raw, pair->sample);
+                _put_varint(&s.raw, pair->count);
+            }
+            plain += sizeof(int) + utarray_len(current->samples) * sizeof(sample_count);
+        }
+        else{
+            label = NULL;
+            while((label=(char**)utarray_next(current->labels, label))){
+                _put_label(&s, *label);
+                plain += sizeof(int) + strlen(*label);
+            }
+        }
+        // Chunks only hold whole records
+        if(s.raw.size >= COMPRESS_CHUNK)
+            _send_chunk(&s);
+    }
+    if(s.raw.size > 0)
+        _send_chunk(&s);
+    // The empty message ends the transfer
+    _send_chunk(&s);
+    MPI_Waitall(2, s.requests, MPI_STATUSES_IGNORE);
+    PLAIN_BYTES += plain;
+    STATS_ADD(bytes_uncompressed, plain);
+    free(s.raw.data);
+    free(s.out[0]);
+    free(s.out[1]);
+}
+
+/*
+    Receives a de-replication database sent by send_compressed_derep_db
+    and merges it with db, chunk by chunk
+
+    Inputs:
+        db: pointer to the local de-replication database structure
+        source: the rank of the source process
+        comm: the communicator of source
+*/
+void recv_compressed_derep_db(derep_db* db, int source, MPI_Comm comm){
+    int i;
+    int size;
+    uint32_t raw_size;
+    uLongf inflated;
+    MPI_Status status;
+    int first = 1;
+    int* sample_map = NULL;
+    char* msg = NULL;
+    int msg_capacity = 0;
+    unsigned char* raw = NULL;
+    size_t raw_capacity = 0;
+    while(1){
+        MPI_Probe(source, COMPRESS_TAG, comm, &status);
+        MPI_Get_count(&status, MPI_BYTE, &size);
+        if(size > msg_capacity){
+            msg_capacity = size;
+            msg = (char*) realloc(msg, msg_capacity);
+        }
+        MPI_Recv(msg, size, MPI_BYTE, source, COMPRESS_TAG, comm, MPI_STATUS_IGNORE);
+        STATS_ADD(bytes_recv, size);
+        // The empty message ends the transfer
+        if(size == 0)
+            break;
+        memcpy(&raw_size, msg, sizeof(uint32_t));
+        if(raw_size > raw_capacity){
+            raw_capacity = raw_size;
+            raw = (unsigned char*) realloc(raw, raw_capacity);
+        }
+        inflated = raw_size;
+        if(uncompress(raw, &inflated, (Bytef*)(msg + sizeof(uint32_t)), size - sizeof(uint32_t)) != Z_OK || inflated != raw_size)
+            error_handler(FATAL_ERROR, "Corrupted compressed gather message from process %d", source);
+        unsigned char* in = raw;
+        if(first){
+            // The number of reads and the samples of the sender
+            db->count += (int) _get_varint(&in);
+            if(db->sample_sep){
+                int num_samples = (int) _get_varint(&in);
+                sample_map = (int*) malloc(sizeof(int) * (num_samples + 1));
+                for(i = 0; i < num_samples; i++){
+                    int length = (int) _get_varint(&in);
+                    sample_map[i] = intern_sample((char*) in, length);
+                    in += length;
+                }
+            }
+            first = 0;
+        }
+        _merge_chunk(db, in, raw + raw_size, sample_map);
+    }
+    free(msg);
+    free(raw);
+    free(sample_map);
+}
+
+/*
+    Reports the compression ratio achieved by the gather messages of all
+    the processes. Must be called by all the processes; rank 0 prints it.
+
+    Inputs:
+        my_rank: process rank
+*/
+void report_gather_compression(int my_rank){
+    double local[2] = {PLAIN_BYTES, WIRE_BYTES};
+    double total[2];
+    MPI_Reduce(local, total, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if(my_rank != 0)
+        return;
+    if(total[1] > 0)
+        error_handler(INFO_MSG, "Gather messages compressed %.2fx (%.0f bytes sent for %.0f bytes)",
+                      total[0] / total[1], total[1], total[0]);
+    else
+        // With --node-gather on a single node the tables are merged through
+        // shared memory
+        error_handler(INFO_MSG, "Gather messages not compressed: no point-to-point transfer took place "
+                      "(the node gather merges the tables of a node through shared memory)");
+}
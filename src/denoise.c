@@ -0,0 +1,391 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+#include <pthread.h>
+#include "denoise.h"
+#include "align.h"
+#include "kmer_index.h"
+#include "sketch.h"
+#include "stats.h"
+#include "util.h"
+
+// Status of the uniques that are not a noisy variant of another
+#define DENOISE_UNDECIDED -2
+#define DENOISE_ZOTU -1
+// Queries taken at once by a thread
+#define DENOISE_THREAD_CHUNK 16
+// Largest piece of the uniques broadcast at once
+#define DENOISE_BCAST_PIECE (1 << 30)
+
+// Parameters of the denoising
+static int MINSIZE = 8;
+static double ALPHA = 2.0;
+static int THREADS = 1;
+static int SKETCH_FILTER = 0;
+
+typedef struct denoise_batch_str {
+    // The uniques, by decreasing abundance, and the index of the ZOTUs
+    seq_replicas** uniques;
+    int* lengths;
+    // Sketches of the uniques, in the same order - NULL without the filter
+    uint16_t* sketches;
+    kmer_index* idx;
+    // Queries of this process in the batch: first, first + step, ...
+    int first;
+    int step;
+    int num_queries;
+    // Output parameter - the decision on each query
+    int* decisions;
+    // Next query to be taken by a thread
+    int next;
+    pthread_mutex_t lock;
+} denoise_batch;
+
+/*
+    Sets the parameters of the denoising
+
+    Inputs:
+        minsize: the smallest abundance of the uniques kept
+        alpha: the alpha of the UNOISE abundance skew criterion
+        threads: the number of threads of each process
+*/
+void set_denoise_params(int minsize, double alpha, int threads){
+    MINSIZE = minsize;
+    ALPHA = alpha;
+    THREADS = threads;
+}
+
+/*
+    Sets whether the candidate parents are filtered with their sketches
+
+    Inputs:
+        enable: 1 to filter the candidates, 0 to align all of them
+*/
+void set_denoise_sketch_filter(int enable){
+    SKETCH_FILTER = enable;
+}
+
+/*
+    Compares two uniques by decreasing abundance, breaking the ties by
+    sequence so the order does not depend on the hash table
+
+    Inputs:
+        a: pointer to the first seq_replicas pointer
+        b: pointer to the second seq_replicas pointer
+
+    Returns a negative, zero or positive value as qsort expects
+*/
+int _compare_abundance(const void* a, const void* b){
+    seq_replicas* r_a = *(seq_replicas**) a;
+    seq_replicas* r_b = *(seq_replicas**) b;
+    if(r_a->count != r_b->count)
+        return (r_a->count > r_b->count) ? -1 : 1;
+    return strcmp(r_a->sequence, r_b->sequence);
+}
+
+/*
+    Looks for the parent of the unique q among the ZOTUs already indexed:
+    the closest one whose abundance skew allows that distance, and the most
+    abundant of them on a tie
+
+    Inputs:
+        batch: pointer to the denoise_batch structure
+        search: the kmer_search scratch space of the caller
+        hits: array of DENOISE_CANDIDATES kmer_hit structures
+        q: index of the query unique
+
+    Returns the index of the parent unique, or DENOISE_ZOTU if it has none
+*/
+int _find_parent(denoise_batch* batch, kmer_search* search, kmer_hit* hits, int q){
+    int i;
+    int best = DENOISE_ZOTU;
+    int best_dist = 0;
+    seq_replicas* query = batch->uniques[q];
+    int num_hits = kmer_index_query(batch->idx, search, query->sequence, DENOISE_CANDIDATES, hits);
+    for(i = 0; i < num_hits; i++){
+        int parent = hits[i].id;
+        // Largest distance accepted by the skew: alpha * d + 1 <= log2(aP / aQ)
+        double skew = log2((double) batch->uniques[parent]->count / query->count);
+        int max_dist = (int) floor((skew - 1.0) / ALPHA + 1e-9);
+        if(max_dist < 1)
+            continue;
+        // No need to look past the best distance found so far
+        if(best != DENOISE_ZOTU && best_dist < max_dist)
+            max_dist = best_dist;
+        // Drop the candidates whose k-mers are clearly farther than that
+        if(batch->sketches){
+            float expected = sketch_jaccard_threshold(1.0f - (float) max_dist / batch->lengths[q]);
+            if(sketch_jaccard(&batch->sketches[(size_t) q * SKETCH_SIZE], &batch->sketches[(size_t) parent * SKETCH_SIZE])
+               < DENOISE_SKETCH_SLACK * expected){
+                STATS_ADD(sketch_rejects, 1);
+                continue;
+            }
+        }
+        int dist = bounded_edit_distance(query->sequence, batch->lengths[q],
+                                         batch->uniques[parent]->sequence, batch->lengths[parent],
+                                         max_dist);
+        if(dist > max_dist)
+            continue;
+        if(best == DENOISE_ZOTU || dist < best_dist || (dist == best_dist && parent < best)){
+            best = parent;
+            best_dist = dist;
+        }
+    }
+    return best;
+}
+
+/*
+    Decides the queries of the batch taken from its shared counter, in
+    chunks of DENOISE_THREAD_CHUNK
+
+    Inputs:
+        arg: pointer to the denoise_batch structure
+
+    Returns NULL
+*/
+void* _denoise_worker(void* arg){
+    int i;
+    denoise_batch* batch = (denoise_batch*) arg;
+    kmer_search* search = create_kmer_search();
+    kmer_hit hits[DENOISE_CANDIDATES];
+    while(1){
+        pthread_mutex_lock(&batch->lock);
+        int start = batch->next;
+        batch->next += DENOISE_THREAD_CHUNK;
+        pthread_mutex_unlock(&batch->lock);
+        if(start >= batch->num_queries)
+            break;
+        int end = (start + DENOISE_THREAD_CHUNK < batch->num_queries) ? start + DENOISE_THREAD_CHUNK : batch->num_queries;
+        for(i = start; i < end; i++)
+            batch->decisions[i] = _find_parent(batch, search, hits, batch->first + i * batch->step);
+    }
+    destroy_kmer_search(search);
+    return NULL;
+}
+
+/*
+    Decides the queries of this process in the batch, with THREADS threads
+    if the batch is large enough
+
+    Inputs:
+        batch: pointer to the denoise_batch structure
+*/
+void _decide_batch(denoise_batch* batch){
+    int i;
+    batch->next = 0;
+    if(THREADS < 2 || batch->num_queries < DENOISE_MIN_THREADED_BATCH){
+        _denoise_worker(batch);
+        return;
+    }
+    pthread_t* threads = (pthread_t*) malloc(sizeof(pthread_t) * (THREADS - 1));
+    for(i = 0; i < THREADS - 1; i++){
+        if(pthread_create(&threads[i], NULL, _denoise_worker, batch) != 0)
+            error_handler(FATAL_ERROR, "Can't create the denoising threads\n");
+    }
+    // The calling thread does its share too
+    _denoise_worker(batch);
+    for(i = 0; i < THREADS - 1; i++)
+        pthread_join(threads[i], NULL);
+    free(threads);
+}
+
+/*
+    Makes the uniques to denoise available in all the processes: rank 0
+    collects the ones with at least MINSIZE reads by decreasing abundance
+    and broadcasts their sequences and abundances; the other processes build
+    label-less replicas of them
+
+    Inputs:
+        db: the de-replication database (complete in rank 0)
+        uniques: output parameter - the array of uniques
+        my_rank: process rank
+
+    Returns the number of uniques
+*/
+int _share_uniques(derep_db* db, seq_replicas*** uniques, int my_rank){
+    int i;
+    int n = 0;
+    long size = 0;
+    char* buffer = NULL;
+    if(my_rank == 0){
+        seq_replicas* current;
+        *uniques = (seq_replicas**) malloc(sizeof(seq_replicas*) * (db->unique + 1));
+        for(current = db->seqs; current != NULL; current = current->hh.next){
+            if(current->count >= MINSIZE){
+                (*uniques)[n++] = current;
+                size += 2 * sizeof(int) + strlen(current->sequence) + 1;
+            }
+        }
+        qsort(*uniques, n, sizeof(seq_replicas*), _compare_abundance);
+        // Pack (count, length, sequence) triplets, with the NUL terminators
+        buffer = (char*) malloc(size + 1);
+        char* out = buffer;
+        for(i = 0; i < n; i++){
+            int length = strlen((*uniques)[i]->sequence);
+            memcpy(out, &(*uniques)[i]->count, sizeof(int));
+            memcpy(out + sizeof(int), &length, sizeof(int));
+            memcpy(out + 2 * sizeof(int), (*uniques)[i]->sequence, length + 1);
+            out += 2 * sizeof(int) + length + 1;
+        }
+    }
+    MPI_Bcast(&n, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    MPI_Bcast(&size, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+    if(my_rank != 0)
+        buffer = (char*) malloc(size + 1);
+    // In pieces, as the MPI counts are ints
+    long offset;
+    for(offset = 0; offset < size; offset += DENOISE_BCAST_PIECE){
+        int piece = (size - offset < DENOISE_BCAST_PIECE) ? size - offset : DENOISE_BCAST_PIECE;
+        MPI_Bcast(buffer + offset, piece, MPI_CHAR, 0, MPI_COMM_WORLD);
+    }
+    if(my_rank != 0){
+        char* in = buffer;
+        *uniques = (seq_replicas**) malloc(sizeof(seq_replicas*) * (n + 1));
+        for(i = 0; i < n; i++){
+            int count;
+            int length;
+            memcpy(&count, in, sizeof(int));
+            memcpy(&length, in + sizeof(int), sizeof(int));
+            (*uniques)[i] = create_empty_seq_replica(in + 2 * sizeof(int), length);
+            (*uniques)[i]->count = count;
+            in += 2 * sizeof(int) + length + 1;
+        }
+    }
+    free(buffer);
+    return n;
+}
+
+/*
+    Moves the reads of the unique child into parent and removes child
+    from db
+
+    Inputs:
+        db: the de-replication database
+        parent: the unique receiving the reads
+        child: the noisy unique
+*/
+void _merge_into_parent(derep_db* db, seq_replicas* parent, seq_replicas* child){
+    merge_seq_replica(parent, child);
+    HASH_DEL(db->seqs, child);
+    destroy_seq_replica(child);
+    --db->unique;
+}
+
+/*
+    Denoises the de-replication database db (complete in rank 0) with the
+    UNOISE criterion, merging each noisy unique into its parent. The batches
+    of queries are split across the processes and their threads. Must be
+    called by all the processes.
+
+    Inputs:
+        db: the de-replication database - will be modified in place in
+            rank 0
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void denoise_derep_db(derep_db* db, int my_rank, int comm_sz){
+    int i;
+    int pos;
+    seq_replicas** uniques = NULL;
+    STATS_TIC(t_denoise);
+    int n = _share_uniques(db, &uniques, my_rank);
+    int* lengths = (int*) malloc(sizeof(int) * (n + 1));
+    int* status = (int*) malloc(sizeof(int) * (n + 1));
+    for(i = 0; i < n; i++){
+        lengths[i] = strlen(uniques[i]->sequence);
+        status[i] = DENOISE_UNDECIDED;
+    }
+    // Scratch space of the batches
+    int* decisions = (int*) malloc(sizeof(int) * (n + 1));
+    int* gathered = (int*) malloc(sizeof(int) * (n + 1));
+    int* counts = (int*) malloc(sizeof(int) * comm_sz);
+    int* displs = (int*) malloc(sizeof(int) * comm_sz);
+    denoise_batch batch;
+    batch.uniques = uniques;
+    batch.lengths = lengths;
+    batch.sketches = NULL;
+    if(SKETCH_FILTER){
+        // Rank 0 sketches the uniques once and shares the sketches
+        if(my_rank == 0)
+            batch.sketches = collect_sketches(uniques, n);
+        bcast_sketches(&batch.sketches, &n, 0);
+    }
+    batch.idx = create_kmer_index(DENOISE_SEED);
+    batch.decisions = decisions;
+    pthread_mutex_init(&batch.lock, NULL);
+    // Any parent of a query is at least this many times more abundant
+    double factor = pow(2.0, ALPHA + 1.0);
+    int zotus = 0;
+    for(pos = 0; pos < n; ){
+        // The batch ends at the first query that could have a parent in it
+        int end = pos + 1;
+        while(end < n && uniques[end]->count * factor > uniques[pos]->count)
+            ++end;
+        int size = end - pos;
+        // The queries are dealt round-robin to the processes
+        int r;
+        for(r = 0; r < comm_sz; r++){
+            counts[r] = (size > r) ? (size - r + comm_sz - 1) / comm_sz : 0;
+            displs[r] = r ? displs[r-1] + counts[r-1] : 0;
+        }
+        batch.first = pos + my_rank;
+        batch.step = comm_sz;
+        batch.num_queries = counts[my_rank];
+        _decide_batch(&batch);
+        MPI_Allgatherv(decisions, counts[my_rank], MPI_INT, gathered, counts, displs, MPI_INT, MPI_COMM_WORLD);
+        for(r = 0; r < comm_sz; r++){
+            for(i = 0; i < counts[r]; i++)
+                status[pos + r + i * comm_sz] = gathered[displs[r] + i];
+        }
+        // The new ZOTUs are candidate parents of the next batches
+        for(i = pos; i < end; i++){
+            if(status[i] == DENOISE_ZOTU){
+                kmer_index_add(batch.idx, uniques[i], i);
+                ++zotus;
+            }
+        }
+        pos = end;
+    }
+    pthread_mutex_destroy(&batch.lock);
+    destroy_kmer_index(batch.idx);
+    free(batch.sketches);
+    free(decisions);
+    free(gathered);
+    free(counts);
+    free(displs);
+    if(my_rank == 0){
+        seq_replicas* current;
+        seq_replicas* tmp;
+        int initial = db->unique;
+        // Merge the noisy uniques into their parents. A parent is always a
+        // ZOTU, so the merged ones are never a parent themselves
+        for(i = 0; i < n; i++){
+            if(status[i] >= 0)
+                _merge_into_parent(db, uniques[status[i]], uniques[i]);
+        }
+        // Discard the uniques below the minimum abundance
+        int discarded = 0;
+        long discarded_reads = 0;
+        HASH_ITER(hh, db->seqs, current, tmp){
+            if(current->count < MINSIZE){
+                discarded_reads += current->count;
+                ++discarded;
+                HASH_DEL(db->seqs, current);
+                destroy_seq_replica(current);
+                --db->unique;
+            }
+        }
+        db->count -= discarded_reads;
+        error_handler(INFO_MSG, "Denoising: %d uniques, %d ZOTUs, %d noisy uniques merged, %d uniques (%ld reads) below size %d discarded",
+                      initial, zotus, n - zotus, discarded, discarded_reads, MINSIZE);
+    }
+    else{
+        for(i = 0; i < n; i++)
+            destroy_seq_replica(uniques[i]);
+    }
+    free(uniques);
+    free(lengths);
+    free(status);
+    STATS_TOC(PHASE_DENOISE, t_denoise);
+}
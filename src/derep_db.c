@@ -3,11 +3,35 @@
 #include <math.h>
 #include "mpi.h"
 #include "derep_db.h"
+#include "sketch.h"
+#include "stats.h"
+#include "samples.h"
+#include "out_writer.h"
+#include "compress.h"
+#include "fingerprint.h"
+#include "util.h"
 
 /************************************
  *   Replica structure functions    *
 ************************************/
 
+/*
+    Allocates the 16-byte aligned sequence string of the replica r, in the
+    key arena if it is enabled
+
+    Inputs:
+        r: pointer to the seq_replicas structure
+        seq_length: the length of the sequence
+*/
+void _alloc_sequence(seq_replicas* r, int seq_length){
+    r->sequence = NULL;
+    if(key_arena_enabled())
+        r->sequence = key_arena_alloc(seq_length+1);
+    r->arena_key = (r->sequence != NULL);
+    if(!r->arena_key)
+        posix_memalign((void **) &r->sequence, 16, sizeof(char) * (seq_length+1));
+}
+
 /*
     Creates a new seq_replicas structure with the 'seq'
 
@@ -22,13 +46,17 @@ seq_replicas* create_seq_replica(sequence* seq){
     // Initialize replica structure with the new sequence
     r->count = 1;
     // Allocate memory for the sequence string
-    posix_memalign((void **) &r->sequence, 16, sizeof(char) * (seq->seq_length+1));
+    _alloc_sequence(r, seq->seq_length);
     // Copy the sequence string
     memcpy(r->sequence, seq->sequence, seq->seq_length+1);
     // Initialize labels array
     utarray_new(r->labels, &ut_str_icd);
     // Insert the sequence's label to the labels array
     utarray_push_back(r->labels, &seq->label);
+    // The sketch is only computed on demand
+    r->sketch = NULL;
+    // Per-sample counts are only used by some databases
+    r->samples = NULL;
     return r;
 }
 
@@ -47,20 +75,35 @@ seq_replicas* create_empty_seq_replica(char* sequence, int seq_length){
     // Initialize counter to 0 because no labels are on it
     r->count = 0;
     // Allocate memory for the sequence string
-    posix_memalign((void **) &r->sequence, 16, sizeof(char) * (seq_length+1));
+    _alloc_sequence(r, seq_length);
     // Copy the sequence string
     memcpy(r->sequence, sequence, seq_length+1);
     // Initialize labels array
     utarray_new(r->labels, &ut_str_icd);
+    // The sketch is only computed on demand
+    r->sketch = NULL;
+    // Per-sample counts are only used by some databases
+    r->samples = NULL;
     return r;
 }
 
 /*
-    Adds the sequence seq as a replica of r
+    Computes the MinHash sketch of the replica r
 
     Inputs:
         r: pointer to the seq_replicas structure
-        seq: pointer to the sequence structure
+*/
+void sketch_seq_replica(seq_replicas* r){
+    posix_memalign((void **) &r->sketch, 16, sizeof(uint16_t) * SKETCH_SIZE);
+    compute_sketch(r->sequence, r->sketch);
+}
+
+/*
+    Adds the label as a replica of r
+
+    Inputs:
+        r: pointer to the seq_replicas structure
+        label: the label of the replica
 */
 void add_replica(seq_replicas* r, char* label){
     // Add the sequence's label to the labels array
@@ -78,12 +121,95 @@ void add_replica(seq_replicas* r, char* label){
 void destroy_seq_replica(seq_replicas* r){
     // Free up the labels array
     utarray_free(r->labels);
+    // Free up the per-sample counts
+    if(r->samples)
+        utarray_free(r->samples);
     // Free the sequence memory
-    free(r->sequence);
+    if(r->arena_key)
+        key_arena_free(r->sequence);
+    else
+        free(r->sequence);
+    // Free the sketch memory (no-op if it was not computed)
+    free(r->sketch);
     // Free the whole structure memory
     free(r);
 }
 
+/*
+    Adds `count` reads of sample `sample` to the replica r
+
+    Inputs:
+        r: pointer to the seq_replicas structure
+        sample: the sample id
+        count: the number of reads to add
+
+    Returns 1 if the sample is new for this replica, 0 otherwise
+*/
+int add_sample_replica(seq_replicas* r, int sample, int count){
+    r->count += count;
+    return add_sample_count(r->samples, sample, count);
+}
+
+/*
+    Adds the reads of the replica src to the replica dst
+
+    Inputs:
+        dst: pointer to the seq_replicas structure receiving the reads
+        src: pointer to the seq_replicas structure whose reads are added
+*/
+void merge_seq_replica(seq_replicas* dst, seq_replicas* src){
+    if(src->samples){
+        sample_count* pair = NULL;
+        while((pair = (sample_count*) utarray_next(src->samples, pair)))
+            add_sample_replica(dst, pair->sample, pair->count);
+    }
+    else{
+        char** label = NULL;
+        while((label = (char**) utarray_next(src->labels, label)))
+            add_replica(dst, *label);
+    }
+}
+
+/*
+    Grows the bucket array of the hash table of db up to one bucket per
+    expected unique sequence, so uthash does not expand it while inserting
+
+    Inputs:
+        db: pointer to the derep_db structure, with a non-empty table
+*/
+void _reserve_buckets(derep_db* db){
+    UT_hash_table* tbl = db->seqs->hh.tbl;
+    while(tbl->num_buckets < (unsigned) db->expected)
+        HASH_EXPAND_BUCKETS(tbl);
+}
+
+/*
+    Inserts the replica r in the database db, without checking if its
+    sequence is already present
+
+    Inputs:
+        db: pointer to the derep_db structure
+        r: pointer to the seq_replicas structure to insert
+*/
+void insert_seq_replica(derep_db* db, seq_replicas* r){
+    char** label = NULL;
+    int length = strlen(r->sequence);
+    if(db->sample_sep && !r->samples)
+        utarray_new(r->samples, &sample_count_icd);
+    HASH_ADD_KEYPTR(hh, db->seqs, r->sequence, length, r);
+    // A new table gets the size announced for it
+    if(db->unique == 0 && db->expected)
+        _reserve_buckets(db);
+    // Update unique counter
+    ++db->unique;
+    // Update the memory estimate
+    db->bytes += REPLICA_BYTES(length);
+    while((label=(char**)utarray_next(r->labels, label)))
+        db->bytes += LABEL_BYTES(strlen(*label));
+    if(r->samples)
+        db->bytes += sizeof(UT_array) + utarray_len(r->samples) * sizeof(sample_count);
+}
+
 /*
     Auxiliary function that compares two seq_replica structures by abundance
     For descendant sorting purposes
@@ -124,8 +250,17 @@ char* pack_derep_db(derep_db* db, int* msg_size){
     int size = 2 * sizeof(int);
     // For each sequence, allocate 500 chars + 2 ints: seq length and num labels
     size += (db->unique * (sizeof(char) * 500 + 2 * sizeof(int)));
-    // For each label, allocate 100 chars + 1 int: label length
-    size += (db->count * (sizeof(char) * 100 + sizeof(int)));
+    if(db->sample_sep){
+        // Per-sample counts are sent instead of the labels: the sample names
+        // (100 chars + 1 int each) and 2 ints per (sample, count) pair
+        seq_replicas* r;
+        size += sizeof(int) + get_num_samples() * (sizeof(char) * 100 + sizeof(int));
+        for(r = db->seqs; r != NULL; r = (seq_replicas*) r->hh.next)
+            size += utarray_len(r->samples) * 2 * sizeof(int);
+    }
+    else
+        // For each label, allocate 100 chars + 1 int: label length
+        size += (db->count * (sizeof(char) * 100 + sizeof(int)));
 
     // Allocate memory for the message
     char* buffer = (char*) malloc(size);
@@ -134,18 +269,38 @@ char* pack_derep_db(derep_db* db, int* msg_size){
     position = 0;
     MPI_Pack(&db->count, 1, MPI_INT, buffer, size, &position, MPI_COMM_WORLD);
     MPI_Pack(&db->unique, 1, MPI_INT, buffer, size, &position, MPI_COMM_WORLD);
+
+    int i;
+    int length;
+    if(db->sample_sep){
+        // Pack the names of the samples, so the receiver can map our ids
+        int num_samples = get_num_samples();
+        MPI_Pack(&num_samples, 1, MPI_INT, buffer, size, &position, MPI_COMM_WORLD);
+        for(i = 0; i < num_samples; i++){
+            length = strlen(get_sample_name(i));
+            MPI_Pack(&length, 1, MPI_INT, buffer, size, &position, MPI_COMM_WORLD);
+            MPI_Pack(get_sample_name(i), length, MPI_CHAR, buffer, size, &position, MPI_COMM_WORLD);
+        }
+    }
     
     // Loop through all the unique sequences present in the db
     seq_replicas* current;
     seq_replicas* tmp;
     char** label;
-    int length;
     HASH_ITER(hh, db->seqs, current, tmp){
         // Pack the length of the sequence
         length = strlen(current->sequence);
         MPI_Pack(&length, 1, MPI_INT, buffer, size, &position, MPI_COMM_WORLD);
         // Pack the sequence
         MPI_Pack(current->sequence, length, MPI_CHAR, buffer, size, &position, MPI_COMM_WORLD);
+        if(db->sample_sep){
+            // Pack the number of reads and the (sample, count) pairs
+            int num_pairs = utarray_len(current->samples);
+            MPI_Pack(&current->count, 1, MPI_INT, buffer, size, &position, MPI_COMM_WORLD);
+            MPI_Pack(&num_pairs, 1, MPI_INT, buffer, size, &position, MPI_COMM_WORLD);
+            MPI_Pack(current->samples->d, 2 * num_pairs, MPI_INT, buffer, size, &position, MPI_COMM_WORLD);
+            continue;
+        }
         // Pack the number of labels
         MPI_Pack(&current->count, 1, MPI_INT, buffer, size, &position, MPI_COMM_WORLD);
         // Loop through all the labels
@@ -171,8 +326,17 @@ char* pack_derep_db(derep_db* db, int* msg_size){
         db: de-replication database to send
         my_rank: this process rank
         dest: the rank of the destination process
+        comm: the communicator of my_rank and dest
 */
-void _send_derep_db(derep_db* db, int my_rank, int dest){
+void _send_derep_db(derep_db* db, int my_rank, int dest, MPI_Comm comm){
+    if(fingerprint_gather_enabled()){
+        send_fingerprinted_derep_db(db, dest, comm);
+        return;
+    }
+    if(gather_compression_enabled()){
+        send_compressed_derep_db(db, dest, comm);
+        return;
+    }
     // We need to send two messages
     // The first one contains the size of second message
     // The second one contains the serialized de-replication db
@@ -180,10 +344,11 @@ void _send_derep_db(derep_db* db, int my_rank, int dest){
     // Pack the db into a message so we know the size of it
     char* msg = pack_derep_db(db, &size);
     // Send the message with the size info
-    MPI_Send(&size, 1, MPI_INT, dest, 0, MPI_COMM_WORLD);
+    MPI_Send(&size, 1, MPI_INT, dest, 0, comm);
     // We can send now the database as the receiver has allocated enough
     // memory to receive it
-    MPI_Send(msg, size, MPI_PACKED, dest, 0, MPI_COMM_WORLD);
+    MPI_Send(msg, size, MPI_PACKED, dest, 0, comm);
+    STATS_ADD(bytes_sent, size + sizeof(int));
     // We can now free up the memory allocated for the msg
     free(msg);
 }
@@ -196,18 +361,28 @@ void _send_derep_db(derep_db* db, int my_rank, int dest){
         db: pointer to the local de-replication database structure
         my_rank: this process rank
         source: the rank of the source process
+        comm: the communicator of my_rank and source
 */
- void _recv_derep_db(derep_db* db, int my_rank, int source){
+ void _recv_derep_db(derep_db* db, int my_rank, int source, MPI_Comm comm){
+    if(fingerprint_gather_enabled()){
+        recv_fingerprinted_derep_db(db, source, comm);
+        return;
+    }
+    if(gather_compression_enabled()){
+        recv_compressed_derep_db(db, source, comm);
+        return;
+    }
     // We will receive two messages
     // The first one contains the size of second message
     // The second one contains the de-replication db
     int msg_size;
     // Receive the first message
-    MPI_Recv(&msg_size, 1, MPI_INT, source, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Recv(&msg_size, 1, MPI_INT, source, 0, comm, MPI_STATUS_IGNORE);
     // Create the buffer for receiving the second message
     char* msg = (char*) malloc(sizeof(char) * msg_size);
     // Receive the second message
-    MPI_Recv(msg, msg_size, MPI_PACKED, source, 0, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    MPI_Recv(msg, msg_size, MPI_PACKED, source, 0, comm, MPI_STATUS_IGNORE);
+    STATS_ADD(bytes_recv, msg_size + sizeof(int));
     // Merge the foreign database with the local one while unpacking it
     // This saves memory since we don't really need a derep_db structure
     // Unpack the count and unique counters
@@ -219,11 +394,25 @@ void _send_derep_db(derep_db* db, int my_rank, int dest){
     // We know that all the sequences present in the foreign database are going
     // to be added to the local one - so we can add already the count to it
     db->count += count;
-    // Loop through all the unique sequences
     int i;
     int j;
     int length;
     int label_count;
+    // Map the sample ids of the sender to ours
+    int* sample_map = NULL;
+    if(db->sample_sep){
+        int num_samples;
+        MPI_Unpack(msg, msg_size, &position, &num_samples, 1, MPI_INT, MPI_COMM_WORLD);
+        sample_map = (int*) malloc(sizeof(int) * (num_samples + 1));
+        for(i = 0; i < num_samples; i++){
+            MPI_Unpack(msg, msg_size, &position, &length, 1, MPI_INT, MPI_COMM_WORLD);
+            char* name = (char*) malloc(sizeof(char) * (length+1));
+            MPI_Unpack(msg, msg_size, &position, name, length, MPI_CHAR, MPI_COMM_WORLD);
+            sample_map[i] = intern_sample(name, length);
+            free(name);
+        }
+    }
+    // Loop through all the unique sequences
     for(i = 0; i < unique; i++){
         // Unpack the sequence length
         MPI_Unpack(msg, msg_size, &position, &length, 1, MPI_INT, MPI_COMM_WORLD);
@@ -236,15 +425,27 @@ void _send_derep_db(derep_db* db, int my_rank, int dest){
         // Check if the sequence is already present on the database
         seq_replicas* r;
         HASH_FIND_STR(db->seqs, sequence, r);
+        STATS_ADD(hash_probes, 1);
         if(!r){
             // The sequence didn't exist, add as a new sequence
             r = create_empty_seq_replica(sequence, length);
-            HASH_ADD_KEYPTR(hh, db->seqs, r->sequence, length, r);
-            // Update unique counter
-            ++db->unique;
+            insert_seq_replica(db, r);
         }
         // Free up sequence memory
         free(sequence);
+        if(db->sample_sep){
+            // Unpack the number of reads and the (sample, count) pairs
+            int pair[2];
+            int num_pairs;
+            MPI_Unpack(msg, msg_size, &position, &label_count, 1, MPI_INT, MPI_COMM_WORLD);
+            MPI_Unpack(msg, msg_size, &position, &num_pairs, 1, MPI_INT, MPI_COMM_WORLD);
+            for(j = 0; j < num_pairs; j++){
+                MPI_Unpack(msg, msg_size, &position, pair, 2, MPI_INT, MPI_COMM_WORLD);
+                if(add_sample_replica(r, sample_map[pair[0]], pair[1]))
+                    db->bytes += sizeof(sample_count);
+            }
+            continue;
+        }
         // Unpack the number of labels
         MPI_Unpack(msg, msg_size, &position, &label_count, 1, MPI_INT, MPI_COMM_WORLD);
         // Loop through all the labels
@@ -258,12 +459,261 @@ void _send_derep_db(derep_db* db, int my_rank, int dest){
             label[length] = '\0';
             // Add the label to the replica structure
             add_replica(r, label);
+            db->bytes += LABEL_BYTES(length);
             // Free up label memory
             free(label);
         }
     }
     // Free up buffer memory
     free(msg);
+    free(sample_map);
+}
+
+/*
+    Returns the size of the flat layout of db written by _write_flat_derep_db
+*/
+size_t _flat_size(derep_db* db){
+    int i;
+    char** label;
+    seq_replicas* current;
+    // Count and unique counters
+    size_t size = 2 * sizeof(int);
+    if(db->sample_sep){
+        // Number of samples and their names
+        size += sizeof(int);
+        for(i = 0; i < get_num_samples(); i++)
+            size += strlen(get_sample_name(i)) + 1;
+    }
+    for(current = db->seqs; current != NULL; current = (seq_replicas*) current->hh.next){
+        // Sequence length, sequence and number of reads
+        size += 2 * sizeof(int) + strlen(current->sequence) + 1;
+        if(db->sample_sep){
+            size += sizeof(int) + utarray_len(current->samples) * sizeof(sample_count);
+            continue;
+        }
+        label = NULL;
+        while((label=(char**)utarray_next(current->labels, label)))
+            size += strlen(*label) + 1;
+    }
+    return size;
+}
+
+/*
+    Writes db in a flat layout at out, which must hold _flat_size(db) bytes.
+    Unlike pack_derep_db, the strings are kept NUL-terminated so the
+    receiver can use them in place.
+
+    Inputs:
+        db: de-replication database to write
+        out: the destination memory
+*/
+void _write_flat_derep_db(derep_db* db, char* out){
+    int i;
+    int length;
+    char** label;
+    seq_replicas* current;
+    memcpy(out, &db->count, sizeof(int));
+    out += sizeof(int);
+    memcpy(out, &db->unique, sizeof(int));
+    out += sizeof(int);
+    if(db->sample_sep){
+        int num_samples = get_num_samples();
+        memcpy(out, &num_samples, sizeof(int));
+        out += sizeof(int);
+        for(i = 0; i < num_samples; i++){
+            length = strlen(get_sample_name(i)) + 1;
+            memcpy(out, get_sample_name(i), length);
+            out += length;
+        }
+    }
+    for(current = db->seqs; current != NULL; current = (seq_replicas*) current->hh.next){
+        length = strlen(current->sequence);
+        memcpy(out, &length, sizeof(int));
+        out += sizeof(int);
+        memcpy(out, current->sequence, length + 1);
+        out += length + 1;
+        memcpy(out, &current->count, sizeof(int));
+        out += sizeof(int);
+        if(db->sample_sep){
+            // The (sample, count) pairs
+            int num_pairs = utarray_len(current->samples);
+            memcpy(out, &num_pairs, sizeof(int));
+            out += sizeof(int);
+            memcpy(out, current->samples->d, num_pairs * sizeof(sample_count));
+            out += num_pairs * sizeof(sample_count);
+            continue;
+        }
+        // As many labels as reads
+        label = NULL;
+        while((label=(char**)utarray_next(current->labels, label))){
+            length = strlen(*label) + 1;
+            memcpy(out, *label, length);
+            out += length;
+        }
+    }
+}
+
+/*
+    Merges the de-replication database written at in by
+    _write_flat_derep_db with the local database db, reading it in place
+
+    Inputs:
+        db: pointer to the local de-replication database structure
+        in: the flat database
+*/
+void _merge_flat_derep_db(derep_db* db, char* in){
+    int i;
+    int j;
+    int count;
+    int unique;
+    int length;
+    int label_count;
+    int* sample_map = NULL;
+    memcpy(&count, in, sizeof(int));
+    in += sizeof(int);
+    memcpy(&unique, in, sizeof(int));
+    in += sizeof(int);
+    db->count += count;
+    if(db->sample_sep){
+        // Map the sample ids of the writer to ours
+        int num_samples;
+        memcpy(&num_samples, in, sizeof(int));
+        in += sizeof(int);
+        sample_map = (int*) malloc(sizeof(int) * (num_samples + 1));
+        for(i = 0; i < num_samples; i++){
+            length = strlen(in);
+            sample_map[i] = intern_sample(in, length);
+            in += length + 1;
+        }
+    }
+    for(i = 0; i < unique; i++){
+        memcpy(&length, in, sizeof(int));
+        in += sizeof(int);
+        char* sequence = in;
+        in += length + 1;
+        memcpy(&label_count, in, sizeof(int));
+        in += sizeof(int);
+        // Check if the sequence is already present on the database
+        seq_replicas* r;
+        HASH_FIND(hh, db->seqs, sequence, length, r);
+        STATS_ADD(hash_probes, 1);
+        if(!r){
+            r = create_empty_seq_replica(sequence, length);
+            insert_seq_replica(db, r);
+        }
+        if(db->sample_sep){
+            sample_count pair;
+            int num_pairs;
+            memcpy(&num_pairs, in, sizeof(int));
+            in += sizeof(int);
+            for(j = 0; j < num_pairs; j++){
+                memcpy(&pair, in, sizeof(sample_count));
+                in += sizeof(sample_count);
+                if(add_sample_replica(r, sample_map[pair.sample], pair.count))
+                    db->bytes += sizeof(sample_count);
+            }
+            continue;
+        }
+        for(j = 0; j < label_count; j++){
+            length = strlen(in);
+            // The label is copied by the labels array
+            add_replica(r, in);
+            db->bytes += LABEL_BYTES(length);
+            in += length + 1;
+        }
+    }
+    free(sample_map);
+}
+
+/*
+    Merges the databases of all the processes of comm into its process with
+    rank 0 with a binomial tree of point to point messages
+
+    Inputs:
+        db: the local derep_db - will be modified in place
+        my_rank: process rank in comm
+        comm_sz: the number of processes of comm
+        comm: the communicator
+*/
+void _tree_gather_derep_db(derep_db* db, int my_rank, int comm_sz, MPI_Comm comm){
+    // With a single process there is nothing to gather
+    if(comm_sz == 1)
+        return;
+    // Initialize bit mask
+    int bit_mask = 0x01 << (int)log2(comm_sz - 1);
+    // Loop while the bit_mask is not 0
+    while(bit_mask){
+        // Get the rank of the partner process
+        int partner = my_rank ^ bit_mask;
+        if(my_rank & bit_mask){
+            // I have a one on the position pointed by the bit mask
+            // I am a sender
+            _send_derep_db(db, my_rank, partner, comm);
+            // Once I sent my data, I'm done
+            break;
+        }
+        else{
+            // I have a zero on the position pointed by the bit mask
+            // I am a receiver
+            // In the first round, it's possible that not all receivers
+            // have a sender, so check the partner exists
+            if(partner < comm_sz){
+                // Receive and merge the foreign de-replication db with
+                // the local one
+                _recv_derep_db(db, my_rank, partner, comm);
+            }
+        }
+        // Update the bitmask
+        bit_mask = bit_mask >> 1;
+    }
+    // The fingerprints of our table are no longer needed
+    if(fingerprint_gather_enabled())
+        release_fingerprint_index();
+}
+
+/*
+    Merges the databases of all the processes of the node communicator into
+    its process with rank 0, with the same binomial tree as
+    _tree_gather_derep_db. In each round the senders write their database
+    in a shared memory window and their partners merge it in place, so no
+    message is packed or copied.
+
+    Inputs:
+        db: the local derep_db - will be modified in place
+        node_rank: process rank in the node communicator
+        node_sz: the number of processes of the node
+        node: the node communicator, of type MPI_COMM_TYPE_SHARED
+*/
+void _shared_gather_derep_db(derep_db* db, int node_rank, int node_sz, MPI_Comm node){
+    int disp_unit;
+    MPI_Aint size;
+    MPI_Win win;
+    char* base;
+    char* partner_base;
+    if(node_sz == 1)
+        return;
+    int bit_mask = 0x01 << (int)log2(node_sz - 1);
+    // Every round allocates a window collectively, so all the processes
+    // of the node go through all the rounds
+    while(bit_mask){
+        int partner = node_rank ^ bit_mask;
+        // Senders of this round: the bit is set and no higher bit is
+        int sender = (node_rank & bit_mask) && node_rank < 2 * bit_mask;
+        int receiver = !(node_rank & bit_mask) && node_rank < bit_mask && partner < node_sz;
+        size = sender ? _flat_size(db) : 0;
+        MPI_Win_allocate_shared(size, 1, MPI_INFO_NULL, node, &base, &win);
+        MPI_Win_fence(0, win);
+        if(sender)
+            _write_flat_derep_db(db, base);
+        MPI_Win_fence(0, win);
+        if(receiver){
+            MPI_Win_shared_query(win, partner, &size, &disp_unit, &partner_base);
+            _merge_flat_derep_db(db, partner_base);
+        }
+        MPI_Win_fence(0, win);
+        MPI_Win_free(&win);
+        bit_mask = bit_mask >> 1;
+    }
 }
 
 /*******************************************
@@ -282,12 +732,31 @@ derep_db* create_derep_db(void){
     // There is no sequence still, so count and unique are 0
     db->count = 0;
     db->unique = 0;
+    db->bytes = 0;
+    // The table grows on demand unless it is pre-sized
+    db->expected = 0;
+    // Keep labels or per-sample counts as currently configured
+    db->sample_sep = get_sample_separator();
     // Initialize the hash table to NULL
     db->seqs = NULL;
     // Return the new database
     return db;
 }
 
+/*
+    Pre-sizes the hash table of db for `expected` unique sequences
+
+    Inputs:
+        db: pointer to the derep_db structure
+        expected: the expected number of unique sequences
+*/
+void presize_derep_db(derep_db* db, long expected){
+    db->expected = expected;
+    // A table already in use is resized now, otherwise on its first insertion
+    if(db->seqs)
+        _reserve_buckets(db);
+}
+
 /*
     Destroys the de-replication database db
 
@@ -306,6 +775,39 @@ void destroy_derep_db(derep_db* db){
     free(db);
 }
 
+/*
+    Records the sequence seq in the database db, given the replica r that
+    holds it - NULL if the sequence is new
+
+    Inputs:
+        db: pointer to the derep_db structure
+        seq: pointer to the sequence structure
+        r: pointer to the seq_replicas structure of the sequence, or NULL
+*/
+void _dereplicate_found(derep_db* db, sequence* seq, seq_replicas* r){
+    if(db->sample_sep){
+        // Only the sample of the read is recorded
+        if(!r){
+            r = create_empty_seq_replica(seq->sequence, seq->seq_length);
+            insert_seq_replica(db, r);
+        }
+        if(add_sample_replica(r, intern_sample_label(seq->label), 1))
+            db->bytes += sizeof(sample_count);
+    }
+    else if(r){
+        // The sequence was already present on the DB
+        add_replica(r, seq->label);
+        db->bytes += LABEL_BYTES(seq->label_length);
+    }
+    else{
+        // The sequence didn't exist, add as new sequence
+        r = create_seq_replica(seq);
+        insert_seq_replica(db, r);
+    }
+    // Update counter
+    ++db->count;
+}
+
 /*
     De-replicates the sequence seq. If the sequence is already present,
     the label is recorded and the sequence struct freed up. Otherwise,
@@ -320,19 +822,52 @@ void dereplicate_db(derep_db* db, sequence* seq){
     // Check if the sequence already exists on the DB
     seq_replicas* r;
     HASH_FIND_STR(db->seqs, seq->sequence, r);
-    if(r){
-        // The sequence was already present on the DB
-        add_replica(r, seq->label);
+    STATS_ADD(hash_probes, 1);
+    _dereplicate_found(db, seq, r);
+}
+
+/*
+    De-replicates the n sequences of seqs, hashing them and prefetching
+    their buckets before any of them is looked up
+
+    Inputs:
+        db: pointer to the derep_db structure
+        seqs: array of pointers to the sequence structures
+        n: the number of sequences, at most DEREP_BATCH
+*/
+void dereplicate_db_batch(derep_db* db, sequence** seqs, int n){
+    int i;
+    unsigned bucket;
+    unsigned hashv[DEREP_BATCH];
+    UT_hash_table* tbl;
+    seq_replicas* r;
+    // The table is created by its first insertion
+    for(i = 0; i < n && db->seqs == NULL; i++)
+        dereplicate_db(db, seqs[i]);
+    if(i == n)
+        return;
+    seqs += i;
+    n -= i;
+    tbl = db->seqs->hh.tbl;
+    // First pass: hash all the keys and prefetch their buckets
+    for(i = 0; i < n; i++){
+        HASH_FCN(seqs[i]->sequence, seqs[i]->seq_length, tbl->num_buckets, hashv[i], bucket);
+        __builtin_prefetch(&tbl->buckets[bucket]);
     }
-    else{
-        // The sequence didn't exist, add as new sequence
-        r = create_seq_replica(seq);
-        HASH_ADD_KEYPTR(hh, db->seqs, r->sequence, strlen(r->sequence), r);
-        // Update unique counter
-        ++db->unique;
+    // Second pass: prefetch the first entry of each bucket, now at hand
+    for(i = 0; i < n; i++){
+        UT_hash_handle* head = tbl->buckets[hashv[i] & (tbl->num_buckets - 1)].hh_head;
+        if(head)
+            __builtin_prefetch(head);
     }
-    // Update counter
-    ++db->count;
+    // Last pass: resolve the probes in order. The inserts may grow the
+    // bucket array, so the buckets are recomputed from the hash values
+    for(i = 0; i < n; i++){
+        HASH_TO_BKT(hashv[i], tbl->num_buckets, bucket);
+        HASH_FIND_IN_BKT(tbl, hh, tbl->buckets[bucket], seqs[i]->sequence, seqs[i]->seq_length, r);
+        _dereplicate_found(db, seqs[i], r);
+    }
+    STATS_ADD(hash_probes, n);
 }
 
 /*
@@ -352,13 +887,13 @@ void sort_db(derep_db* db){
     Inputs:
         db: pointer to the derep_db struct
         fasta: string with the output fasta filename
-        map: string with the output OTU map filename
+        map: string with the output OTU map filename - NULL to skip it
 */
 void write_output(derep_db* db, char* fasta, char* map){
     int i;
-    // Open fasta and OTU map files
-    FILE* fasta_fd = fopen(fasta, "w");
-    FILE* map_fd = fopen(map, "w");
+    // Open fasta and OTU map files - each one is written by its own thread
+    out_writer* fasta_w = create_out_writer(fasta);
+    out_writer* map_w = map ? create_out_writer(map) : NULL;
 
     // Loop through all the sequences
     seq_replicas* current;
@@ -367,22 +902,94 @@ void write_output(derep_db* db, char* fasta, char* map){
     i = 0;
     HASH_ITER(hh, db->seqs, current, tmp){
         // Write sequence into the fasta file
-        fprintf(fasta_fd, ">Seq_%d count=%d\n%s\n", i, current->count,current->sequence);
+        writer_put(fasta_w, ">Seq_", 5);
+        writer_put_int(fasta_w, i);
+        writer_put(fasta_w, " count=", 7);
+        writer_put_int(fasta_w, current->count);
+        writer_put_char(fasta_w, '\n');
+        writer_put_str(fasta_w, current->sequence);
+        writer_put_char(fasta_w, '\n');
+        i++;
+        if(!map_w)
+            continue;
         // Write OTU id in the OTU map
-        fprintf(map_fd, "Seq_%d", i);
+        writer_put(map_w, "Seq_", 4);
+        writer_put_int(map_w, i-1);
         // Write all the labels
         l = NULL;
         while((l=(char**)utarray_next(current->labels, l))){
-            fprintf(map_fd, "\t%s", *l);
+            writer_put_char(map_w, '\t');
+            writer_put_str(map_w, *l);
         }
         // Current OTU done - write new line character in the OTU map
-        fprintf(map_fd, "\n");
-        // and increment OTU counter
-        i++;
+        writer_put_char(map_w, '\n');
     }
-    // Close files
-    fclose(fasta_fd);
-    fclose(map_fd);
+    // Flush and close files
+    destroy_out_writer(fasta_w);
+    if(map_w)
+        destroy_out_writer(map_w);
+}
+
+/*
+    Auxiliary function that compares two sample ids by sample name
+*/
+int _compare_sample_names(const void* a, const void* b){
+    return strcmp(get_sample_name(*(int*)a), get_sample_name(*(int*)b));
+}
+
+/*
+    Writes the sample x unique abundance table of the de-replication
+    database db as a tab-separated file
+
+    Inputs:
+        db: pointer to the derep_db struct
+        table: string with the output table filename
+*/
+void write_sample_table(derep_db* db, char* table){
+    int i;
+    int num_samples = get_num_samples();
+    out_writer* w = create_out_writer(table);
+    // Columns are sorted by sample name
+    int* order = (int*) malloc(sizeof(int) * (num_samples + 1));
+    int* column = (int*) malloc(sizeof(int) * (num_samples + 1));
+    for(i = 0; i < num_samples; i++)
+        order[i] = i;
+    qsort(order, num_samples, sizeof(int), _compare_sample_names);
+    for(i = 0; i < num_samples; i++)
+        column[order[i]] = i;
+    // Header
+    writer_put_str(w, "#OTU ID");
+    for(i = 0; i < num_samples; i++){
+        writer_put_char(w, '\t');
+        writer_put_str(w, get_sample_name(order[i]));
+    }
+    writer_put_char(w, '\n');
+    // One dense row per unique sequence
+    int* row = (int*) calloc(num_samples + 1, sizeof(int));
+    seq_replicas* current;
+    seq_replicas* tmp;
+    sample_count* pair;
+    int otu = 0;
+    HASH_ITER(hh, db->seqs, current, tmp){
+        pair = NULL;
+        while((pair=(sample_count*)utarray_next(current->samples, pair)))
+            row[column[pair->sample]] = pair->count;
+        writer_put(w, "Seq_", 4);
+        writer_put_int(w, otu++);
+        for(i = 0; i < num_samples; i++){
+            writer_put_char(w, '\t');
+            writer_put_int(w, row[i]);
+        }
+        writer_put_char(w, '\n');
+        // Clear the row for the next unique
+        pair = NULL;
+        while((pair=(sample_count*)utarray_next(current->samples, pair)))
+            row[column[pair->sample]] = 0;
+    }
+    destroy_out_writer(w);
+    free(order);
+    free(column);
+    free(row);
 }
 
 /*
@@ -395,31 +1002,90 @@ void write_output(derep_db* db, char* fasta, char* map){
         comm_sz: the number of processes
 */
 void gather_derep_db(derep_db* db, int my_rank, int comm_sz){
-    // Initialize bit mask
-    int bit_mask = 0x01 << (int)log2(comm_sz - 1);
-    // Loop while the bit_mask is not 0
-    while(bit_mask){
-        // Get the rank of the partner process
-        int partner = my_rank ^ bit_mask;
-        if(my_rank & bit_mask){
-            // I have a one on the position pointed by the bit mask
-            // I am a sender
-            _send_derep_db(db, my_rank, partner);
-            // Once I sent my data, I'm done
-            break;
-        }
-        else{
-            // I have a zero on the position pointed by the bit mask
-            // I am a receiver
-            // In the first round, it's possible that not all receivers
-            // have a sender, so check the partner exists
-            if(partner < comm_sz){
-                // Receive and merge the foreign de-replication db with
-                // the local one
-                _recv_derep_db(db, my_rank, partner);
-            }
-        }
-        // Update the bitmask
-        bit_mask = bit_mask >> 1;
+    _tree_gather_derep_db(db, my_rank, comm_sz, MPI_COMM_WORLD);
+}
+
+/*
+    Returns the number of processes in the subtree of rank in the binomial
+    tree of _tree_gather_derep_db over size processes, rank included
+*/
+int _binomial_subtree(int rank, int size){
+    int subtree = rank ? (rank & -rank) : size;
+    return (subtree > size - rank) ? size - rank : subtree;
+}
+
+/*
+    Collects all the information about the derep_db spread across multiple
+    processes in the process with rank 0 in two levels: the processes of
+    each node merge their databases through shared memory, and then the
+    first process of each node takes part in a gather across the nodes
+
+    Inputs:
+        db: the local derep_db - will be modified in place
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void node_gather_derep_db(derep_db* db, int my_rank, int comm_sz){
+    int node_rank;
+    int node_sz;
+    MPI_Comm node;
+    MPI_Comm leaders;
+    if(comm_sz == 1)
+        return;
+    // Group the processes that can share memory, ordered by rank so rank 0
+    // leads its node
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &node_rank);
+    MPI_Comm_size(node, &node_sz);
+    _shared_gather_derep_db(db, node_rank, node_sz, node);
+    // Only the leader of each node goes on to the inter-node gather
+    MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, my_rank, &leaders);
+    if(leaders != MPI_COMM_NULL){
+        int leader_rank;
+        int num_leaders;
+        MPI_Comm_rank(leaders, &leader_rank);
+        MPI_Comm_size(leaders, &num_leaders);
+        _tree_gather_derep_db(db, leader_rank, num_leaders, leaders);
+        MPI_Comm_free(&leaders);
     }
-}
\ No newline at end of file
+    MPI_Comm_free(&node);
+}
+
+/*
+    Returns the number of processes whose databases end up merged in the
+    one of process my_rank with node_gather_derep_db
+
+    Inputs:
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+int node_gather_subtree(int my_rank, int comm_sz){
+    int i;
+    int node_rank;
+    int node_sz;
+    MPI_Comm node;
+    MPI_Comm leaders;
+    // Same communicators as node_gather_derep_db
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node);
+    MPI_Comm_rank(node, &node_rank);
+    MPI_Comm_size(node, &node_sz);
+    int subtree = _binomial_subtree(node_rank, node_sz);
+    MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, my_rank, &leaders);
+    if(leaders != MPI_COMM_NULL){
+        int leader_rank;
+        int num_leaders;
+        MPI_Comm_rank(leaders, &leader_rank);
+        MPI_Comm_size(leaders, &num_leaders);
+        // A leader merges whole nodes, whatever their size
+        int* node_sizes = (int*) malloc(sizeof(int) * num_leaders);
+        MPI_Allgather(&node_sz, 1, MPI_INT, node_sizes, 1, MPI_INT, leaders);
+        int span = _binomial_subtree(leader_rank, num_leaders);
+        subtree = 0;
+        for(i = leader_rank; i < leader_rank + span; i++)
+            subtree += node_sizes[i];
+        free(node_sizes);
+        MPI_Comm_free(&leaders);
+    }
+    MPI_Comm_free(&node);
+    return subtree;
+}
@@ -0,0 +1,432 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+#include "dist_output.h"
+#include "hash.h"
+#include "stats.h"
+#include "util.h"
+
+// Seed of the hash that assigns each sequence to a process
+#define OWNER_SEED 0x51ed2701ULL
+
+/*
+    Orders two uniques by abundance (descending) and then by sequence
+
+    Returns a negative number if (count_a, seq_a) goes first, a positive
+    one if (count_b, seq_b) does and 0 if they are equal
+*/
+int _compare_order(int count_a, char* seq_a, int count_b, char* seq_b){
+    if(count_a != count_b)
+        return count_b - count_a;
+    return strcmp(seq_a, seq_b);
+}
+
+/*
+    Auxiliary function that compares two seq_replicas pointers in output
+    order, for qsort
+*/
+int _compare_replicas(const void* a, const void* b){
+    seq_replicas* ra = *(seq_replicas**) a;
+    seq_replicas* rb = *(seq_replicas**) b;
+    return _compare_order(ra->count, ra->sequence, rb->count, rb->sequence);
+}
+
+/*
+    Appends the decimal representation of the non-negative value to b
+*/
+void _append_int(byte_buffer* b, long value){
+    char digits[24];
+    int i = sizeof(digits);
+    do{
+        digits[--i] = '0' + (value % 10);
+        value /= 10;
+    }while(value);
+    buffer_append(b, digits + i, sizeof(digits) - i);
+}
+
+/*
+    Appends the replica r to b: the sequence length and sequence, followed
+    by the number of labels and the labels, each with its length
+*/
+void _pack_replica(byte_buffer* b, seq_replicas* r){
+    int length = strlen(r->sequence);
+    char** label = NULL;
+    buffer_append(b, &length, sizeof(int));
+    buffer_append(b, r->sequence, length);
+    buffer_append(b, &r->count, sizeof(int));
+    while((label=(char**)utarray_next(r->labels, label))){
+        length = strlen(*label);
+        buffer_append(b, &length, sizeof(int));
+        buffer_append(b, *label, length);
+    }
+}
+
+/*
+    Merges the replicas packed by _pack_replica in the size bytes of data
+    with the database db
+*/
+void _unpack_replicas(derep_db* db, char* data, size_t size){
+    int i;
+    int length;
+    int count;
+    int capacity = 0;
+    char* buffer = NULL;
+    char* end = data + size;
+    while(data < end){
+        memcpy(&length, data, sizeof(int));
+        data += sizeof(int);
+        if(length + 1 > capacity){
+            capacity = 2 * (length + 1);
+            buffer = (char*) realloc(buffer, capacity);
+        }
+        memcpy(buffer, data, length);
+        buffer[length] = '\0';
+        data += length;
+        seq_replicas* r;
+        HASH_FIND(hh, db->seqs, buffer, length, r);
+        if(!r){
+            r = create_empty_seq_replica(buffer, length);
+            insert_seq_replica(db, r);
+        }
+        memcpy(&count, data, sizeof(int));
+        data += sizeof(int);
+        for(i = 0; i < count; i++){
+            memcpy(&length, data, sizeof(int));
+            data += sizeof(int);
+            if(length + 1 > capacity){
+                capacity = 2 * (length + 1);
+                buffer = (char*) realloc(buffer, capacity);
+            }
+            memcpy(buffer, data, length);
+            buffer[length] = '\0';
+            data += length;
+            add_replica(r, buffer);
+        }
+    }
+    free(buffer);
+}
+
+/*
+    Sends the replicas packed in send, laid out by destination process as
+    given by send_counts, to their processes, and merges the replicas
+    received into db
+
+    Inputs:
+        db: the derep_db that receives the replicas
+        send: the packed replicas
+        send_counts: the number of bytes for each process
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void _exchange_replicas(derep_db* db, byte_buffer* send, int* send_counts, int my_rank, int comm_sz){
+    int i;
+    int* send_displs = (int*) malloc(sizeof(int) * comm_sz);
+    int* recv_counts = (int*) malloc(sizeof(int) * comm_sz);
+    int* recv_displs = (int*) malloc(sizeof(int) * comm_sz);
+    size_t displ = 0;
+    for(i = 0; i < comm_sz; i++){
+        send_displs[i] = displ;
+        displ += send_counts[i];
+    }
+    MPI_Alltoall(send_counts, 1, MPI_INT, recv_counts, 1, MPI_INT, MPI_COMM_WORLD);
+    size_t recv_size = 0;
+    for(i = 0; i < comm_sz; i++){
+        recv_displs[i] = recv_size;
+        recv_size += recv_counts[i];
+    }
+    char* recv = (char*) malloc(recv_size + 1);
+    MPI_Alltoallv(send->data, send_counts, send_displs, MPI_BYTE,
+                  recv, recv_counts, recv_displs, MPI_BYTE, MPI_COMM_WORLD);
+    STATS_ADD(bytes_sent, send->size - send_counts[my_rank]);
+    STATS_ADD(bytes_recv, recv_size - recv_counts[my_rank]);
+    free(send->data);
+    send->data = NULL;
+    send->size = send->capacity = 0;
+    _unpack_replicas(db, recv, recv_size);
+    free(recv);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+}
+
+/*
+    Moves every unique of db to the process that owns its sequence, by
+    hash, so the same sequence is never held by two processes
+*/
+void _redistribute_by_hash(derep_db* db, int my_rank, int comm_sz){
+    int i;
+    int n = 0;
+    seq_replicas* current;
+    seq_replicas* tmp;
+    // Bucket the uniques by owner (counting sort)
+    int* owners = (int*) malloc(sizeof(int) * (db->unique + 1));
+    int* starts = (int*) calloc(comm_sz + 1, sizeof(int));
+    HASH_ITER(hh, db->seqs, current, tmp){
+        owners[n] = hash_bytes64(current->sequence, strlen(current->sequence), OWNER_SEED) % comm_sz;
+        ++starts[owners[n++] + 1];
+    }
+    for(i = 0; i < comm_sz; i++)
+        starts[i+1] += starts[i];
+    seq_replicas** replicas = (seq_replicas**) malloc(sizeof(seq_replicas*) * (n + 1));
+    n = 0;
+    HASH_ITER(hh, db->seqs, current, tmp){
+        replicas[starts[owners[n++]]++] = current;
+        HASH_DEL(db->seqs, current);
+    }
+    db->unique = 0;
+    db->bytes = 0;
+    // starts now holds the end of each bucket
+    byte_buffer send = {NULL, 0, 0};
+    int* send_counts = (int*) malloc(sizeof(int) * comm_sz);
+    for(i = 0; i < comm_sz; i++){
+        int j;
+        size_t start = send.size;
+        for(j = i ? starts[i-1] : 0; j < starts[i]; j++){
+            _pack_replica(&send, replicas[j]);
+            destroy_seq_replica(replicas[j]);
+        }
+        send_counts[i] = send.size - start;
+    }
+    free(replicas);
+    free(owners);
+    free(starts);
+    _exchange_replicas(db, &send, send_counts, my_rank, comm_sz);
+    free(send_counts);
+}
+
+/*
+    Returns the uniques of db in an array sorted in output order, removing
+    them from the hash table of db
+*/
+seq_replicas** _sorted_replicas(derep_db* db){
+    int n = 0;
+    seq_replicas* current;
+    seq_replicas* tmp;
+    seq_replicas** replicas = (seq_replicas**) malloc(sizeof(seq_replicas*) * (db->unique + 1));
+    HASH_ITER(hh, db->seqs, current, tmp){
+        replicas[n++] = current;
+        HASH_DEL(db->seqs, current);
+    }
+    qsort(replicas, n, sizeof(seq_replicas*), _compare_replicas);
+    return replicas;
+}
+
+/*
+    Sample sort of the uniques of all the processes in output order. Each
+    process picks comm_sz - 1 regular samples of its sorted uniques; the
+    splitters chosen among all the samples give each process a range of
+    the order, and the uniques are exchanged so each one holds its range.
+*/
+void _sample_sort(derep_db* db, int my_rank, int comm_sz){
+    int i;
+    int j;
+    int length;
+    int n = db->unique;
+    seq_replicas** local = _sorted_replicas(db);
+    db->unique = 0;
+    db->bytes = 0;
+
+    // Regular samples: (count, length, sequence)
+    byte_buffer samples = {NULL, 0, 0};
+    for(i = 0; n > 0 && i < comm_sz - 1; i++){
+        seq_replicas* r = local[(long)(i + 1) * n / comm_sz];
+        length = strlen(r->sequence);
+        buffer_append(&samples, &r->count, sizeof(int));
+        buffer_append(&samples, &length, sizeof(int));
+        buffer_append(&samples, r->sequence, length + 1);
+    }
+    int sample_size = samples.size;
+    int* sample_sizes = (int*) malloc(sizeof(int) * comm_sz);
+    int* sample_displs = (int*) malloc(sizeof(int) * comm_sz);
+    MPI_Allgather(&sample_size, 1, MPI_INT, sample_sizes, 1, MPI_INT, MPI_COMM_WORLD);
+    int total_size = 0;
+    for(i = 0; i < comm_sz; i++){
+        sample_displs[i] = total_size;
+        total_size += sample_sizes[i];
+    }
+    char* all_samples = (char*) malloc(total_size + 1);
+    MPI_Allgatherv(samples.data, sample_size, MPI_BYTE, all_samples, sample_sizes,
+                   sample_displs, MPI_BYTE, MPI_COMM_WORLD);
+    free(samples.data);
+    // Point at every sample, reusing empty replicas as holders
+    int num_samples = 0;
+    int capacity = 0;
+    seq_replicas** sorted_samples = NULL;
+    char* in = all_samples;
+    while(in < all_samples + total_size){
+        if(num_samples == capacity){
+            capacity = capacity ? 2 * capacity : 64;
+            sorted_samples = (seq_replicas**) realloc(sorted_samples, sizeof(seq_replicas*) * capacity);
+        }
+        int count;
+        memcpy(&count, in, sizeof(int));
+        memcpy(&length, in + sizeof(int), sizeof(int));
+        in += 2 * sizeof(int);
+        seq_replicas* r = create_empty_seq_replica(in, length);
+        r->count = count;
+        sorted_samples[num_samples++] = r;
+        in += length + 1;
+    }
+    qsort(sorted_samples, num_samples, sizeof(seq_replicas*), _compare_replicas);
+
+    // Process p gets the uniques in (splitter[p-1], splitter[p]], and the
+    // last process the rest
+    byte_buffer send = {NULL, 0, 0};
+    int* send_counts = (int*) malloc(sizeof(int) * comm_sz);
+    int first = 0;
+    for(i = 0; i < comm_sz; i++){
+        int last = n;
+        if(i < comm_sz - 1 && num_samples > 0){
+            seq_replicas* splitter = sorted_samples[(long)(i + 1) * num_samples / comm_sz];
+            last = first;
+            while(last < n && _compare_replicas(&local[last], &splitter) <= 0)
+                ++last;
+        }
+        else if(i < comm_sz - 1)
+            last = first;
+        size_t start = send.size;
+        for(j = first; j < last; j++){
+            _pack_replica(&send, local[j]);
+            destroy_seq_replica(local[j]);
+        }
+        send_counts[i] = send.size - start;
+        first = last;
+    }
+    free(local);
+    for(i = 0; i < num_samples; i++)
+        destroy_seq_replica(sorted_samples[i]);
+    free(sorted_samples);
+    free(all_samples);
+    free(sample_sizes);
+    free(sample_displs);
+    _exchange_replicas(db, &send, send_counts, my_rank, comm_sz);
+    free(send_counts);
+}
+
+/*
+    Writes the size bytes of data at offset of the file fh, in pieces of at
+    most DIST_WRITE_PIECE bytes
+*/
+void _write_slice(MPI_File fh, char* path, MPI_Offset offset, char* data, size_t size){
+    size_t done;
+    for(done = 0; done < size; done += DIST_WRITE_PIECE){
+        int piece = (size - done < DIST_WRITE_PIECE) ? (int)(size - done) : DIST_WRITE_PIECE;
+        if(MPI_File_write_at(fh, offset + done, data + done, piece, MPI_BYTE, MPI_STATUS_IGNORE) != MPI_SUCCESS)
+            error_handler(FATAL_ERROR, "Error writing output file %s", path);
+    }
+}
+
+/*
+    Writes the slice b of the file path at the end of the slices of the
+    processes with a lower rank. Must be called by all the processes.
+*/
+void _write_shared_file(char* path, byte_buffer* b){
+    int my_rank;
+    MPI_File fh;
+    long long size = b->size;
+    long long offset = 0;
+    long long total;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    MPI_Exscan(&size, &offset, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    // MPI_Exscan leaves the result of rank 0 undefined
+    if(my_rank == 0)
+        offset = 0;
+    MPI_Allreduce(&size, &total, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if(MPI_File_open(MPI_COMM_WORLD, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+        error_handler(FATAL_ERROR, "Error opening output file %s", path);
+    // Cut any previous, longer contents of the file - the slices cover
+    // the whole new size
+    MPI_File_set_size(fh, total);
+    _write_slice(fh, path, offset, b->data, b->size);
+    MPI_File_close(&fh);
+}
+
+/*
+    Writes the FASTA and OTU map outputs from the local, not gathered,
+    de-replication databases of all the processes, without collecting them
+    in a single process
+
+    Inputs:
+        db: the local derep_db
+        fasta: string with the output fasta filename
+        map: string with the output OTU map filename - NULL to skip it
+        sort: 1 to order the output by abundance, 0 otherwise
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void write_distributed_output(derep_db* db, char* fasta, char* map, int sort, int my_rank, int comm_sz){
+    int i;
+    char** l;
+    STATS_TIC(t_sort);
+    // Each sequence in a single process
+    _redistribute_by_hash(db, my_rank, comm_sz);
+    // Each process with a contiguous range of the output order
+    if(sort)
+        _sample_sort(db, my_rank, comm_sz);
+    int n = db->unique;
+    seq_replicas** replicas = NULL;
+    if(sort){
+        replicas = _sorted_replicas(db);
+    }
+    else{
+        seq_replicas* current;
+        seq_replicas* tmp;
+        replicas = (seq_replicas**) malloc(sizeof(seq_replicas*) * (n + 1));
+        i = 0;
+        HASH_ITER(hh, db->seqs, current, tmp){
+            replicas[i++] = current;
+            HASH_DEL(db->seqs, current);
+        }
+    }
+    STATS_TOC(PHASE_SORT, t_sort);
+
+    STATS_TIC(t_write);
+    // The OTU id of our first unique
+    long first_id = 0;
+    long num = n;
+    MPI_Exscan(&num, &first_id, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+    if(my_rank == 0)
+        first_id = 0;
+    // Format our slices of the files
+    byte_buffer fasta_b = {NULL, 0, 0};
+    byte_buffer map_b = {NULL, 0, 0};
+    for(i = 0; i < n; i++){
+        seq_replicas* r = replicas[i];
+        buffer_append(&fasta_b, ">Seq_", 5);
+        _append_int(&fasta_b, first_id + i);
+        buffer_append(&fasta_b, " count=", 7);
+        _append_int(&fasta_b, r->count);
+        buffer_append(&fasta_b, "\n", 1);
+        buffer_append(&fasta_b, r->sequence, strlen(r->sequence));
+        buffer_append(&fasta_b, "\n", 1);
+        if(map){
+            buffer_append(&map_b, "Seq_", 4);
+            _append_int(&map_b, first_id + i);
+            l = NULL;
+            while((l=(char**)utarray_next(r->labels, l))){
+                buffer_append(&map_b, "\t", 1);
+                buffer_append(&map_b, *l, strlen(*l));
+            }
+            buffer_append(&map_b, "\n", 1);
+        }
+        destroy_seq_replica(r);
+    }
+    free(replicas);
+    _write_shared_file(fasta, &fasta_b);
+    if(map)
+        _write_shared_file(map, &map_b);
+    free(fasta_b.data);
+    free(map_b.data);
+    STATS_TOC(PHASE_WRITE, t_write);
+
+    // Totals for the report of rank 0
+    int totals[2];
+    int local[2] = {db->count, n};
+    MPI_Reduce(local, totals, 2, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    db->unique = 0;
+    db->bytes = 0;
+    if(my_rank == 0){
+        db->count = totals[0];
+        db->unique = totals[1];
+    }
+}
@@ -0,0 +1,375 @@
+#include <emmintrin.h>
+#include <math.h>
+#include <ctype.h>
+#include <string.h>
+#include "filter.h"
+#include "stats.h"
+#include "util.h"
+
+// Index of each primer in the primer tables
+#define PRIMER_FORWARD 0
+#define PRIMER_REVERSE 1
+
+// Maximum expected errors of the reads kept (negative means no filter)
+static double MAX_EE = -1.0;
+// Quality score at which the reads are truncated (negative means no truncation)
+static int TRUNCQUAL = -1;
+// Error probability of each quality character, filled on first use
+static float ERROR_PROBABILITY[256];
+static int ERROR_TABLE_READY = 0;
+// Length of each primer (0 means no primer) and, for each of its
+// positions, whether it accepts an A, a C, a G or a T (0xff) or not (0).
+// The reverse primer is stored reverse complemented, as found in the reads
+static int PRIMER_LENGTH[2] = {0, 0};
+static char PRIMER_ACCEPTS[2][4][PRIMER_MAX_LENGTH] __attribute__ ((aligned (16)));
+// Largest number of mismatches of a primer match
+static int PRIMER_MISMATCHES = 0;
+// Length the reads are truncated to, and length limits (0 means none)
+static int TRUNCLEN = 0;
+static int MINLEN = 0;
+static int MAXLEN = 0;
+
+/*
+    Fills the table that maps each quality character to its error
+    probability, 10^(-Q/10)
+*/
+void _init_error_table(void){
+    int c;
+    for(c = 0; c < 256; c++){
+        int q = c - PHRED_OFFSET;
+        // Characters below the offset are treated as Q0
+        ERROR_PROBABILITY[c] = (q <= 0) ? 1.0f : (float) pow(10.0, -q / 10.0);
+    }
+    ERROR_TABLE_READY = 1;
+}
+
+/*
+    Sets the maximum number of expected errors of the reads that are kept
+
+    Inputs:
+        max_ee: the maximum expected errors - negative to disable the filter
+*/
+void set_max_expected_errors(double max_ee){
+    MAX_EE = max_ee;
+    if(!ERROR_TABLE_READY)
+        _init_error_table();
+}
+
+/*
+    Sets the quality score at which the reads are truncated
+
+    Inputs:
+        truncqual: the Phred quality score - negative to disable truncation
+*/
+void set_truncqual(int truncqual){
+    TRUNCQUAL = truncqual;
+}
+
+/*
+    Returns the bases of the IUPAC code c, in any case, as a mask (1 for A,
+    2 for C, 4 for G and 8 for T), or 0 if c is not an IUPAC code
+*/
+int _iupac_bases(char c){
+    switch(toupper((unsigned char) c)){
+        case 'A': return 1;
+        case 'C': return 2;
+        case 'G': return 4;
+        case 'T': case 'U': return 8;
+        case 'R': return 1 | 4;
+        case 'Y': return 2 | 8;
+        case 'S': return 2 | 4;
+        case 'W': return 1 | 8;
+        case 'K': return 4 | 8;
+        case 'M': return 1 | 2;
+        case 'B': return 2 | 4 | 8;
+        case 'D': return 1 | 4 | 8;
+        case 'H': return 1 | 2 | 8;
+        case 'V': return 1 | 2 | 4;
+        case 'N': return 1 | 2 | 4 | 8;
+        default: return 0;
+    }
+}
+
+/*
+    Returns 1 if primer is a valid primer: IUPAC codes, at most
+    PRIMER_MAX_LENGTH of them and more than max_mismatches, so a match
+    needs at least one primer base
+*/
+int _valid_primer(char* primer, int max_mismatches){
+    int i;
+    int length = strlen(primer);
+    if(length <= max_mismatches || length > PRIMER_MAX_LENGTH)
+        return 0;
+    for(i = 0; i < length; i++){
+        if(!_iupac_bases(primer[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+    Fills the table of the primer `index` from the primer string
+
+    Inputs:
+        index: PRIMER_FORWARD or PRIMER_REVERSE
+        primer: the primer, a valid one
+        reverse: 1 to store the reverse complement of primer
+*/
+void _set_primer(int index, char* primer, int reverse){
+    int i;
+    int b;
+    int length = strlen(primer);
+    memset(PRIMER_ACCEPTS[index], 0, sizeof(PRIMER_ACCEPTS[index]));
+    for(i = 0; i < length; i++){
+        int bases = _iupac_bases(primer[reverse ? length - 1 - i : i]);
+        // The complement swaps A with T and C with G
+        if(reverse)
+            bases = ((bases & 1) << 3) | ((bases & 8) >> 3) | ((bases & 2) << 1) | ((bases & 4) >> 1);
+        for(b = 0; b < 4; b++)
+            PRIMER_ACCEPTS[index][b][i] = (bases & (1 << b)) ? (char) 0xff : 0;
+    }
+    PRIMER_LENGTH[index] = length;
+}
+
+/*
+    Sets the primers trimmed from the reads
+
+    Inputs:
+        forward: the forward primer - NULL for none
+        reverse: the reverse primer, as synthesized - NULL for none
+        max_mismatches: the largest number of mismatches of a primer match
+
+    Returns 1 if the primers are valid, 0 otherwise (and nothing is set)
+*/
+int set_primers(char* forward, char* reverse, int max_mismatches){
+    if((forward && !_valid_primer(forward, max_mismatches)) ||
+       (reverse && !_valid_primer(reverse, max_mismatches)))
+        return 0;
+    PRIMER_LENGTH[PRIMER_FORWARD] = 0;
+    PRIMER_LENGTH[PRIMER_REVERSE] = 0;
+    if(forward)
+        _set_primer(PRIMER_FORWARD, forward, 0);
+    if(reverse)
+        _set_primer(PRIMER_REVERSE, reverse, 1);
+    PRIMER_MISMATCHES = max_mismatches;
+    return 1;
+}
+
+/*
+    Sets the length filters of the reads
+
+    Inputs:
+        trunclen: the length the reads are truncated to - 0 to disable
+        minlen: the shortest read kept - 0 for no limit
+        maxlen: the longest read kept - 0 for no limit
+*/
+void set_length_filters(int trunclen, int minlen, int maxlen){
+    TRUNCLEN = trunclen;
+    MINLEN = minlen;
+    MAXLEN = maxlen;
+}
+
+/*
+    Returns 1 if any read filter is enabled, 0 otherwise
+*/
+int read_filter_enabled(void){
+    return MAX_EE >= 0.0 || TRUNCQUAL >= 0 || PRIMER_LENGTH[PRIMER_FORWARD] ||
+           PRIMER_LENGTH[PRIMER_REVERSE] || TRUNCLEN || MINLEN || MAXLEN;
+}
+
+/*
+    Returns the number of mismatches of the primer `index` against the
+    bases of read, 16 bases per SSE2 instruction: the read bases are
+    lowercased and compared with a, c, g and t, and each match is kept if
+    the primer accepts that base at that position
+
+    Inputs:
+        index: PRIMER_FORWARD or PRIMER_REVERSE
+        read: the read bases - readable up to the primer length rounded up
+            to 16
+*/
+int _primer_mismatches(int index, char* read){
+    int i;
+    int b;
+    int mismatches = 0;
+    int length = PRIMER_LENGTH[index];
+    const char bases[4] = {'a', 'c', 'g', 't'};
+    __m128i lower = _mm_set1_epi8(0x20);
+    for(i = 0; i < length; i += 16){
+        __m128i r = _mm_or_si128(_mm_loadu_si128((__m128i*) (read + i)), lower);
+        __m128i matches = _mm_setzero_si128();
+        for(b = 0; b < 4; b++){
+            __m128i accepts = _mm_load_si128((__m128i*) (PRIMER_ACCEPTS[index][b] + i));
+            matches = _mm_or_si128(matches, _mm_and_si128(_mm_cmpeq_epi8(r, _mm_set1_epi8(bases[b])), accepts));
+        }
+        int mask = ~_mm_movemask_epi8(matches) & 0xffff;
+        // Positions past the end of the primer do not count
+        if(length - i < 16)
+            mask &= (1 << (length - i)) - 1;
+        mismatches += __builtin_popcount(mask);
+    }
+    return mismatches;
+}
+
+/*
+    Cuts the read seq to its first `length` bases
+
+    Inputs:
+        seq: pointer to the sequence structure
+        length: the new length of the read
+*/
+void _truncate_read(sequence* seq, int length){
+    seq->seq_length = length;
+    seq->sequence[length] = '\0';
+    if(seq->quality)
+        seq->quality[length] = '\0';
+}
+
+/*
+    Removes the primers of the read seq with the bases beyond them, if it
+    holds them
+
+    Inputs:
+        seq: pointer to the sequence structure
+*/
+void _trim_primers(sequence* seq){
+    int offset;
+    int trimmed = 0;
+    // The bases searched are copied to a padded window, so the SSE2 loads
+    // never read past the read
+    char window[PRIMER_MAX_OFFSET + PRIMER_MAX_LENGTH + 16];
+    int length = PRIMER_LENGTH[PRIMER_FORWARD];
+    if(length && seq->seq_length >= length){
+        int size = (seq->seq_length < PRIMER_MAX_OFFSET + length) ? seq->seq_length : PRIMER_MAX_OFFSET + length;
+        memcpy(window, seq->sequence, size);
+        memset(window + size, 0, sizeof(window) - size);
+        for(offset = 0; offset + length <= size; offset++){
+            if(_primer_mismatches(PRIMER_FORWARD, window + offset) <= PRIMER_MISMATCHES){
+                // Shift the read after the primer to its start
+                int cut = offset + length;
+                memmove(seq->sequence, seq->sequence + cut, seq->seq_length - cut + 1);
+                if(seq->quality)
+                    memmove(seq->quality, seq->quality + cut, seq->seq_length - cut + 1);
+                seq->seq_length -= cut;
+                trimmed = 1;
+                break;
+            }
+        }
+    }
+    length = PRIMER_LENGTH[PRIMER_REVERSE];
+    if(length && seq->seq_length >= length){
+        int size = (seq->seq_length < PRIMER_MAX_OFFSET + length) ? seq->seq_length : PRIMER_MAX_OFFSET + length;
+        int start = seq->seq_length - size;
+        memcpy(window, seq->sequence + start, size);
+        memset(window + size, 0, sizeof(window) - size);
+        // Look from the end of the read backwards
+        for(offset = size - length; offset >= 0; offset--){
+            if(_primer_mismatches(PRIMER_REVERSE, window + offset) <= PRIMER_MISMATCHES){
+                _truncate_read(seq, start + offset);
+                trimmed = 1;
+                break;
+            }
+        }
+    }
+    if(trimmed)
+        STATS_ADD(primers_trimmed, 1);
+}
+
+/*
+    Returns the position of the first character of the quality string that
+    is <= limit, or length if there is none. Compares 16 characters per
+    SSE2 instruction.
+
+    Inputs:
+        quality: the quality string
+        length: the length of the quality string
+        limit: the quality character limit
+*/
+int _first_low_quality(char* quality, int length, char limit){
+    int i;
+    // Quality characters are printable ASCII, so signed compares are safe
+    __m128i threshold = _mm_set1_epi8(limit + 1);
+    for(i = 0; i + 16 <= length; i += 16){
+        __m128i q = _mm_loadu_si128((__m128i*) (quality + i));
+        int mask = _mm_movemask_epi8(_mm_cmplt_epi8(q, threshold));
+        if(mask)
+            return i + __builtin_ctz(mask);
+    }
+    // Remaining characters
+    for(; i < length; i++){
+        if(quality[i] <= limit)
+            return i;
+    }
+    return length;
+}
+
+/*
+    Returns the expected errors of the quality string, stopping as soon as
+    they exceed `limit`. Looks up the error probabilities in a table and
+    accumulates them in four SSE lanes.
+
+    Inputs:
+        quality: the quality string
+        length: the length of the quality string
+        limit: the expected errors limit
+*/
+float _expected_errors(char* quality, int length, float limit){
+    int i;
+    unsigned char* q = (unsigned char*) quality;
+    __m128 acc = _mm_setzero_ps();
+    float lanes[4];
+    float sum;
+    for(i = 0; i + 16 <= length; i += 16){
+        acc = _mm_add_ps(acc, _mm_set_ps(ERROR_PROBABILITY[q[i+3]], ERROR_PROBABILITY[q[i+2]],
+                                         ERROR_PROBABILITY[q[i+1]], ERROR_PROBABILITY[q[i]]));
+        acc = _mm_add_ps(acc, _mm_set_ps(ERROR_PROBABILITY[q[i+7]], ERROR_PROBABILITY[q[i+6]],
+                                         ERROR_PROBABILITY[q[i+5]], ERROR_PROBABILITY[q[i+4]]));
+        acc = _mm_add_ps(acc, _mm_set_ps(ERROR_PROBABILITY[q[i+11]], ERROR_PROBABILITY[q[i+10]],
+                                         ERROR_PROBABILITY[q[i+9]], ERROR_PROBABILITY[q[i+8]]));
+        acc = _mm_add_ps(acc, _mm_set_ps(ERROR_PROBABILITY[q[i+15]], ERROR_PROBABILITY[q[i+14]],
+                                         ERROR_PROBABILITY[q[i+13]], ERROR_PROBABILITY[q[i+12]]));
+        // Bail out early on reads that already failed - checked once per 64 bases
+        if((i & 63) == 48){
+            _mm_storeu_ps(lanes, acc);
+            if(lanes[0] + lanes[1] + lanes[2] + lanes[3] > limit)
+                return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        }
+    }
+    _mm_storeu_ps(lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    // Remaining characters
+    for(; i < length; i++)
+        sum += ERROR_PROBABILITY[q[i]];
+    return sum;
+}
+
+/*
+    Applies the read filters to seq
+
+    Inputs:
+        seq: pointer to the sequence structure - may be trimmed in place
+
+    Returns 1 if the read passes the filters, 0 if it must be dropped
+*/
+int read_filter(sequence* seq){
+    if(PRIMER_LENGTH[PRIMER_FORWARD] || PRIMER_LENGTH[PRIMER_REVERSE])
+        _trim_primers(seq);
+    if((MAX_EE >= 0.0 || TRUNCQUAL >= 0) && seq->quality == NULL)
+        error_handler(FATAL_ERROR, "Quality filtering needs FASTQ input, read %s has no quality scores", seq->label);
+    if(TRUNCQUAL >= 0){
+        // Truncate the read before its first low quality base
+        _truncate_read(seq, _first_low_quality(seq->quality, seq->seq_length, (char)(TRUNCQUAL + PHRED_OFFSET)));
+    }
+    if(TRUNCLEN){
+        // The reads are cut to the same length, the shorter ones dropped
+        if(seq->seq_length < TRUNCLEN)
+            return 0;
+        _truncate_read(seq, TRUNCLEN);
+    }
+    if(MAX_EE >= 0.0 && _expected_errors(seq->quality, seq->seq_length, (float) MAX_EE) > MAX_EE)
+        return 0;
+    if(seq->seq_length < MINLEN || (MAXLEN && seq->seq_length > MAXLEN))
+        return 0;
+    // Nothing left to de-replicate
+    return seq->seq_length > 0;
+}
@@ -0,0 +1,331 @@
+#include <stdlib.h>
+#include <string.h>
+#include "fingerprint.h"
+#include "hash.h"
+#include "samples.h"
+#include "stats.h"
+#include "util.h"
+
+// Seeds of the two halves of a fingerprint
+#define FINGERPRINT_SEED_LO 0x2545f4914f6cdd1dULL
+#define FINGERPRINT_SEED_HI 0x9e3779b97f4a7c15ULL
+
+typedef struct fingerprint_entry_str {
+    uint64_t key[2];
+    seq_replicas* r;
+    UT_hash_handle hh;
+} fingerprint_entry;
+
+// Whether the gather sends the fingerprints first
+static int FINGERPRINTS = 0;
+// Fingerprints of the uniques of the database receiving the gather
+static fingerprint_entry* INDEX = NULL;
+// The database indexed and its number of uniques when last updated
+static derep_db* INDEX_DB = NULL;
+static int INDEX_UNIQUE = 0;
+// Uniques announced by this process and how many it had to send in full
+static double ANNOUNCED = 0.0;
+static double SENT_IN_FULL = 0.0;
+
+/*
+    Computes the 128-bit fingerprint of the sequence of the given length
+*/
+void _fingerprint_of(char* sequence, int length, uint64_t key[2]){
+    key[0] = hash_bytes64(sequence, length, FINGERPRINT_SEED_LO);
+    key[1] = hash_bytes64(sequence, length, FINGERPRINT_SEED_HI);
+}
+
+/*
+    Adds the replica r to the fingerprint index
+*/
+void _index_replica(seq_replicas* r){
+    fingerprint_entry* e = (fingerprint_entry*) malloc(sizeof(fingerprint_entry));
+    _fingerprint_of(r->sequence, strlen(r->sequence), e->key);
+    e->r = r;
+    HASH_ADD(hh, INDEX, key, sizeof(e->key), e);
+}
+
+/*
+    Makes sure the fingerprint index holds the uniques of db, rebuilding it
+    if it was built for another database or db changed since
+*/
+void _update_index(derep_db* db){
+    seq_replicas* current;
+    if(INDEX_DB == db && INDEX_UNIQUE == db->unique)
+        return;
+    release_fingerprint_index();
+    for(current = db->seqs; current != NULL; current = (seq_replicas*) current->hh.next)
+        _index_replica(current);
+    INDEX_DB = db;
+    INDEX_UNIQUE = db->unique;
+}
+
+/*
+    Sends the size bytes of buffer to process dest in pieces of at most
+    FINGERPRINT_PIECE bytes
+
+    Inputs:
+        buffer: the bytes to send
+        size: the number of bytes
+        dest: the rank of the destination process
+        comm: the communicator of dest
+*/
+void _send_pieces(void* buffer, long size, int dest, MPI_Comm comm){
+    long offset;
+    for(offset = 0; offset < size; offset += FINGERPRINT_PIECE){
+        int piece = (size - offset < FINGERPRINT_PIECE) ? size - offset : FINGERPRINT_PIECE;
+        MPI_Send((char*) buffer + offset, piece, MPI_BYTE, dest, FINGERPRINT_TAG, comm);
+    }
+}
+
+/*
+    Receives the size bytes sent by process source with _send_pieces
+
+    Inputs:
+        buffer: where to store the bytes
+        size: the number of bytes
+        source: the rank of the source process
+        comm: the communicator of source
+*/
+void _recv_pieces(void* buffer, long size, int source, MPI_Comm comm){
+    long offset;
+    for(offset = 0; offset < size; offset += FINGERPRINT_PIECE){
+        int piece = (size - offset < FINGERPRINT_PIECE) ? size - offset : FINGERPRINT_PIECE;
+        MPI_Recv((char*) buffer + offset, piece, MPI_BYTE, source, FINGERPRINT_TAG, comm, MPI_STATUS_IGNORE);
+    }
+}
+
+/*
+    Sets whether the de-replication databases are sent fingerprint-first
+    during the gather
+
+    Inputs:
+        enable: 1 to send the fingerprints first, 0 otherwise
+*/
+void set_fingerprint_gather(int enable){
+    FINGERPRINTS = enable;
+}
+
+/*
+    Returns whether the gather sends the fingerprints first
+*/
+int fingerprint_gather_enabled(void){
+    return FINGERPRINTS;
+}
+
+/*
+    Sends the de-replication database db to process dest fingerprint-first
+
+    Inputs:
+        db: de-replication database to send
+        dest: the rank of the destination process
+        comm: the communicator of dest
+*/
+void send_fingerprinted_derep_db(derep_db* db, int dest, MPI_Comm comm){
+    int i;
+    int length;
+    long n = db->unique;
+    char** label;
+    seq_replicas* current;
+    // First message: the fingerprints and counts of the uniques, in the
+    // order of the table
+    fingerprint* fingerprints = (fingerprint*) malloc(sizeof(fingerprint) * (n + 1));
+    i = 0;
+    for(current = db->seqs; current != NULL; current = (seq_replicas*) current->hh.next){
+        _fingerprint_of(current->sequence, strlen(current->sequence), fingerprints[i].key);
+        fingerprints[i++].count = current->count;
+    }
+    MPI_Send(&n, 1, MPI_LONG, dest, FINGERPRINT_TAG, comm);
+    _send_pieces(fingerprints, n * sizeof(fingerprint), dest, comm);
+    STATS_ADD(bytes_sent, sizeof(long) + n * sizeof(fingerprint));
+    free(fingerprints);
+    // The answer: a bit set for each fingerprint the receiver lacks
+    unsigned char* missing = (unsigned char*) malloc((n + 7) / 8 + 1);
+    _recv_pieces(missing, (n + 7) / 8, dest, comm);
+    STATS_ADD(bytes_recv, (n + 7) / 8);
+
+    // Second message: the bodies of the missing sequences and the labels
+    // (or per-sample counts) of all of them
+    byte_buffer body = {NULL, 0, 0};
+    buffer_append(&body, &db->count, sizeof(int));
+    if(db->sample_sep){
+        int num_samples = get_num_samples();
+        buffer_append(&body, &num_samples, sizeof(int));
+        for(i = 0; i < num_samples; i++){
+            length = strlen(get_sample_name(i));
+            buffer_append(&body, &length, sizeof(int));
+            buffer_append(&body, get_sample_name(i), length);
+        }
+    }
+    i = 0;
+    for(current = db->seqs; current != NULL; current = (seq_replicas*) current->hh.next, i++){
+        if(missing[i >> 3] & (1 << (i & 7))){
+            length = strlen(current->sequence);
+            buffer_append(&body, &length, sizeof(int));
+            buffer_append(&body, current->sequence, length);
+            ++SENT_IN_FULL;
+        }
+        if(db->sample_sep){
+            int num_pairs = utarray_len(current->samples);
+            buffer_append(&body, &num_pairs, sizeof(int));
+            buffer_append(&body, current->samples->d, num_pairs * sizeof(sample_count));
+            continue;
+        }
+        label = NULL;
+        while((label=(char**)utarray_next(current->labels, label))){
+            length = strlen(*label);
+            buffer_append(&body, &length, sizeof(int));
+            buffer_append(&body, *label, length);
+        }
+    }
+    ANNOUNCED += n;
+    MPI_Send(&body.size, 1, MPI_UNSIGNED_LONG, dest, FINGERPRINT_TAG, comm);
+    _send_pieces(body.data, body.size, dest, comm);
+    STATS_ADD(bytes_sent, sizeof(unsigned long) + body.size);
+    free(body.data);
+    free(missing);
+}
+
+/*
+    Receives a de-replication database sent by send_fingerprinted_derep_db
+    and merges it with db
+
+    Inputs:
+        db: pointer to the local de-replication database structure
+        source: the rank of the source process
+        comm: the communicator of source
+*/
+void recv_fingerprinted_derep_db(derep_db* db, int source, MPI_Comm comm){
+    long i;
+    int j;
+    long n;
+    int length;
+    int count;
+    unsigned long size;
+    fingerprint_entry* e;
+    _update_index(db);
+    MPI_Recv(&n, 1, MPI_LONG, source, FINGERPRINT_TAG, comm, MPI_STATUS_IGNORE);
+    fingerprint* fingerprints = (fingerprint*) malloc(sizeof(fingerprint) * (n + 1));
+    _recv_pieces(fingerprints, n * sizeof(fingerprint), source, comm);
+    STATS_ADD(bytes_recv, sizeof(long) + n * sizeof(fingerprint));
+    // Look up every fingerprint and ask for the ones we lack
+    seq_replicas** known = (seq_replicas**) malloc(sizeof(seq_replicas*) * (n + 1));
+    unsigned char* missing = (unsigned char*) calloc((n + 7) / 8 + 1, 1);
+    for(i = 0; i < n; i++){
+        HASH_FIND(hh, INDEX, fingerprints[i].key, sizeof(fingerprints[i].key), e);
+        STATS_ADD(hash_probes, 1);
+        known[i] = e ? e->r : NULL;
+        if(!e)
+            missing[i >> 3] |= 1 << (i & 7);
+    }
+    _send_pieces(missing, (n + 7) / 8, source, comm);
+    STATS_ADD(bytes_sent, (n + 7) / 8);
+    free(missing);
+
+    MPI_Recv(&size, 1, MPI_UNSIGNED_LONG, source, FINGERPRINT_TAG, comm, MPI_STATUS_IGNORE);
+    char* body = (char*) malloc(size + 1);
+    _recv_pieces(body, size, source, comm);
+    STATS_ADD(bytes_recv, sizeof(unsigned long) + size);
+    char* in = body;
+    memcpy(&count, in, sizeof(int));
+    in += sizeof(int);
+    db->count += count;
+    int* sample_map = NULL;
+    if(db->sample_sep){
+        // Map the sample ids of the sender to ours
+        int num_samples;
+        memcpy(&num_samples, in, sizeof(int));
+        in += sizeof(int);
+        sample_map = (int*) malloc(sizeof(int) * (num_samples + 1));
+        for(j = 0; j < num_samples; j++){
+            memcpy(&length, in, sizeof(int));
+            in += sizeof(int);
+            sample_map[j] = intern_sample(in, length);
+            in += length;
+        }
+    }
+    char* buffer = NULL;
+    int capacity = 0;
+    for(i = 0; i < n; i++){
+        seq_replicas* r = known[i];
+        if(!r){
+            // A new sequence - its body follows
+            memcpy(&length, in, sizeof(int));
+            in += sizeof(int);
+            if(length + 1 > capacity){
+                capacity = 2 * (length + 1);
+                buffer = (char*) realloc(buffer, capacity);
+            }
+            memcpy(buffer, in, length);
+            buffer[length] = '\0';
+            in += length;
+            r = create_empty_seq_replica(buffer, length);
+            insert_seq_replica(db, r);
+            _index_replica(r);
+        }
+        if(db->sample_sep){
+            sample_count pair;
+            int num_pairs;
+            memcpy(&num_pairs, in, sizeof(int));
+            in += sizeof(int);
+            for(j = 0; j < num_pairs; j++){
+                memcpy(&pair, in, sizeof(sample_count));
+                in += sizeof(sample_count);
+                if(add_sample_replica(r, sample_map[pair.sample], pair.count))
+                    db->bytes += sizeof(sample_count);
+            }
+            continue;
+        }
+        // The count announced tells how many labels are coming
+        utarray_reserve(r->labels, fingerprints[i].count);
+        for(j = 0; j < fingerprints[i].count; j++){
+            memcpy(&length, in, sizeof(int));
+            in += sizeof(int);
+            if(length + 1 > capacity){
+                capacity = 2 * (length + 1);
+                buffer = (char*) realloc(buffer, capacity);
+            }
+            memcpy(buffer, in, length);
+            buffer[length] = '\0';
+            in += length;
+            add_replica(r, buffer);
+        }
+    }
+    INDEX_UNIQUE = db->unique;
+    free(buffer);
+    free(sample_map);
+    free(body);
+    free(known);
+    free(fingerprints);
+}
+
+/*
+    Frees the fingerprint index built by recv_fingerprinted_derep_db
+*/
+void release_fingerprint_index(void){
+    fingerprint_entry* current;
+    fingerprint_entry* tmp;
+    HASH_ITER(hh, INDEX, current, tmp){
+        HASH_DEL(INDEX, current);
+        free(current);
+    }
+    INDEX_DB = NULL;
+    INDEX_UNIQUE = 0;
+}
+
+/*
+    Reports how many sequence bodies the fingerprint-first gather avoided
+    sending across all the processes. Must be called by all the processes;
+    rank 0 prints it.
+
+    Inputs:
+        my_rank: process rank
+*/
+void report_fingerprint_gather(int my_rank){
+    double local[2] = {ANNOUNCED, SENT_IN_FULL};
+    double total[2];
+    MPI_Reduce(local, total, 2, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+    if(my_rank == 0 && total[0] > 0)
+        error_handler(INFO_MSG, "Fingerprint-first gather: %.0f of %.0f unique sequences were already known to the receiver",
+                      total[0] - total[1], total[0]);
+}
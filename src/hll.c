@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+#include "hll.h"
+#include "hash.h"
+
+// Seed of the hash used by the sketches - any value different from the
+// other users of hash_bytes64 keeps the estimates independent of them
+#define HLL_SEED 0x484c4cULL
+
+/*
+    Creates a new, empty HyperLogLog sketch
+
+    Returns:
+        the new hll structure
+*/
+hll* create_hll(void){
+    hll* h = (hll*) malloc(sizeof(hll));
+    memset(h->registers, 0, sizeof(h->registers));
+    return h;
+}
+
+/*
+    Destroys the HyperLogLog sketch h
+
+    Inputs:
+        h: pointer to the hll structure to destroy
+*/
+void destroy_hll(hll* h){
+    free(h);
+}
+
+/*
+    Adds the sequence to the HyperLogLog sketch h
+
+    Inputs:
+        h: pointer to the hll structure
+        sequence: the sequence string
+        length: the length of the sequence
+*/
+void hll_add(hll* h, char* sequence, int length){
+    uint64_t hash = hash_bytes64(sequence, length, HLL_SEED);
+    // The top bits select the register
+    int index = (int)(hash >> (64 - HLL_PRECISION));
+    // The rest give the position of the first 1 bit
+    uint64_t rest = hash << HLL_PRECISION;
+    uint8_t rank = rest ? __builtin_clzll(rest) + 1 : 64 - HLL_PRECISION + 1;
+    if(rank > h->registers[index])
+        h->registers[index] = rank;
+}
+
+/*
+    Estimates the number of distinct sequences added to h
+
+    Inputs:
+        h: pointer to the hll structure
+
+    Returns the estimated cardinality
+*/
+double hll_estimate(hll* h){
+    int i;
+    int zeros = 0;
+    double sum = 0.0;
+    double m = HLL_REGISTERS;
+    for(i = 0; i < HLL_REGISTERS; i++){
+        sum += ldexp(1.0, -h->registers[i]);
+        if(h->registers[i] == 0)
+            ++zeros;
+    }
+    double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    // Small cardinalities are better estimated by linear counting
+    if(estimate <= 2.5 * m && zeros)
+        estimate = m * log(m / zeros);
+    return estimate;
+}
+
+/*
+    Merges in place the sketches of all the processes (register-wise
+    maximum), so every process ends up with the sketch of the union
+
+    Inputs:
+        h: pointer to the local hll structure
+*/
+void allreduce_hll(hll* h){
+    MPI_Allreduce(MPI_IN_PLACE, h->registers, HLL_REGISTERS, MPI_UNSIGNED_CHAR, MPI_MAX, MPI_COMM_WORLD);
+}
@@ -0,0 +1,195 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "huge_alloc.h"
+#include "stats.h"
+#include "util.h"
+
+// Bytes at the start of each key arena block holding its header
+#define KEY_BLOCK_HEADER 64
+// Largest number of NUMA nodes handled
+#define MAX_NUMA_NODES 1024
+
+typedef struct key_block_str {
+    // Number of keys of the block not freed yet
+    long live;
+} key_block;
+
+// Page backing and NUMA placement of the new allocations
+static int PAGES = HUGE_PAGES_OFF;
+static int NUMA = NUMA_FIRST_TOUCH;
+// Whether the fallbacks were already reported
+static int EXPLICIT_WARNED = 0;
+static int NUMA_WARNED = 0;
+// Block of the key arena being carved and its first free byte
+static char* ARENA_BLOCK = NULL;
+static size_t ARENA_USED = 0;
+
+/*
+    Sets how the large tables are allocated from now on
+
+    Inputs:
+        pages: one of the HUGE_PAGES_* modes
+        numa: one of the NUMA_* placements
+*/
+void set_huge_pages(int pages, int numa){
+    PAGES = pages;
+    NUMA = numa;
+}
+
+/*
+    Returns whether the key arena is used for the new sequences
+*/
+int key_arena_enabled(void){
+    return PAGES != HUGE_PAGES_OFF;
+}
+
+/*
+    Returns size rounded up to a multiple of align, a power of two
+*/
+size_t _round_up(size_t size, size_t align){
+    return (size + align - 1) & ~(align - 1);
+}
+
+/*
+    Spreads the pages of [ptr, ptr + size) over the NUMA nodes the process
+    may use. Must be called before they are touched.
+
+    Inputs:
+        ptr: start of the mapping
+        size: the number of bytes of the mapping
+*/
+void _interleave(void* ptr, size_t size){
+    unsigned long nodes[MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    memset(nodes, 0, sizeof(nodes));
+    if(syscall(__NR_get_mempolicy, NULL, nodes, MAX_NUMA_NODES, NULL, MPOL_F_MEMS_ALLOWED) != 0 ||
+       syscall(__NR_mbind, ptr, size, MPOL_INTERLEAVE, nodes, MAX_NUMA_NODES, 0) != 0){
+        if(!NUMA_WARNED)
+            error_handler(WARN_ERROR, "Could not interleave the tables over the NUMA nodes");
+        NUMA_WARNED = 1;
+    }
+}
+
+/*
+    Maps size bytes aligned to align, both multiples of HUGE_PAGE_SIZE, with
+    the page backing and NUMA placement set
+
+    Inputs:
+        size: the number of bytes
+        align: the alignment of the mapping
+
+    Returns a pointer to the new mapping
+*/
+void* _map_aligned(size_t size, size_t align){
+    int transparent = (PAGES == HUGE_PAGES_TRANSPARENT);
+    char* map = MAP_FAILED;
+    // Map the extra alignment and trim it afterwards
+    size_t map_size = size + align;
+    if(PAGES == HUGE_PAGES_EXPLICIT){
+        map = (char*) mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(map == MAP_FAILED){
+            if(!EXPLICIT_WARNED)
+                error_handler(WARN_ERROR, "Not enough explicit huge pages reserved, using transparent ones");
+            EXPLICIT_WARNED = 1;
+            transparent = 1;
+        }
+    }
+    if(map == MAP_FAILED)
+        map = (char*) mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(map == MAP_FAILED)
+        error_handler(FATAL_ERROR, "Could not map %zu bytes for the tables", size);
+    char* start = (char*) _round_up((uintptr_t) map, align);
+    if(start > map)
+        munmap(map, start - map);
+    if(map + map_size > start + size)
+        munmap(start + size, map + map_size - (start + size));
+    // Nothing is touched yet, so the advice and the policy apply to all of it
+    if(transparent)
+        madvise(start, size, MADV_HUGEPAGE);
+    if(NUMA == NUMA_INTERLEAVE)
+        _interleave(start, size);
+    if(PAGES != HUGE_PAGES_OFF)
+        STATS_ADD(huge_page_bytes, size);
+    return start;
+}
+
+/*
+    Allocates size bytes for a table, in its own mapping from HUGE_ALLOC_MIN
+    bytes on and from malloc below
+
+    Inputs:
+        size: the number of bytes
+
+    Returns a pointer to the new memory
+*/
+void* huge_malloc(size_t size){
+    if(size < HUGE_ALLOC_MIN)
+        return malloc(size);
+    return _map_aligned(_round_up(size, HUGE_PAGE_SIZE), HUGE_PAGE_SIZE);
+}
+
+/*
+    Releases the memory ptr, allocated with huge_malloc(size)
+
+    Inputs:
+        ptr: pointer to the memory
+        size: the size given to huge_malloc
+*/
+void huge_free(void* ptr, size_t size){
+    if(size < HUGE_ALLOC_MIN)
+        free(ptr);
+    else
+        munmap(ptr, _round_up(size, HUGE_PAGE_SIZE));
+}
+
+/*
+    Allocates size bytes, 16-byte aligned, for a key in the current block of
+    the key arena, mapping a new block when it is full
+
+    Inputs:
+        size: the number of bytes
+
+    Returns a pointer to the new memory, or NULL if size does not fit in a
+    block
+*/
+char* key_arena_alloc(size_t size){
+    size = _round_up(size, 16);
+    if(size > KEY_ARENA_BLOCK - KEY_BLOCK_HEADER)
+        return NULL;
+    if(ARENA_BLOCK == NULL || ARENA_USED + size > KEY_ARENA_BLOCK){
+        // A full block is released with its last key, or right away
+        if(ARENA_BLOCK && ((key_block*) ARENA_BLOCK)->live == 0)
+            munmap(ARENA_BLOCK, KEY_ARENA_BLOCK);
+        ARENA_BLOCK = (char*) _map_aligned(KEY_ARENA_BLOCK, KEY_ARENA_BLOCK);
+        ((key_block*) ARENA_BLOCK)->live = 0;
+        ARENA_USED = KEY_BLOCK_HEADER;
+    }
+    char* key = ARENA_BLOCK + ARENA_USED;
+    ARENA_USED += size;
+    ++((key_block*) ARENA_BLOCK)->live;
+    return key;
+}
+
+/*
+    Releases the key allocated with key_arena_alloc, and its block with its
+    last key
+
+    Inputs:
+        key: pointer to the key
+*/
+void key_arena_free(char* key){
+    // The blocks are aligned to their size
+    char* block = (char*) ((uintptr_t) key & ~(KEY_ARENA_BLOCK - 1));
+    if(--((key_block*) block)->live > 0)
+        return;
+    if(block == ARENA_BLOCK)
+        // The block being carved starts over
+        ARENA_USED = KEY_BLOCK_HEADER;
+    else
+        munmap(block, KEY_ARENA_BLOCK);
+}
@@ -0,0 +1,399 @@
+#include <stdlib.h>
+#include <string.h>
+#include "kmer_index.h"
+#include "util.h"
+
+// Minimum number of pending postings before compacting them into the CSR
+#define MIN_PENDING_COMPACT 1024
+
+// Nucleotide codes - anything that is not ACGT(U) breaks the k-mers
+static const unsigned char BASE_CODE[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4, ['U'] = 4,
+    ['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4, ['u'] = 4
+};
+
+/*
+    Auxiliary function that compares two integers, for qsort
+
+    Inputs:
+        a, b: pointers to the integers
+*/
+int _compare_kmers(const void* a, const void* b){
+    int x = *(const int*)a;
+    int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+/*
+    Computes the sorted list of distinct k-mers of sequence under the seed of
+    the index idx
+
+    Inputs:
+        idx: pointer to the kmer_index structure
+        sequence: the sequence string
+        kmers: in/out parameter - buffer that holds the k-mers, grown if needed
+        capacity: in/out parameter - the number of ints allocated in kmers
+
+    Returns:
+        the number of distinct k-mers stored in kmers
+*/
+int sequence_kmers(kmer_index* idx, char* sequence, int** kmers, int* capacity){
+    int i;
+    int j;
+    int n = 0;
+    int length = strlen(sequence);
+    int num_windows = length - idx->span + 1;
+    if(num_windows <= 0)
+        return 0;
+    // Make sure that the buffer can hold a k-mer per window
+    if(*capacity < num_windows){
+        *capacity = num_windows;
+        *kmers = (int*) realloc(*kmers, sizeof(int) * num_windows);
+    }
+    // Loop through all the windows of the sequence
+    for(i = 0; i < num_windows; i++){
+        int kmer = 0;
+        // Pack the care positions of the window, 2 bits per base
+        for(j = 0; j < idx->weight; j++){
+            unsigned char code = BASE_CODE[(unsigned char)sequence[i + idx->care[j]]];
+            if(!code)
+                break;
+            kmer = (kmer << 2) | (code - 1);
+        }
+        // Windows with an unknown base do not produce any k-mer
+        if(j == idx->weight)
+            (*kmers)[n++] = kmer;
+    }
+    // Sort the k-mers and remove duplicates, so each sequence is only
+    // present once in a posting list
+    qsort(*kmers, n, sizeof(int), _compare_kmers);
+    j = 0;
+    for(i = 0; i < n; i++){
+        if(j == 0 || (*kmers)[j-1] != (*kmers)[i])
+            (*kmers)[j++] = (*kmers)[i];
+    }
+    return j;
+}
+
+/*
+    Registers the sequence r with id `id` in the list of indexed sequences
+
+    Inputs:
+        idx: pointer to the kmer_index structure
+        r: pointer to the seq_replicas structure
+        id: the global id of the sequence
+
+    Returns:
+        the local index of the sequence
+*/
+int _register_sequence(kmer_index* idx, seq_replicas* r, int id){
+    if(idx->num_seqs == idx->capacity){
+        // Double the capacity of the sequence arrays
+        idx->capacity = idx->capacity ? 2 * idx->capacity : 1024;
+        idx->ids = (int*) realloc(idx->ids, sizeof(int) * idx->capacity);
+        idx->seqs = (seq_replicas**) realloc(idx->seqs, sizeof(seq_replicas*) * idx->capacity);
+    }
+    idx->ids[idx->num_seqs] = id;
+    idx->seqs[idx->num_seqs] = r;
+    return idx->num_seqs++;
+}
+
+/*
+    Merges the pending postings into the CSR arrays of the index idx
+
+    Inputs:
+        idx: pointer to the kmer_index structure
+*/
+void _compact_kmer_index(kmer_index* idx){
+    int i;
+    int kmer;
+    if(idx->num_pending == 0)
+        return;
+    // Count the postings each k-mer will hold
+    int* offsets = (int*) calloc(idx->num_kmers + 1, sizeof(int));
+    for(kmer = 0; kmer < idx->num_kmers; kmer++)
+        offsets[kmer+1] = idx->offsets[kmer+1] - idx->offsets[kmer];
+    for(i = 0; i < idx->num_pending; i++)
+        ++offsets[idx->pending[2*i] + 1];
+    // Prefix sum to get the start of each posting list
+    for(kmer = 0; kmer < idx->num_kmers; kmer++)
+        offsets[kmer+1] += offsets[kmer];
+    // Copy the old posting lists, keeping track of where each one ends
+    int num_postings = idx->num_postings + idx->num_pending;
+    int* postings = (int*) malloc(sizeof(int) * num_postings);
+    int* fill = (int*) malloc(sizeof(int) * idx->num_kmers);
+    for(kmer = 0; kmer < idx->num_kmers; kmer++){
+        int length = idx->offsets[kmer+1] - idx->offsets[kmer];
+        memcpy(&postings[offsets[kmer]], &idx->postings[idx->offsets[kmer]], sizeof(int) * length);
+        fill[kmer] = offsets[kmer] + length;
+    }
+    // Append the pending postings - they are already in insertion order
+    for(i = 0; i < idx->num_pending; i++)
+        postings[fill[idx->pending[2*i]]++] = idx->pending[2*i+1];
+    free(fill);
+    // Swap in the new arrays
+    free(idx->offsets);
+    free(idx->postings);
+    idx->offsets = offsets;
+    idx->postings = postings;
+    idx->num_postings = num_postings;
+    idx->num_pending = 0;
+}
+
+/*
+    Indexes the uniques of db whose id modulo num_shards is shard
+
+    Inputs:
+        idx: pointer to an empty kmer_index structure
+        db: pointer to the derep_db structure
+        shard: the index of the shard to build
+        num_shards: the total number of shards
+*/
+void _fill_kmer_index(kmer_index* idx, derep_db* db, int shard, int num_shards){
+    int i;
+    int id;
+    int n;
+    int* kmers = NULL;
+    int capacity = 0;
+    seq_replicas* current;
+    seq_replicas* tmp;
+    // First pass: register the sequences and count the postings of each k-mer
+    id = 0;
+    HASH_ITER(hh, db->seqs, current, tmp){
+        if(id % num_shards == shard){
+            _register_sequence(idx, current, id);
+            n = sequence_kmers(idx, current->sequence, &kmers, &capacity);
+            for(i = 0; i < n; i++)
+                ++idx->offsets[kmers[i] + 1];
+        }
+        ++id;
+    }
+    // Prefix sum to get the start of each posting list
+    for(i = 0; i < idx->num_kmers; i++)
+        idx->offsets[i+1] += idx->offsets[i];
+    idx->num_postings = idx->offsets[idx->num_kmers];
+    idx->postings = (int*) malloc(sizeof(int) * (idx->num_postings + 1));
+    // Second pass: fill the posting lists
+    int* fill = (int*) malloc(sizeof(int) * idx->num_kmers);
+    memcpy(fill, idx->offsets, sizeof(int) * idx->num_kmers);
+    for(id = 0; id < idx->num_seqs; id++){
+        n = sequence_kmers(idx, idx->seqs[id]->sequence, &kmers, &capacity);
+        for(i = 0; i < n; i++)
+            idx->postings[fill[kmers[i]]++] = id;
+    }
+    free(fill);
+    free(kmers);
+}
+
+/*
+    Auxiliary function that checks if hit a ranks before hit b: more shared
+    k-mers first, ties broken by the smallest id
+*/
+int _hit_before(kmer_hit* a, kmer_hit* b){
+    if(a->shared != b->shared)
+        return a->shared > b->shared;
+    return a->id < b->id;
+}
+
+/*
+    Creates a new empty k-mer index
+
+    Inputs:
+        seed: string describing the seed, with a '1' in the positions that are
+            part of the k-mer and a '0' in the don't care positions
+
+    Returns:
+        the new kmer_index structure
+*/
+kmer_index* create_kmer_index(char* seed){
+    int i;
+    int span = strlen(seed);
+    if(span == 0 || span > KMER_MAX_SPAN)
+        error_handler(FATAL_ERROR, "Seed %s must span between 1 and %d positions", seed, KMER_MAX_SPAN);
+    // Allocate memory for the new structure
+    kmer_index* idx = (kmer_index*) calloc(1, sizeof(kmer_index));
+    // Parse the seed
+    idx->span = span;
+    for(i = 0; i < span; i++){
+        if(seed[i] == '1')
+            idx->care[idx->weight++] = i;
+        else if(seed[i] != '0')
+            error_handler(FATAL_ERROR, "Seed %s can only contain '0' and '1'", seed);
+    }
+    if(idx->weight == 0 || idx->weight > KMER_MAX_WEIGHT || seed[0] != '1' || seed[span-1] != '1')
+        error_handler(FATAL_ERROR, "Seed %s must start and end with '1' and have at most %d care positions", seed, KMER_MAX_WEIGHT);
+    idx->num_kmers = 1 << (2 * idx->weight);
+    // The posting lists are empty
+    idx->offsets = (int*) calloc(idx->num_kmers + 1, sizeof(int));
+    idx->postings = NULL;
+    return idx;
+}
+
+/*
+    Creates a k-mer index over the unique sequences of the de-replication
+    database db
+
+    Inputs:
+        db: pointer to the derep_db structure
+        seed: seed description (see create_kmer_index)
+
+    Returns:
+        the new kmer_index structure
+*/
+kmer_index* build_kmer_index(derep_db* db, char* seed){
+    return build_kmer_index_shard(db, seed, 0, 1);
+}
+
+/*
+    Creates the shard `shard` out of `num_shards` of the k-mer index over the
+    unique sequences of the de-replication database db
+
+    Inputs:
+        db: pointer to the derep_db structure
+        seed: seed description (see create_kmer_index)
+        shard: the index of the shard to build
+        num_shards: the total number of shards
+
+    Returns:
+        the new kmer_index structure
+*/
+kmer_index* build_kmer_index_shard(derep_db* db, char* seed, int shard, int num_shards){
+    kmer_index* idx = create_kmer_index(seed);
+    _fill_kmer_index(idx, db, shard, num_shards);
+    return idx;
+}
+
+/*
+    Destroys the k-mer index idx. The indexed seq_replicas are not freed.
+
+    Inputs:
+        idx: pointer to the kmer_index structure to destroy
+*/
+void destroy_kmer_index(kmer_index* idx){
+    free(idx->ids);
+    free(idx->seqs);
+    free(idx->offsets);
+    free(idx->postings);
+    free(idx->pending);
+    free(idx);
+}
+
+/*
+    Adds the sequence r to the k-mer index with id `id`
+
+    Inputs:
+        idx: pointer to the kmer_index structure
+        r: pointer to the seq_replicas structure to index
+        id: the id to report for this sequence in the query results
+*/
+void kmer_index_add(kmer_index* idx, seq_replicas* r, int id){
+    int i;
+    int* kmers = NULL;
+    int capacity = 0;
+    int local = _register_sequence(idx, r, id);
+    int n = sequence_kmers(idx, r->sequence, &kmers, &capacity);
+    // Make room for the new postings
+    if(idx->num_pending + n > idx->pending_capacity){
+        idx->pending_capacity = 2 * (idx->num_pending + n);
+        idx->pending = (int*) realloc(idx->pending, sizeof(int) * 2 * idx->pending_capacity);
+    }
+    // Queue the new postings
+    for(i = 0; i < n; i++){
+        idx->pending[2*idx->num_pending] = kmers[i];
+        idx->pending[2*idx->num_pending+1] = local;
+        ++idx->num_pending;
+    }
+    free(kmers);
+    // Pending postings are scanned linearly on every query, so fold them
+    // into the CSR arrays once they are a significant fraction of them
+    if(idx->num_pending >= MIN_PENDING_COMPACT && idx->num_pending >= idx->num_postings / 8)
+        _compact_kmer_index(idx);
+}
+
+/*
+    Creates the scratch space needed to query a k-mer index
+
+    Returns:
+        the new kmer_search structure
+*/
+kmer_search* create_kmer_search(void){
+    return (kmer_search*) calloc(1, sizeof(kmer_search));
+}
+
+/*
+    Destroys the query scratch space search
+
+    Inputs:
+        search: pointer to the kmer_search structure to destroy
+*/
+void destroy_kmer_search(kmer_search* search){
+    free(search->shared);
+    free(search->touched);
+    free(search->kmers);
+    free(search);
+}
+
+/*
+    Looks for the indexed sequences that share the most k-mers with sequence
+
+    Inputs:
+        idx: pointer to the kmer_index structure
+        search: pointer to the kmer_search scratch space
+        sequence: the query sequence
+        n: the maximum number of candidates to return
+        hits: output parameter - array of at least n kmer_hit structures
+
+    Returns:
+        the number of candidates stored in hits
+*/
+int kmer_index_query(kmer_index* idx, kmer_search* search, char* sequence, int n, kmer_hit* hits){
+    int i;
+    int j;
+    int num_touched = 0;
+    int num_hits = 0;
+    // Make sure the scratch space covers all the indexed sequences
+    if(search->capacity < idx->num_seqs){
+        search->shared = (int*) realloc(search->shared, sizeof(int) * idx->capacity);
+        search->touched = (int*) realloc(search->touched, sizeof(int) * idx->capacity);
+        memset(&search->shared[search->capacity], 0, sizeof(int) * (idx->capacity - search->capacity));
+        search->capacity = idx->capacity;
+    }
+    // Get the k-mers of the query
+    int num_kmers = sequence_kmers(idx, sequence, &search->kmers, &search->kmers_capacity);
+    // Count the shared k-mers walking the compacted posting lists
+    for(i = 0; i < num_kmers; i++){
+        int kmer = search->kmers[i];
+        for(j = idx->offsets[kmer]; j < idx->offsets[kmer+1]; j++){
+            int local = idx->postings[j];
+            if(search->shared[local]++ == 0)
+                search->touched[num_touched++] = local;
+        }
+    }
+    // Count the shared k-mers on the pending postings
+    for(i = 0; i < idx->num_pending; i++){
+        if(bsearch(&idx->pending[2*i], search->kmers, num_kmers, sizeof(int), _compare_kmers)){
+            int local = idx->pending[2*i+1];
+            if(search->shared[local]++ == 0)
+                search->touched[num_touched++] = local;
+        }
+    }
+    // Keep the n best candidates, using insertion into the sorted hits array
+    for(i = 0; i < num_touched; i++){
+        int local = search->touched[i];
+        kmer_hit hit;
+        hit.id = idx->ids[local];
+        hit.shared = search->shared[local];
+        hit.seq = idx->seqs[local];
+        // Reset the scratch counter for the next query
+        search->shared[local] = 0;
+        if(num_hits == n && (n == 0 || !_hit_before(&hit, &hits[n-1])))
+            continue;
+        j = (num_hits < n) ? num_hits++ : n - 1;
+        while(j > 0 && _hit_before(&hit, &hits[j-1])){
+            hits[j] = hits[j-1];
+            --j;
+        }
+        hits[j] = hit;
+    }
+    return num_hits;
+}
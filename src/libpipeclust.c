@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <string.h>
+#include "libpipeclust.h"
+#include "derep_db.h"
+#include "sequence.h"
+
+struct pipeclust_str {
+    int flags;
+    int finalized;
+    derep_db* db;
+    // Next unique returned by pipeclust_next_unique
+    seq_replicas* cursor;
+    // Scratch copy of the record being added
+    char* buffer;
+    int buffer_size;
+};
+
+/*
+    Creates a new, empty de-replication database
+
+    Inputs:
+        flags: PIPECLUST_NO_NORMALIZE and/or PIPECLUST_NO_SORT, or 0
+
+    Returns:
+        the new database, or NULL if it could not be allocated
+*/
+pipeclust* pipeclust_create(int flags){
+    pipeclust* pc = (pipeclust*) malloc(sizeof(pipeclust));
+    if(pc == NULL)
+        return NULL;
+    pc->flags = flags;
+    pc->finalized = 0;
+    pc->db = create_derep_db();
+    pc->cursor = NULL;
+    pc->buffer = NULL;
+    pc->buffer_size = 0;
+    return pc;
+}
+
+/*
+    De-replicates a batch of records against the database
+
+    Inputs:
+        pc: pointer to the database
+        records: array of records
+        num_records: the number of records
+
+    Returns PIPECLUST_OK, PIPECLUST_EINVALID or PIPECLUST_EFINALIZED
+*/
+int pipeclust_add(pipeclust* pc, const pipeclust_record* records, int num_records){
+    int i;
+    sequence seq;
+    if(pc->finalized)
+        return PIPECLUST_EFINALIZED;
+    for(i = 0; i < num_records; i++){
+        int length = records[i].length < 0 ? (int) strlen(records[i].sequence) : records[i].length;
+        // The sequence is normalized in a scratch copy, the database keeps its own
+        if(length + 1 > pc->buffer_size){
+            free(pc->buffer);
+            pc->buffer_size = 2 * (length + 1);
+            posix_memalign((void **) &pc->buffer, 16, pc->buffer_size);
+        }
+        memcpy(pc->buffer, records[i].sequence, length);
+        pc->buffer[length] = '\0';
+        if(!(pc->flags & PIPECLUST_NO_NORMALIZE) && normalize_sequence(pc->buffer, length, 1) >= 0)
+            return PIPECLUST_EINVALID;
+        seq.sequence = pc->buffer;
+        seq.seq_length = length;
+        seq.label = (char*) records[i].label;
+        seq.label_length = strlen(records[i].label);
+        seq.quality = NULL;
+        dereplicate_db(pc->db, &seq);
+    }
+    return PIPECLUST_OK;
+}
+
+/*
+    Finalizes the database
+
+    Inputs:
+        pc: pointer to the database
+*/
+void pipeclust_finalize(pipeclust* pc){
+    if(pc->finalized)
+        return;
+    if(!(pc->flags & PIPECLUST_NO_SORT))
+        sort_db(pc->db);
+    pc->finalized = 1;
+    pc->cursor = pc->db->seqs;
+}
+
+/*
+    Returns the number of records added to the database
+*/
+long pipeclust_num_records(pipeclust* pc){
+    return pc->db->count;
+}
+
+/*
+    Returns the number of unique sequences in the database
+*/
+int pipeclust_num_uniques(pipeclust* pc){
+    return pc->db->unique;
+}
+
+/*
+    Fetches the next unique sequence of a finalized database
+
+    Inputs:
+        pc: pointer to the finalized database
+        unique: output parameter - the next unique sequence
+
+    Returns 1 if a unique was fetched, 0 if there are no more uniques
+*/
+int pipeclust_next_unique(pipeclust* pc, pipeclust_unique* unique){
+    if(!pc->finalized || pc->cursor == NULL)
+        return 0;
+    seq_replicas* r = pc->cursor;
+    unique->sequence = r->sequence;
+    unique->length = strlen(r->sequence);
+    unique->count = r->count;
+    // The labels array stores the strings contiguously
+    unique->num_labels = utarray_len(r->labels);
+    unique->labels = (char**) utarray_front(r->labels);
+    pc->cursor = (seq_replicas*) r->hh.next;
+    return 1;
+}
+
+/*
+    Makes pipeclust_next_unique start again from the first unique
+*/
+void pipeclust_rewind(pipeclust* pc){
+    pc->cursor = pc->finalized ? pc->db->seqs : NULL;
+}
+
+/*
+    Destroys the database and everything it holds
+
+    Inputs:
+        pc: pointer to the database
+*/
+void pipeclust_destroy(pipeclust* pc){
+    destroy_derep_db(pc->db);
+    free(pc->buffer);
+    free(pc);
+}
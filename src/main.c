@@ -1,21 +1,151 @@
 #include <mpi.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
 #include "pipe_clust.h"
 #include "util.h"
+#include "stats.h"
+#include "samples.h"
+#include "filter.h"
+#include "stream.h"
+#include "compress.h"
+#include "fingerprint.h"
+#include "dist_output.h"
+#include "denoise.h"
+#include "ref_index.h"
+#include "closed_ref.h"
+#include "huge_alloc.h"
 
 static char* USAGE = "USAGE: mpiexec -n <NUM PROCS> PipeClust [cmd] [cmd options] FILE1 FILE2 ...\n"
                      "Run PipeClust --help for more information";
 
+/*
+    Parses a size in bytes with an optional K, M or G suffix
+
+    Inputs:
+        text: the string to parse
+
+    Returns the size in bytes or 0 if the string is not a valid size
+*/
+static size_t parse_size(char* text){
+    char* end;
+    double value = strtod(text, &end);
+    if(end == text || value < 0)
+        return 0;
+    switch(*end){
+        case 'g': case 'G': value *= 1024;
+        case 'm': case 'M': value *= 1024;
+        case 'k': case 'K': value *= 1024;
+        case '\0': break;
+        default: return 0;
+    }
+    return (size_t) value;
+}
+
 static char* HELP = "USAGE: mpiexec -n <NUM PROCS> PipeClust [cmd] [cmd options] FILE1 FILE2 ...\n\n"
+                    "  A FILE can be '-' (the standard input) or a named pipe: it is read\n"
+                    "  by rank 0 and its reads are scattered to the other ranks\n\n"
+                    "  --manifest FILE  Read the input files from FILE (one path per line)\n"
+                    "               instead of the command line. Each rank gets a bundle\n"
+                    "               of files of about the same total size\n\n"
                     "  cmd\n"
                     "    --help     Print this message\n"
                     "    --derep    Execute de-replication\n"
+                    "    --denoise  Execute de-replication and then denoise the uniques\n"
+                    "               with the UNOISE abundance skew criterion, merging\n"
+                    "               the noisy ones into their parents (ZOTUs)\n"
+                    "    --closed-ref  Execute de-replication and then map the uniques\n"
+                    "               to the references of a reference index\n"
+                    "    --build-ref FILE  Build the reference index of the (single line)\n"
+                    "               FASTA FILE into --ref-index. Takes no input files\n"
                     "\n"
                     "  --derep options:\n"
                     "    --fasta    Path to the output FASTA file\n"
-                    "    --map      Path to the output OTU-map file\n";
+                    "    --map      Path to the output OTU-map file\n"
+                    "    --mem-limit  Memory budget of the de-replication table of each\n"
+                    "               process (e.g. 512M, 4G). Larger tables are spilled\n"
+                    "               to disk and merged back after reading\n"
+                    "    --spill-dir  Directory for the spilled tables [.]\n"
+                    "    --engine   De-replication engine: 'hash' inserts every read in a\n"
+                    "               hash table, 'sort' radix sorts batches of reads and\n"
+                    "               gathers with a parallel sample sort, 'rma' merges the\n"
+                    "               local hash tables in a distributed table through MPI\n"
+                    "               one-sided operations instead of a gather [hash]\n"
+                    "    --sample-sep  Separator between the sample id and the read id in\n"
+                    "               the labels (e.g. _ for SampleID_readnum). Instead of\n"
+                    "               the OTU map, writes a sample x sequence count table\n"
+                    "    --table    Path to the output count table (with --sample-sep)\n"
+                    "    --fastq-maxee  Drop the FASTQ reads whose expected number of\n"
+                    "               errors (sum of the error probabilities of their\n"
+                    "               quality scores) is larger than this value\n"
+                    "    --truncqual  Truncate each FASTQ read at its first base with a\n"
+                    "               quality score <= this value (before --fastq-maxee)\n"
+                    "    --fwd-primer  Forward primer (IUPAC codes allowed) removed from\n"
+                    "               the start of the reads, with up to 8 bases before it\n"
+                    "    --rev-primer  Reverse primer, as synthesized: its reverse\n"
+                    "               complement is removed from the end of the reads,\n"
+                    "               with up to 8 bases after it\n"
+                    "    --primer-mismatches  Mismatches allowed in a primer match [2]\n"
+                    "    --trunclen  Truncate the reads to this length, after removing\n"
+                    "               the primers and --truncqual, and drop the shorter ones\n"
+                    "    --minlen   Drop the reads shorter than this after trimming\n"
+                    "    --maxlen   Drop the reads longer than this after trimming\n"
+                    "    --no-normalize  Keep the sequences as read. By default they are\n"
+                    "               uppercased, U is read as T and \\r line endings\n"
+                    "               are dropped\n"
+                    "    --strict-iupac  Reject the sequences with characters that are\n"
+                    "               not IUPAC nucleotide codes\n"
+                    "    --presize  Estimate the number of unique sequences with a first\n"
+                    "               HyperLogLog pass over the input and pre-size the\n"
+                    "               hash tables, so they never grow while reading\n"
+                    "    --compress  Compress the hash tables sent during the gather (2-bit\n"
+                    "               sequences, front-coded labels and zlib, in chunks)\n"
+                    "               and report the compression ratio achieved\n"
+                    "    --fingerprints  Send the 128-bit fingerprints of the hash tables\n"
+                    "               first during the gather, so only the sequences the\n"
+                    "               receiver lacks are sent (not with --compress)\n"
+                    "    --distributed-output  Do not gather the tables in a single\n"
+                    "               process: sort the uniques across all the processes,\n"
+                    "               by abundance and then sequence, and have each one\n"
+                    "               write its slice of the outputs (not with --table)\n"
+                    "    --node-gather  Have the processes of each node merge their hash\n"
+                    "               tables through shared memory first, and only one\n"
+                    "               process per node take part in the gather (experimental)\n"
+                    "\n"
+                    "  --denoise options (and the --derep ones):\n"
+                    "    --minsize  Discard the uniques with fewer reads [8]\n"
+                    "    --unoise-alpha  Alpha of the abundance skew criterion: a unique\n"
+                    "               at edit distance d of a more abundant one is noise\n"
+                    "               if it is at least 2^(alpha * d + 1) times less\n"
+                    "               abundant [2.0]\n"
+                    "    --threads  Threads of each process aligning the candidates [1]\n"
+                    "    --sketch-filter  Drop the candidate parents whose MinHash sketch\n"
+                    "               is far from the unique's before aligning them\n"
+                    "\n"
+                    "  --closed-ref options (and the --derep ones):\n"
+                    "    --ref-index  Path to the reference index, mapped in memory\n"
+                    "    --ref-otus  Path to the output reference-OTU table: an OTU map\n"
+                    "               with the reference labels or, with --sample-sep, a\n"
+                    "               reference x sample count table\n"
+                    "    --similarity  Smallest identity of a unique to its reference,\n"
+                    "               as 1 - edit distance / unique length [0.97]\n"
+                    "    The --fasta, --map and --table outputs are optional and hold\n"
+                    "    the uniques that failed to map\n"
+                    "\n"
+                    "  general options:\n"
+                    "    --stats    Path to the output JSON file with the per-process\n"
+                    "               performance counters\n"
+                    "    --io-uring  Read the input files through io_uring, opening and\n"
+                    "               reading the next files of each process while the\n"
+                    "               current one is parsed (Linux 5.6 or later)\n"
+                    "    --huge-pages  Back the hash bucket arrays and the sequences of\n"
+                    "               the tables with 'transparent' or 'explicit'\n"
+                    "               (hugetlbfs, transparent if none are reserved) huge\n"
+                    "               pages, to cut the TLB misses of the large tables\n"
+                    "    --numa     Placement of the table pages on the NUMA nodes:\n"
+                    "               'first-touch' (the node of the thread filling them)\n"
+                    "               or 'interleave' (all the nodes) [first-touch]\n";
 
 int main(int argc, char** argv){
     // Start MPI
@@ -31,22 +161,94 @@ int main(int argc, char** argv){
     static int derep_flag = 0;
     static int sort_flag = 1;
     static int help_flag = 0;
+    static int presize_flag = 0;
+    static int normalize_flag = 1;
+    static int strict_iupac_flag = 0;
+    static int node_gather_flag = 0;
+    static int compress_flag = 0;
+    static int fingerprint_flag = 0;
+    static int distributed_flag = 0;
+    static int denoise_flag = 0;
+    static int sketch_filter_flag = 0;
+    static int closed_ref_flag = 0;
+    static int io_uring_flag = 0;
     char* fasta = NULL;
     char* map = NULL;
+    char* stats = NULL;
+    size_t mem_limit = 0;
+    char* spill_dir = NULL;
+    int engine = DEREP_ENGINE_HASH;
+    char sample_sep = '\0';
+    char* table = NULL;
+    char* manifest = NULL;
+    double max_ee = -1.0;
+    int truncqual = -1;
+    char* fwd_primer = NULL;
+    char* rev_primer = NULL;
+    int primer_mismatches = 2;
+    int trunclen = 0;
+    int minlen = 0;
+    int maxlen = 0;
+    int minsize = 8;
+    double alpha = 2.0;
+    int threads = 1;
+    char* build_ref = NULL;
+    char* ref_index = NULL;
+    char* ref_otus = NULL;
+    double similarity = 0.97;
+    int huge_pages = HUGE_PAGES_OFF;
+    int numa = NUMA_FIRST_TOUCH;
+    char* end;
     int option_index = 0;
     int c;
+    int i;
     int len;
     static struct option long_options[] = {
         {"derep", no_argument, &derep_flag, 1},
         {"suppress_sort", no_argument, &sort_flag, 0},
         {"help", no_argument, &help_flag, 1},
+        {"presize", no_argument, &presize_flag, 1},
+        {"no-normalize", no_argument, &normalize_flag, 0},
+        {"strict-iupac", no_argument, &strict_iupac_flag, 1},
+        {"node-gather", no_argument, &node_gather_flag, 1},
+        {"compress", no_argument, &compress_flag, 1},
+        {"fingerprints", no_argument, &fingerprint_flag, 1},
+        {"distributed-output", no_argument, &distributed_flag, 1},
+        {"denoise", no_argument, &denoise_flag, 1},
+        {"sketch-filter", no_argument, &sketch_filter_flag, 1},
+        {"closed-ref", no_argument, &closed_ref_flag, 1},
+        {"io-uring", no_argument, &io_uring_flag, 1},
         {"fasta", required_argument, 0, 'f'},
         {"map", required_argument, 0, 'm'},
+        {"stats", required_argument, 0, 's'},
+        {"mem-limit", required_argument, 0, 'M'},
+        {"spill-dir", required_argument, 0, 'D'},
+        {"engine", required_argument, 0, 'E'},
+        {"sample-sep", required_argument, 0, 'S'},
+        {"table", required_argument, 0, 'T'},
+        {"fastq-maxee", required_argument, 0, 'e'},
+        {"truncqual", required_argument, 0, 'q'},
+        {"fwd-primer", required_argument, 0, 'g'},
+        {"rev-primer", required_argument, 0, 'G'},
+        {"primer-mismatches", required_argument, 0, 'x'},
+        {"trunclen", required_argument, 0, 'L'},
+        {"minlen", required_argument, 0, 'n'},
+        {"maxlen", required_argument, 0, 'X'},
+        {"manifest", required_argument, 0, 'F'},
+        {"minsize", required_argument, 0, 'Z'},
+        {"unoise-alpha", required_argument, 0, 'A'},
+        {"threads", required_argument, 0, 't'},
+        {"build-ref", required_argument, 0, 'R'},
+        {"ref-index", required_argument, 0, 'I'},
+        {"ref-otus", required_argument, 0, 'O'},
+        {"similarity", required_argument, 0, 'P'},
+        {"huge-pages", required_argument, 0, 'H'},
+        {"numa", required_argument, 0, 'N'},
         {0, 0, 0, 0}
     };
 
     // Parse the command line options
-    while((c = getopt_long(argc, argv, "f:m:", long_options, &option_index)) != -1){
+    while((c = getopt_long(argc, argv, "f:m:s:M:D:E:S:T:e:q:g:G:x:L:n:X:F:Z:A:t:R:I:O:P:H:N:", long_options, &option_index)) != -1){
         switch(c){
             case 0:
                 // If this is setting a flag do nothing
@@ -71,6 +273,207 @@ int main(int argc, char** argv){
                 memcpy(map, optarg, len);
                 map[len] = '\0';
                 break;
+            case 's':
+                // We got the stats file
+                len = strlen(optarg);
+                stats = (char*) malloc(sizeof(char) * (len+1));
+                memcpy(stats, optarg, len);
+                stats[len] = '\0';
+                break;
+            case 'M':
+                // We got the memory budget
+                mem_limit = parse_size(optarg);
+                if(mem_limit == 0){
+                    error_handler(INFO_MSG, "Invalid memory limit %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'D':
+                // We got the spill directory
+                spill_dir = optarg;
+                break;
+            case 'S':
+                // We got the sample separator
+                if(strlen(optarg) != 1){
+                    error_handler(INFO_MSG, "The sample separator must be a single character\n%s", USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                sample_sep = optarg[0];
+                break;
+            case 'T':
+                // We got the count table file
+                table = optarg;
+                break;
+            case 'F':
+                // We got the manifest with the input files
+                manifest = optarg;
+                break;
+            case 'e':
+                // We got the maximum expected errors
+                max_ee = strtod(optarg, &end);
+                if(*end != '\0' || max_ee < 0.0){
+                    error_handler(INFO_MSG, "Invalid maximum expected errors %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'q':
+                // We got the truncation quality score
+                truncqual = (int) strtol(optarg, &end, 10);
+                // Scores above '~' have no quality character
+                if(*end != '\0' || truncqual < 0 || truncqual > '~' - PHRED_OFFSET){
+                    error_handler(INFO_MSG, "Invalid truncation quality score %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'g':
+                // We got the forward primer
+                fwd_primer = optarg;
+                break;
+            case 'G':
+                // We got the reverse primer
+                rev_primer = optarg;
+                break;
+            case 'x':
+                // We got the mismatches allowed in the primers
+                primer_mismatches = (int) strtol(optarg, &end, 10);
+                if(*end != '\0' || primer_mismatches < 0){
+                    error_handler(INFO_MSG, "Invalid number of primer mismatches %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'L':
+                // We got the truncation length
+                trunclen = (int) strtol(optarg, &end, 10);
+                if(*end != '\0' || trunclen < 1){
+                    error_handler(INFO_MSG, "Invalid truncation length %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'n':
+                // We got the minimum read length
+                minlen = (int) strtol(optarg, &end, 10);
+                if(*end != '\0' || minlen < 1){
+                    error_handler(INFO_MSG, "Invalid minimum length %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'X':
+                // We got the maximum read length
+                maxlen = (int) strtol(optarg, &end, 10);
+                if(*end != '\0' || maxlen < 1){
+                    error_handler(INFO_MSG, "Invalid maximum length %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'Z':
+                // We got the minimum abundance of the uniques to denoise
+                minsize = (int) strtol(optarg, &end, 10);
+                if(*end != '\0' || minsize < 1){
+                    error_handler(INFO_MSG, "Invalid minimum size %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'A':
+                // We got the alpha of the abundance skew criterion
+                alpha = strtod(optarg, &end);
+                if(*end != '\0' || alpha <= 0.0){
+                    error_handler(INFO_MSG, "Invalid UNOISE alpha %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 't':
+                // We got the number of threads of each process
+                threads = (int) strtol(optarg, &end, 10);
+                if(*end != '\0' || threads < 1){
+                    error_handler(INFO_MSG, "Invalid number of threads %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'R':
+                // We got the reference FASTA file to index
+                build_ref = optarg;
+                break;
+            case 'I':
+                // We got the reference index file
+                ref_index = optarg;
+                break;
+            case 'O':
+                // We got the reference-OTU table file
+                ref_otus = optarg;
+                break;
+            case 'P':
+                // We got the identity threshold of the references
+                similarity = strtod(optarg, &end);
+                if(*end != '\0' || similarity <= 0.0 || similarity > 1.0){
+                    error_handler(INFO_MSG, "Invalid similarity %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'H':
+                // We got the page backing of the tables
+                if(strcmp(optarg, "transparent") == 0)
+                    huge_pages = HUGE_PAGES_TRANSPARENT;
+                else if(strcmp(optarg, "explicit") == 0)
+                    huge_pages = HUGE_PAGES_EXPLICIT;
+                else{
+                    error_handler(INFO_MSG, "Unknown huge page mode %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'N':
+                // We got the NUMA placement of the tables
+                if(strcmp(optarg, "first-touch") == 0)
+                    numa = NUMA_FIRST_TOUCH;
+                else if(strcmp(optarg, "interleave") == 0)
+                    numa = NUMA_INTERLEAVE;
+                else{
+                    error_handler(INFO_MSG, "Unknown NUMA placement %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
+            case 'E':
+                // We got the de-replication engine
+                if(strcmp(optarg, "hash") == 0)
+                    engine = DEREP_ENGINE_HASH;
+                else if(strcmp(optarg, "sort") == 0)
+                    engine = DEREP_ENGINE_SORT;
+                else if(strcmp(optarg, "rma") == 0)
+                    engine = DEREP_ENGINE_RMA;
+                else{
+                    error_handler(INFO_MSG, "Unknown de-replication engine %s\n%s", optarg, USAGE);
+                    // Shut down MPI
+                    MPI_Finalize();
+                    return 0;
+                }
+                break;
             case '?':
                 break;
             default:
@@ -91,19 +494,63 @@ int main(int argc, char** argv){
         return 0;
     }
 
+    // Building a reference index takes no input files
+    if(build_ref){
+        if(!ref_index){
+            error_handler(INFO_MSG, "--build-ref needs the path of the output index in --ref-index\n%s", USAGE);
+            // Shut down MPI
+            MPI_Finalize();
+            return 0;
+        }
+        if(my_rank == 0)
+            build_ref_index(build_ref, ref_index);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+
     // Get the number of input files
     int num_files = argc - optind;
-    if(num_files == 0){
+    if((num_files == 0) == (manifest == NULL)){
         // No input files provided, throw the usage error
-        error_handler(INFO_MSG, "Input files not provided!\n%s", USAGE);
+        error_handler(INFO_MSG, "Input files not provided! Pass them either on the command line or with --manifest\n%s", USAGE);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+
+    // Denoising and closed-reference clustering work on the de-replicated
+    // uniques
+    if(denoise_flag || closed_ref_flag)
+        derep_flag = 1;
+    if(closed_ref_flag && (!ref_index || !ref_otus)){
+        error_handler(INFO_MSG, "If doing closed-reference clustering, both the reference index and the output reference-OTU table should be defined. Index: %s, Table: %s\n%s", ref_index, ref_otus, USAGE);
         // Shut down MPI
         MPI_Finalize();
         return 0;
     }
+    // The closed-reference uniques that failed to map are only written if
+    // some output is requested
+    int no_outputs = closed_ref_flag && !fasta && !map && !table;
 
     // Check de-replication options
-    if (derep_flag){
-        if(!fasta || !map){
+    if (derep_flag && sample_sep){
+        if(!no_outputs && (!fasta || !table || map)){
+            // Per-sample counts replace the OTU map by the count table
+            error_handler(INFO_MSG, "If de-replicating with --sample-sep, the output fasta file and the count table (but no otu_map) should be defined. Fasta: %s, Table: %s\n%s", fasta, table, USAGE);
+            // Shut down MPI
+            MPI_Finalize();
+            return 0;
+        }
+        if(engine != DEREP_ENGINE_HASH || mem_limit){
+            error_handler(INFO_MSG, "--sample-sep is only supported by the hash engine without memory limit\n%s", USAGE);
+            // Shut down MPI
+            MPI_Finalize();
+            return 0;
+        }
+    }
+    else if (derep_flag){
+        if(!no_outputs && (!fasta || !map)){
             // No output files provided, throw the usage error
             error_handler(INFO_MSG, "If doing de-replication, both the output fasta file and the output otu_map should be defined. Fasta: %s, Otu Map: %s\n%s", fasta, map, USAGE);
             // Shut down MPI
@@ -115,26 +562,135 @@ int main(int argc, char** argv){
         error_handler(FATAL_ERROR, "Only de-replication is currently supported");
     }
     
+    // Set up the de-replication engine and its memory budget
+    if(engine == DEREP_ENGINE_SORT && mem_limit){
+        error_handler(INFO_MSG, "The memory limit only applies to the hash engine\n%s", USAGE);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+    for(i = optind; presize_flag && i < argc; i++){
+        if(is_stream_input(argv[i])){
+            error_handler(INFO_MSG, "The tables cannot be pre-sized when reading from %s, it can only be read once\n%s", argv[i], USAGE);
+            // Shut down MPI
+            MPI_Finalize();
+            return 0;
+        }
+    }
+    if(distributed_flag && sample_sep){
+        error_handler(INFO_MSG, "--distributed-output cannot write a sample count table\n%s", USAGE);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+    if(distributed_flag && closed_ref_flag){
+        error_handler(INFO_MSG, "--closed-ref needs the gathered uniques, it cannot be used with --distributed-output\n%s", USAGE);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+    if(distributed_flag && denoise_flag){
+        error_handler(INFO_MSG, "--denoise needs the gathered uniques, it cannot be used with --distributed-output\n%s", USAGE);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+    if(compress_flag && fingerprint_flag){
+        error_handler(INFO_MSG, "--compress and --fingerprints cannot be used together\n%s", USAGE);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+    if(maxlen && minlen > maxlen){
+        error_handler(INFO_MSG, "The minimum length is larger than the maximum length\n%s", USAGE);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+    if(!set_primers(fwd_primer, rev_primer, primer_mismatches)){
+        error_handler(INFO_MSG, "The primers must be IUPAC sequences of at most %d bases and longer than "
+                      "--primer-mismatches (%d)\n%s", PRIMER_MAX_LENGTH, primer_mismatches, USAGE);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+    if(presize_flag && mem_limit){
+        error_handler(INFO_MSG, "The tables cannot be pre-sized under a memory limit\n%s", USAGE);
+        // Shut down MPI
+        MPI_Finalize();
+        return 0;
+    }
+    set_derep_engine(engine);
+    set_presize(presize_flag);
+    set_node_gather(node_gather_flag);
+    set_gather_compression(compress_flag);
+    set_fingerprint_gather(fingerprint_flag);
+    set_distributed_output(distributed_flag);
+    set_io_uring(io_uring_flag);
+    set_normalize(normalize_flag);
+    set_strict_iupac(strict_iupac_flag);
+    set_max_expected_errors(max_ee);
+    set_truncqual(truncqual);
+    set_length_filters(trunclen, minlen, maxlen);
+    set_sample_separator(sample_sep);
+    set_memory_limit(mem_limit, spill_dir);
+    set_denoise_params(minsize, alpha, threads);
+    set_denoise_sketch_filter(sketch_filter_flag);
+    set_ref_similarity(similarity);
+    set_huge_pages(huge_pages, numa);
+
+    // Start collecting the performance counters if requested
+    if(stats)
+        enable_stats();
+
     // Execute the commands
     if(derep_flag){
         // Executes de-replication
         derep_db* db = NULL;
-        if(comm_sz == 1)
+        if(manifest)
+            db = manifest_dereplication(manifest, my_rank, comm_sz);
+        else if(comm_sz == 1)
             db = serial_dereplication(&argv[optind], num_files);
         else
             db = parallel_dereplication(&argv[optind], num_files, my_rank, comm_sz);
+        if(denoise_flag){
+            // All the processes take part in the denoising
+            if(my_rank == 0)
+                error_handler(INFO_MSG, "%d total sequences, %d unique sequences before denoising", db->count, db->unique);
+            denoise_derep_db(db, my_rank, comm_sz);
+        }
+        if(closed_ref_flag){
+            // All the processes map a share of the uniques
+            if(my_rank == 0 && !denoise_flag)
+                error_handler(INFO_MSG, "%d total sequences, %d unique sequences before mapping", db->count, db->unique);
+            closed_ref_derep_db(db, ref_index, ref_otus, my_rank, comm_sz);
+        }
+        if(distributed_flag){
+            // Every process writes its slice of the outputs
+            write_distributed_output(db, fasta, map, sort_flag, my_rank, comm_sz);
+            error_handler(INFO_MSG, "%d total sequences, %d unique sequences", db->count, db->unique);
+            destroy_derep_db(db);
+        }
         // At this point, only process with rank 0 has the
         // complete de-replication database
-        if(my_rank == 0){
+        else if(my_rank == 0){
             // Write a info message with the number of sequence read and the
             // number of unique sequences
             error_handler(INFO_MSG, "%d total sequences, %d unique sequences", db->count, db->unique);
-            if(sort_flag)
+            if(sort_flag && fasta){
                 // Sort the database by abundance
+                STATS_TIC(t_sort);
                 sort_db(db);
+                STATS_TOC(PHASE_SORT, t_sort);
+            }
             // Write the output files
             // TODO: probably remove when implementing further clustering steps
-            write_output(db, fasta, map);
+            STATS_TIC(t_write);
+            if(fasta)
+                write_output(db, fasta, map);
+            if(table)
+                write_sample_table(db, table);
+            STATS_TOC(PHASE_WRITE, t_write);
             // Destroy the sequence DB
             // TODO: probably remove when implementing further clustering steps
             destroy_derep_db(db);
@@ -145,6 +701,10 @@ int main(int argc, char** argv){
         }
     }
     
+    // Write the performance report
+    if(stats)
+        write_stats_report(stats, my_rank, comm_sz);
+
     // Shut down MPI
     MPI_Finalize();
     return 0;
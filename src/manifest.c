@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <mpi.h>
+#include "manifest.h"
+#include "stream.h"
+#include "util.h"
+
+/*
+    Reads the manifest file `manifest`: one input path per line
+
+    Inputs:
+        manifest: the manifest path
+        num_files: output parameter - the number of input paths
+
+    Returns the array of input paths
+*/
+char** read_manifest(char* manifest, int* num_files){
+    FILE* fd = fopen(manifest, "r");
+    if(fd == NULL)
+        error_handler(FATAL_ERROR, "Error opening manifest %s", manifest);
+    int capacity = 1024;
+    char** paths = (char**) malloc(sizeof(char*) * capacity);
+    char* line = NULL;
+    size_t line_capacity = 0;
+    *num_files = 0;
+    while(getline(&line, &line_capacity, fd) != -1){
+        // The path ends at the first tab or end of line
+        line[strcspn(line, "\t\r\n")] = '\0';
+        if(line[0] == '\0' || line[0] == '#')
+            continue;
+        if(*num_files == capacity){
+            capacity *= 2;
+            paths = (char**) realloc(paths, sizeof(char*) * capacity);
+        }
+        paths[(*num_files)++] = strdup(line);
+    }
+    free(line);
+    fclose(fd);
+    return paths;
+}
+
+/*
+    Moves down the process at position i of the min-heap of processes
+    ordered by assigned bytes (ties by rank)
+*/
+void _sift_down(int* heap, long long* load, int n, int i){
+    while(1){
+        int smallest = i;
+        int child;
+        for(child = 2*i + 1; child <= 2*i + 2 && child < n; child++){
+            if(load[heap[child]] < load[heap[smallest]] ||
+               (load[heap[child]] == load[heap[smallest]] && heap[child] < heap[smallest]))
+                smallest = child;
+        }
+        if(smallest == i)
+            return;
+        int tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+// Sizes used by _compare_sizes
+static long long* SORT_SIZES;
+
+/*
+    Auxiliary function that compares two file indices by decreasing size
+    (ties by index), for qsort
+*/
+int _compare_sizes(const void* a, const void* b){
+    int i = *(int*)a;
+    int j = *(int*)b;
+    if(SORT_SIZES[i] != SORT_SIZES[j])
+        return SORT_SIZES[i] > SORT_SIZES[j] ? -1 : 1;
+    return i - j;
+}
+
+/*
+    Assigns each file to a process with the LPT rule
+
+    Inputs:
+        sizes: the size of each file, in bytes
+        num_files: the number of files
+        comm_sz: the number of processes
+
+    Returns the array with the process assigned to each file
+*/
+int* plan_bundles(long long* sizes, int num_files, int comm_sz){
+    int i;
+    int* order = (int*) malloc(sizeof(int) * (num_files + 1));
+    int* owner = (int*) malloc(sizeof(int) * (num_files + 1));
+    int* heap = (int*) malloc(sizeof(int) * comm_sz);
+    long long* load = (long long*) calloc(comm_sz, sizeof(long long));
+    // Largest files first
+    for(i = 0; i < num_files; i++)
+        order[i] = i;
+    SORT_SIZES = sizes;
+    qsort(order, num_files, sizeof(int), _compare_sizes);
+    // Every process starts empty - the heap is already valid
+    for(i = 0; i < comm_sz; i++)
+        heap[i] = i;
+    for(i = 0; i < num_files; i++){
+        // The least loaded process takes the file
+        owner[order[i]] = heap[0];
+        load[heap[0]] += sizes[order[i]];
+        _sift_down(heap, load, comm_sz, 0);
+    }
+    free(order);
+    free(heap);
+    free(load);
+    return owner;
+}
+
+/*
+    Reads the manifest in the process with rank 0 and sends each process its
+    bundle of inputs
+
+    Inputs:
+        manifest: the manifest path - only used in rank 0
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+        num_files: output parameter - the number of inputs in my bundle
+
+    Returns the array of input paths of my bundle
+*/
+char** scatter_manifest(char* manifest, int my_rank, int comm_sz, int* num_files){
+    int i;
+    int r;
+    int my_size;
+    int* send_counts = NULL;
+    int* send_displs = NULL;
+    byte_buffer send = {NULL, 0, 0};
+    if(my_rank == 0){
+        int total;
+        struct stat st;
+        char** paths = read_manifest(manifest, &total);
+        if(total == 0)
+            error_handler(FATAL_ERROR, "The manifest %s lists no input files", manifest);
+        // A single pass of metadata lookups
+        long long* sizes = (long long*) malloc(sizeof(long long) * total);
+        for(i = 0; i < total; i++){
+            if(stat(paths[i], &st) != 0)
+                error_handler(FATAL_ERROR, "Error accessing input %s listed in %s", paths[i], manifest);
+            if(is_stream_input(paths[i]))
+                error_handler(FATAL_ERROR, "Streamed input %s cannot be listed in a manifest", paths[i]);
+            sizes[i] = st.st_size;
+        }
+        int* owner = plan_bundles(sizes, total, comm_sz);
+        // Pack the bundles one after the other, the paths NUL-terminated
+        send_counts = (int*) malloc(sizeof(int) * comm_sz);
+        send_displs = (int*) malloc(sizeof(int) * comm_sz);
+        for(r = 0; r < comm_sz; r++){
+            send_displs[r] = send.size;
+            for(i = 0; i < total; i++){
+                if(owner[i] == r)
+                    buffer_append(&send, paths[i], strlen(paths[i]) + 1);
+            }
+            send_counts[r] = send.size - send_displs[r];
+        }
+        for(i = 0; i < total; i++)
+            free(paths[i]);
+        free(paths);
+        free(sizes);
+        free(owner);
+    }
+    MPI_Scatter(send_counts, 1, MPI_INT, &my_size, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    char* data = (char*) malloc(my_size + 1);
+    MPI_Scatterv(send.data, send_counts, send_displs, MPI_CHAR, data, my_size, MPI_CHAR, 0, MPI_COMM_WORLD);
+    free(send.data);
+    free(send_counts);
+    free(send_displs);
+    // Split the bundle - the paths point into data, held by the first one
+    *num_files = 0;
+    for(i = 0; i < my_size; i++){
+        if(data[i] == '\0')
+            ++(*num_files);
+    }
+    char** bundle = (char**) malloc(sizeof(char*) * (*num_files + 1));
+    bundle[0] = data;
+    for(i = 0, r = 0; i < my_size; i++){
+        if(i == 0 || data[i-1] == '\0')
+            bundle[r++] = data + i;
+    }
+    return bundle;
+}
+
+/*
+    Frees the bundle returned by scatter_manifest
+*/
+void free_bundle(char** bundle){
+    // All the paths live in the block of the first one
+    free(bundle[0]);
+    free(bundle);
+}
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "out_writer.h"
+#include "util.h"
+
+/*
+    Writes the len bytes of data to the file descriptor fd, retrying on
+    partial writes
+
+    Returns 0 on success or the errno of the failed write
+*/
+int _write_all(int fd, char* data, size_t len){
+    while(len > 0){
+        ssize_t written = write(fd, data, len);
+        if(written < 0){
+            if(errno == EINTR)
+                continue;
+            return errno;
+        }
+        data += written;
+        len -= written;
+    }
+    return 0;
+}
+
+/*
+    Background thread of a writer: writes each buffer handed over by
+    flush_out_writer until the writer is done
+*/
+void* _writer_thread(void* arg){
+    out_writer* w = (out_writer*) arg;
+    pthread_mutex_lock(&w->lock);
+    while(1){
+        // Wait for a full buffer or the end of the output
+        while(!w->pending && !w->done)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if(!w->pending)
+            break;
+        // The buffer handed over is the one not being filled
+        char* buffer = w->buffers[1 - w->current];
+        size_t len = w->pending;
+        pthread_mutex_unlock(&w->lock);
+        int error = _write_all(w->fd, buffer, len);
+        pthread_mutex_lock(&w->lock);
+        if(error && !w->error)
+            w->error = error;
+        // Buffer written - the producer can reuse it
+        w->pending = 0;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/*
+    Opens the file path for writing through a buffered writer. The output is
+    formatted into one buffer while a background thread writes the other.
+
+    Inputs:
+        path: the output filename
+
+    Returns:
+        the new out_writer structure
+*/
+out_writer* create_out_writer(char* path){
+    out_writer* w = (out_writer*) malloc(sizeof(out_writer));
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(w->fd < 0)
+        error_handler(FATAL_ERROR, "Error opening output file %s", path);
+    w->path = path;
+    w->buffers[0] = (char*) malloc(WRITER_BUFFER_SIZE);
+    w->buffers[1] = (char*) malloc(WRITER_BUFFER_SIZE);
+    w->current = 0;
+    w->used = 0;
+    w->pending = 0;
+    w->done = 0;
+    w->error = 0;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if(pthread_create(&w->thread, NULL, _writer_thread, w) != 0)
+        error_handler(FATAL_ERROR, "Error creating the writer thread for %s", path);
+    return w;
+}
+
+/*
+    Hands the current buffer of w to the background thread, waiting for the
+    previous one to be written first
+
+    Inputs:
+        w: pointer to the out_writer structure
+*/
+void flush_out_writer(out_writer* w){
+    if(w->used == 0)
+        return;
+    pthread_mutex_lock(&w->lock);
+    // Wait until the other buffer has been written
+    while(w->pending)
+        pthread_cond_wait(&w->cond, &w->lock);
+    // Swap buffers: the full one goes to the thread
+    w->pending = w->used;
+    w->current = 1 - w->current;
+    w->used = 0;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+    Writes out everything still buffered in w, closes its file and destroys
+    the writer. Any write error is fatal.
+
+    Inputs:
+        w: pointer to the out_writer structure
+*/
+void destroy_out_writer(out_writer* w){
+    flush_out_writer(w);
+    // Let the thread drain the last buffer and finish
+    pthread_mutex_lock(&w->lock);
+    w->done = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+    if(close(w->fd) != 0 && !w->error)
+        w->error = errno;
+    if(w->error)
+        error_handler(FATAL_ERROR, "Error writing output file %s: %s", w->path, strerror(w->error));
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    free(w->buffers[0]);
+    free(w->buffers[1]);
+    free(w);
+}
@@ -1,8 +1,459 @@
 #include <mpi.h>
 #include <stdlib.h>
+#include <string.h>
 #include "pipe_clust.h"
 #include "sequence.h"
 #include "util.h"
+#include "stats.h"
+#include "spill.h"
+#include "sort_derep.h"
+#include "hll.h"
+#include "filter.h"
+#include "stream.h"
+#include "manifest.h"
+#include "rma_table.h"
+#include "compress.h"
+#include "fingerprint.h"
+#include "uring_reader.h"
+
+// Rank that reads the streamed inputs and scatters them
+#define STREAM_READER 0
+// Bytes of records sent to a process before moving to the next one
+#define STREAM_BATCH_BYTES (1 << 20)
+// Tag of the messages carrying batches of a streamed input
+#define STREAM_TAG 38
+
+// Reads the inputs that correspond to a process into a de-replication database
+typedef void (*input_reader)(char** fasta_fps, int num_files, int my_rank, int comm_sz, derep_db* db);
+
+// De-replication engine in use
+static int ENGINE = DEREP_ENGINE_HASH;
+// Sort-based engine of this process, while reading with it
+static sort_derep* SORTER = NULL;
+
+// Whether the tables are pre-sized with a cardinality estimation pass
+static int PRESIZE = 0;
+// Sketch of the sequences of this process, while running that pass
+static hll* SCAN = NULL;
+// Estimated number of unique sequences across all the processes
+static long GLOBAL_UNIQUE = 0;
+
+// Whether the hash engine gathers within each node first
+static int NODE_GATHER = 0;
+// Whether the local databases are left in place for a distributed output
+static int DISTRIBUTED_OUTPUT = 0;
+// Whether the regular files are read through io_uring
+static int IO_URING = 0;
+
+// Sequences waiting to be de-replicated together in the hash table
+static sequence* BATCH[DEREP_BATCH];
+static int BATCH_SIZE = 0;
+
+// Memory budget of the de-replication table (0 means no limit)
+static size_t MEM_LIMIT = 0;
+// Directory where the tables are spilled
+static char* SPILL_DIR = ".";
+// Spill area of this process, created on the first spill
+static spill* SPILL = NULL;
+
+/*
+    Sets the de-replication engine used by the following de-replications
+
+    Inputs:
+        engine: DEREP_ENGINE_HASH or DEREP_ENGINE_SORT
+*/
+void set_derep_engine(int engine){
+    ENGINE = engine;
+}
+
+/*
+    Sets whether the de-replication tables are pre-sized
+
+    Inputs:
+        presize: 1 to run the cardinality estimation pass, 0 otherwise
+*/
+void set_presize(int presize){
+    PRESIZE = presize;
+}
+
+/*
+    Sets whether the hash engine merges the tables of the processes of each
+    node through shared memory before gathering them across the nodes
+
+    Inputs:
+        node_gather: 1 for the node-aware gather, 0 for a flat one
+*/
+void set_node_gather(int node_gather){
+    NODE_GATHER = node_gather;
+}
+
+/*
+    Sets whether the de-replications leave the local databases in their
+    processes, for write_distributed_output, instead of gathering them
+
+    Inputs:
+        distributed: 1 to skip the gather, 0 otherwise
+*/
+void set_distributed_output(int distributed){
+    DISTRIBUTED_OUTPUT = distributed;
+}
+
+/*
+    Sets whether the runs of regular input files of a process are read
+    through an io_uring reader
+
+    Inputs:
+        io_uring: 1 to submit the opens and reads ahead, 0 for blocking reads
+*/
+void set_io_uring(int io_uring){
+    IO_URING = io_uring;
+}
+
+/*
+    Sets the memory budget of the de-replication table of each process
+
+    Inputs:
+        bytes: the memory budget, in bytes - 0 means no limit
+        spill_dir: directory where the spilled tables are written
+*/
+void set_memory_limit(size_t bytes, char* spill_dir){
+    MEM_LIMIT = bytes;
+    if(spill_dir)
+        SPILL_DIR = spill_dir;
+}
+
+/*
+    Spills the de-replication database db to disk if it has outgrown the
+    memory budget
+
+    Inputs:
+        db: pointer to the de-replication database
+*/
+void _check_memory(derep_db* db){
+    if(MEM_LIMIT == 0 || db->bytes < MEM_LIMIT)
+        return;
+    if(SPILL == NULL){
+        int my_rank;
+        MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+        SPILL = create_spill(SPILL_DIR, my_rank);
+    }
+    spill_derep_db(SPILL, db);
+}
+
+/*
+    Merges back the spilled tables, if any, into the de-replication
+    database db
+
+    Inputs:
+        db: pointer to the de-replication database
+*/
+void _merge_spilled(derep_db* db){
+    if(SPILL == NULL)
+        return;
+    merge_spilled_runs(SPILL, db);
+    destroy_spill(SPILL);
+    SPILL = NULL;
+}
+
+/*
+    Prepares the de-replication engine to read sequences into db
+
+    Inputs:
+        db: pointer to the de-replication database
+*/
+void _start_engine(derep_db* db){
+    if(ENGINE == DEREP_ENGINE_SORT)
+        SORTER = create_sort_derep();
+}
+
+/*
+    De-replicates the batch of sequences waiting against db, frees them and
+    spills db if it went over the memory budget
+
+    Inputs:
+        db: pointer to the de-replication database
+*/
+void _flush_batch(derep_db* db){
+    int i;
+    if(BATCH_SIZE == 0)
+        return;
+    STATS_TIC(t_derep);
+    dereplicate_db_batch(db, BATCH, BATCH_SIZE);
+    STATS_TOC(PHASE_DEREP, t_derep);
+    // The database keeps its own copy of the sequences
+    for(i = 0; i < BATCH_SIZE; i++)
+        free_sequence(BATCH[i]);
+    BATCH_SIZE = 0;
+    _check_memory(db);
+}
+
+/*
+    De-replicates the sequence seq with the engine in use. The sequence
+    structure is consumed.
+
+    Inputs:
+        db: pointer to the de-replication database
+        seq: pointer to the sequence structure
+*/
+void _consume_sequence(derep_db* db, sequence* seq){
+    // Reads failing the filters never reach the engine, and the ones
+    // passing them are trimmed before being hashed
+    if(read_filter_enabled() && !read_filter(seq)){
+        STATS_ADD(filtered, 1);
+        free_sequence(seq);
+        return;
+    }
+    if(SCAN){
+        // Estimation pass - the sequence is only counted
+        hll_add(SCAN, seq->sequence, seq->seq_length);
+        free_sequence(seq);
+        return;
+    }
+    if(SORTER){
+        STATS_TIC(t_derep);
+        sort_derep_add(SORTER, seq);
+        STATS_TOC(PHASE_DEREP, t_derep);
+        return;
+    }
+    // The hash table takes the sequences in batches
+    BATCH[BATCH_SIZE++] = seq;
+    if(BATCH_SIZE == DEREP_BATCH)
+        _flush_batch(db);
+}
+
+/*
+    Flushes the de-replication engine so db holds all the unique sequences
+    read by this process
+
+    Inputs:
+        db: pointer to the de-replication database
+*/
+void _finish_engine(derep_db* db){
+    _flush_batch(db);
+    STATS_TIC(t_derep);
+    if(SORTER){
+        finish_sort_derep(SORTER, db);
+        SORTER = NULL;
+    }
+    // Bring back the spilled partitions before anything is gathered
+    _merge_spilled(db);
+    STATS_TOC(PHASE_DEREP, t_derep);
+}
+
+/*
+    Records the size and load factor of the local de-replication table
+    in the performance counters
+
+    Inputs:
+        db: pointer to the de-replication database
+*/
+void _record_table_stats(derep_db* db){
+    if(!STATS_ENABLED)
+        return;
+    STATS.local_unique = db->unique;
+    if(db->seqs)
+        STATS.load_factor = (double) db->seqs->hh.tbl->num_items / db->seqs->hh.tbl->num_buckets;
+}
+
+/*
+    De-replicates the sequences of the stream s against the de-replication
+    database db
+
+    Inputs:
+        s: pointer to the stream structure
+        db: pointer to the de-replication database
+*/
+void _dereplicate_stream(stream* s, derep_db* db){
+    // Read the first sequence
+    STATS_TIC(t_read);
+    sequence* seq = read_stream_sequence(s);
+    STATS_TOC(PHASE_READ, t_read);
+    // Loop through all the stream
+    while(seq != NULL){
+        // De-replicate the sequence
+        _consume_sequence(db, seq);
+        // Read next sequence
+        STATS_TIC(t_next);
+        seq = read_stream_sequence(s);
+        STATS_TOC(PHASE_READ, t_next);
+    }
+}
+
+/*
+    De-replicates the streamed input fasta_fp ('-', a pipe...) against the
+    de-replication database db
+
+    Inputs:
+        fasta_fp: input path
+        db: pointer to the de-replication database
+*/
+void _stream_dereplication(char* fasta_fp, derep_db* db){
+    stream* s = open_stream(fasta_fp);
+    _dereplicate_stream(s, db);
+    close_stream(s);
+}
+
+/*
+    De-replicates the regular files fasta_fps, in order, against the
+    de-replication database db through an io_uring reader, which opens and
+    reads the next files while the current one is parsed
+
+    Inputs:
+        fasta_fps: list of fasta filepaths
+        num_files: the number of fasta filepaths
+        db: pointer to the de-replication database
+
+    Returns 1 if the files were read, 0 if io_uring is not available
+*/
+int _uring_dereplication(char** fasta_fps, int num_files, derep_db* db){
+    stream* s;
+    uring_reader* r = create_uring_reader(fasta_fps, num_files);
+    if(r == NULL){
+        error_handler(WARN_ERROR, "io_uring is not available, reading the files with blocking I/O");
+        IO_URING = 0;
+        return 0;
+    }
+    while((s = uring_next_stream(r)) != NULL)
+        _dereplicate_stream(s, db);
+    destroy_uring_reader(r);
+    return 1;
+}
+
+/*
+    Serializes the record seq at the end of the batch b
+*/
+void _pack_record(byte_buffer* b, sequence* seq){
+    int quality_length = seq->quality ? seq->seq_length : 0;
+    buffer_append(b, &seq->label_length, sizeof(int));
+    buffer_append(b, seq->label, seq->label_length);
+    buffer_append(b, &seq->seq_length, sizeof(int));
+    buffer_append(b, seq->sequence, seq->seq_length);
+    buffer_append(b, &quality_length, sizeof(int));
+    buffer_append(b, seq->quality, quality_length);
+}
+
+/*
+    Rebuilds the record serialized at *position of the batch data, moving
+    *position past it
+
+    Returns a pointer to the new sequence structure
+*/
+sequence* _unpack_record(char* data, int* position){
+    int quality_length;
+    sequence* seq = new_sequence();
+    memcpy(&seq->label_length, data + *position, sizeof(int));
+    *position += sizeof(int);
+    seq->label = (char*) malloc(sizeof(char) * (seq->label_length+1));
+    memcpy(seq->label, data + *position, seq->label_length);
+    seq->label[seq->label_length] = '\0';
+    *position += seq->label_length;
+    memcpy(&seq->seq_length, data + *position, sizeof(int));
+    *position += sizeof(int);
+    posix_memalign((void **) &seq->sequence, 16, sizeof(char) * (seq->seq_length+1));
+    memcpy(seq->sequence, data + *position, seq->seq_length);
+    seq->sequence[seq->seq_length] = '\0';
+    *position += seq->seq_length;
+    memcpy(&quality_length, data + *position, sizeof(int));
+    *position += sizeof(int);
+    if(quality_length){
+        seq->quality = (char*) malloc(sizeof(char) * (quality_length+1));
+        memcpy(seq->quality, data + *position, quality_length);
+        seq->quality[quality_length] = '\0';
+        *position += quality_length;
+    }
+    return seq;
+}
+
+/*
+    Reads the streamed input fasta_fp in the reader process and scatters its
+    records, in batches of about STREAM_BATCH_BYTES, round robin to all the
+    processes (the reader included). Each process de-replicates the batches
+    it gets against db. Batches are sent asynchronously, so the reader keeps
+    reading while the previous batch of a process is in flight.
+
+    Inputs:
+        fasta_fp: input path
+        db: pointer to the de-replication database
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+*/
+void _scatter_stream(char* fasta_fp, derep_db* db, int my_rank, int comm_sz){
+    int i;
+    if(my_rank != STREAM_READER){
+        // Receive batches until the empty one that closes the stream
+        MPI_Status status;
+        int size;
+        char* data = NULL;
+        while(1){
+            STATS_TIC(t_recv);
+            MPI_Probe(STREAM_READER, STREAM_TAG, MPI_COMM_WORLD, &status);
+            MPI_Get_count(&status, MPI_BYTE, &size);
+            data = (char*) realloc(data, size + 1);
+            MPI_Recv(data, size, MPI_BYTE, STREAM_READER, STREAM_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+            STATS_TOC(PHASE_READ, t_recv);
+            if(size == 0)
+                break;
+            int position = 0;
+            while(position < size)
+                _consume_sequence(db, _unpack_record(data, &position));
+        }
+        free(data);
+        return;
+    }
+    // One batch being filled and one in flight per process
+    byte_buffer* filling = (byte_buffer*) calloc(comm_sz, sizeof(byte_buffer));
+    byte_buffer* in_flight = (byte_buffer*) calloc(comm_sz, sizeof(byte_buffer));
+    MPI_Request* requests = (MPI_Request*) malloc(sizeof(MPI_Request) * comm_sz);
+    for(i = 0; i < comm_sz; i++)
+        requests[i] = MPI_REQUEST_NULL;
+    int dest = 0;
+    size_t batch_bytes = 0;
+    stream* s = open_stream(fasta_fp);
+    STATS_TIC(t_read);
+    sequence* seq = read_stream_sequence(s);
+    STATS_TOC(PHASE_READ, t_read);
+    while(seq != NULL){
+        batch_bytes += seq->label_length + seq->seq_length;
+        if(dest == my_rank)
+            _consume_sequence(db, seq);
+        else{
+            _pack_record(&filling[dest], seq);
+            free_sequence(seq);
+        }
+        if(batch_bytes >= STREAM_BATCH_BYTES){
+            if(dest != my_rank){
+                // Swap the batches once the previous one has been delivered
+                byte_buffer tmp;
+                MPI_Wait(&requests[dest], MPI_STATUS_IGNORE);
+                tmp = in_flight[dest];
+                in_flight[dest] = filling[dest];
+                filling[dest] = tmp;
+                filling[dest].size = 0;
+                MPI_Isend(in_flight[dest].data, in_flight[dest].size, MPI_BYTE, dest, STREAM_TAG, MPI_COMM_WORLD, &requests[dest]);
+            }
+            dest = (dest + 1) % comm_sz;
+            batch_bytes = 0;
+        }
+        STATS_TIC(t_next);
+        seq = read_stream_sequence(s);
+        STATS_TOC(PHASE_READ, t_next);
+    }
+    close_stream(s);
+    // Send the last partial batches and close the stream everywhere
+    for(i = 0; i < comm_sz; i++){
+        if(i == my_rank)
+            continue;
+        MPI_Wait(&requests[i], MPI_STATUS_IGNORE);
+        if(filling[i].size > 0)
+            MPI_Send(filling[i].data, filling[i].size, MPI_BYTE, i, STREAM_TAG, MPI_COMM_WORLD);
+        MPI_Send(NULL, 0, MPI_BYTE, i, STREAM_TAG, MPI_COMM_WORLD);
+        free(filling[i].data);
+        free(in_flight[i].data);
+    }
+    free(filling);
+    free(in_flight);
+    free(requests);
+}
 
 /*
     De-replicates the fasta file fasta_fp against the de-replication
@@ -13,43 +464,56 @@
         db: pointer to the de-replication database
 */
 void _serial_dereplication(char* fasta_fp, derep_db* db){
+    // Pipes and the standard input are read through a stream
+    if(is_stream_input(fasta_fp)){
+        _stream_dereplication(fasta_fp, db);
+        return;
+    }
     // Open the FASTA file
     FILE* fd = fopen(fasta_fp, "r");
     // Check if we were able to open the file
     if(fd == NULL)
         error_handler(FATAL_ERROR, "Error opening file %s", fasta_fp);
     // Read the first sequence
+    STATS_TIC(t_read);
     sequence* seq = read_sequence(fd);
+    STATS_TOC(PHASE_READ, t_read);
     // Loop through all the file
     while(seq != NULL){
-        // Compare if the sequence already exist on the DB
-        dereplicate_db(db, seq);
+        // De-replicate the sequence
+        _consume_sequence(db, seq);
         // Read next sequence
+        STATS_TIC(t_next);
         seq = read_sequence(fd);
+        STATS_TOC(PHASE_READ, t_next);
     }
     // Close the FASTA file
     fclose(fd);
 }
 
 /*
-    De-replicates the list of files fasta_fps.
+    De-replicates the files fasta_fps, in order, against the de-replication
+    database db. With io_uring enabled, each run of regular files goes
+    through a single io_uring reader.
 
     Inputs:
         fasta_fps: list of fasta filepaths
-        count: the number of fasta filepaths
-
-    Returns a pointer to the de-replication database
+        num_files: the number of fasta filepaths
+        db: pointer to the de-replication database
 */
-derep_db* serial_dereplication(char** fasta_fps, int num_files){
-    int i;
-    // Create the sequence DB
-    derep_db* db = create_derep_db();
-    // Loop through all the fasta files
-    for(i = 0; i < num_files; i++){
-        // Serially de-replicate current file against database
+void _read_files(char** fasta_fps, int num_files, derep_db* db){
+    int i = 0;
+    while(i < num_files){
+        int run = 0;
+        while(IO_URING && i + run < num_files && !is_stream_input(fasta_fps[i + run]))
+            ++run;
+        if(run > 0 && _uring_dereplication(&fasta_fps[i], run, db)){
+            i += run;
+            continue;
+        }
         _serial_dereplication(fasta_fps[i], db);
+        ++i;
     }
-    return db;
 }
 
 /*
@@ -72,54 +536,73 @@ void _parallel_dereplication(char* fasta_fp, derep_db* db, int first, int n_part
         error_handler(FATAL_ERROR, "Error opening file %s", fasta_fp);
     // Read the first sequence
     restore_counter();
+    STATS_TIC(t_read);
     sequence* seq = read_sequence_by_idx(fd, current);
+    STATS_TOC(PHASE_READ, t_read);
     // Loop through all the file
     while(seq != NULL){
-        // Compare if the sequence already exist on the DB
-        dereplicate_db(db, seq);
+        // De-replicate the sequence
+        _consume_sequence(db, seq);
         // Update current sequence
         current += n_partners;
         // Read the next sequence
+        STATS_TIC(t_next);
         seq = read_sequence_by_idx(fd, current);
+        STATS_TOC(PHASE_READ, t_next);
     }
     // Close the FASTA file
     fclose(fd);
 }
 
 /*
-    De-replicates the list of files fasta_fps in parallel.
+    Reads the share of the list of inputs all_fps that corresponds to the
+    process my_rank, handing each sequence to the engine in use. The regular
+    files are split among the processes; the streamed inputs are read by
+    STREAM_READER and scattered.
 
     Inputs:
-        fasta_fps: list of fasta filepaths
-        num_files: the number of fasta filepaths
+        all_fps: list of input paths
+        num_inputs: the number of input paths
         my_rank: the MPI rank of the current process
         comm_sz: the number of processes launched
-
-    Returns a pointer to the de-replication database
+        db: pointer to the de-replication database
 */
-derep_db* parallel_dereplication(char** fasta_fps, int num_files, int my_rank, int comm_sz){
+void _read_my_share(char** all_fps, int num_inputs, int my_rank, int comm_sz, derep_db* db){
     int i;
     // Will hold the current file processed
     int current;
+    // Streamed inputs are read by a single process and scattered,
+    // the regular files are split as usual. Rank 0 decides which is which.
+    char* streamed = (char*) malloc(sizeof(char) * (num_inputs + 1));
+    if(my_rank == 0){
+        for(i = 0; i < num_inputs; i++)
+            streamed[i] = is_stream_input(all_fps[i]);
+    }
+    MPI_Bcast(streamed, num_inputs, MPI_CHAR, 0, MPI_COMM_WORLD);
+    char** fasta_fps = (char**) malloc(sizeof(char*) * (num_inputs + 1));
+    int num_files = 0;
+    for(i = 0; i < num_inputs; i++){
+        if(!streamed[i])
+            fasta_fps[num_files++] = all_fps[i];
+    }
     // Determine how many files I have to process by myself
     int num_my_files = num_files / comm_sz;
     // Determine how many files have left unassigned
     int remaining_files = num_files % comm_sz;
 
-    // De-replication
-
-    // Create the sequence DB
-    derep_db* db = create_derep_db();
     // Loop through all the fasta file that are assigned to me
     // and I'm going to be the only process looking at it
+    // Since I'm the only one that will visit them
+    // I can de-replicate them serially
+    char** my_fps = (char**) malloc(sizeof(char*) * (num_my_files + 1));
     current = my_rank;
     for(i = 0; i < num_my_files; i++){
-        // Since I'm the only one that will visit this file
-        // I can de-replicate it serially
-        _serial_dereplication(fasta_fps[current], db);
+        my_fps[i] = fasta_fps[current];
         // Update file index
         current += comm_sz;
     }
+    _read_files(my_fps, num_my_files, db);
+    free(my_fps);
 
     // If the number of files cannot be evenly distributed among all 
     // the processes, there are some remaining files to be de-replicated
@@ -134,7 +617,7 @@ derep_db* parallel_dereplication(char** fasta_fps, int num_files, int my_rank, i
         int remaining_procs = comm_sz - (n_partners * remaining_files);
         // If my file is one of the files that the 'unassigned processes' are
         // going to access, I need to update my n_partners variable
-        if(current < remaining_procs)
+        if((my_rank % remaining_files) < remaining_procs)
             ++n_partners;
         // Get which is the first sequence that I need to read
         int first_sequence = my_rank / remaining_files;
@@ -142,8 +625,233 @@ derep_db* parallel_dereplication(char** fasta_fps, int num_files, int my_rank, i
         _parallel_dereplication(fasta_fps[current], db, first_sequence, n_partners);
     }
 
+    // Streamed inputs
+    for(i = 0; i < num_inputs; i++){
+        if(streamed[i])
+            _scatter_stream(all_fps[i], db, my_rank, comm_sz);
+    }
+    free(streamed);
+    free(fasta_fps);
+}
+
+/*
+    Reads the bundle of files fasta_fps, all of them assigned to this process
+
+    Inputs:
+        fasta_fps: list of fasta filepaths
+        num_files: the number of fasta filepaths
+        my_rank, comm_sz: unused - the bundle is already planned
+        db: pointer to the de-replication database
+*/
+void _read_bundle(char** fasta_fps, int num_files, int my_rank, int comm_sz, derep_db* db){
+    _read_files(fasta_fps, num_files, db);
+}
+
+/*
+    Estimates the number of unique sequences in the share of the files of
+    the process my_rank with a HyperLogLog sketch and pre-sizes db for them.
+    The sketches of all the processes are merged to estimate the global
+    number of uniques, kept for the gather.
+
+    Inputs:
+        read_inputs: function that reads the share of the files
+        fasta_fps: list of fasta filepaths
+        num_files: the number of fasta filepaths
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+        db: pointer to the de-replication database
+*/
+void _presize_pass(input_reader read_inputs, char** fasta_fps, int num_files, int my_rank, int comm_sz, derep_db* db){
+    // The reads of this pass are not accounted as reads
+    run_stats saved = STATS;
+    STATS_TIC(t_presize);
+    SCAN = create_hll();
+    read_inputs(fasta_fps, num_files, my_rank, comm_sz, db);
+    presize_derep_db(db, (long) hll_estimate(SCAN));
+    // Union of the sketches of all the processes
+    if(comm_sz > 1)
+        allreduce_hll(SCAN);
+    GLOBAL_UNIQUE = (long) hll_estimate(SCAN);
+    destroy_hll(SCAN);
+    SCAN = NULL;
+    if(STATS_ENABLED){
+        STATS = saved;
+        STATS_TOC(PHASE_PRESIZE, t_presize);
+    }
+}
+
+/*
+    Pre-sizes the table of db for the uniques it will hold once the gather
+    is done: the table of a receiver merges the tables of its subtree of
+    the binomial tree (of the node and then of the node leaders with the
+    node gather), bounded by the global estimate
+
+    Inputs:
+        db: pointer to the local de-replication database, already pre-sized
+            for the local uniques
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+*/
+void _presize_for_gather(derep_db* db, int my_rank, int comm_sz){
+    // Number of processes whose tables end up in mine
+    int subtree;
+    if(NODE_GATHER)
+        subtree = node_gather_subtree(my_rank, comm_sz);
+    else{
+        subtree = my_rank ? (my_rank & -my_rank) : comm_sz;
+        if(subtree > comm_sz - my_rank)
+            subtree = comm_sz - my_rank;
+    }
+    // Senders keep their table as is
+    if(subtree == 1)
+        return;
+    long expected = db->expected * subtree;
+    if(expected > GLOBAL_UNIQUE)
+        expected = GLOBAL_UNIQUE;
+    presize_derep_db(db, expected);
+}
+
+/*
+    De-replicates the list of files fasta_fps.
+
+    Inputs:
+        fasta_fps: list of fasta filepaths
+        count: the number of fasta filepaths
+
+    Returns a pointer to the de-replication database
+*/
+derep_db* serial_dereplication(char** fasta_fps, int num_files){
+    // Create the sequence DB
+    derep_db* db = create_derep_db();
+    // A single process reads all the files
+    if(PRESIZE)
+        _presize_pass(_read_bundle, fasta_fps, num_files, 0, 1, db);
+    _start_engine(db);
+    // Serially de-replicate all the fasta files against the database
+    _read_files(fasta_fps, num_files, db);
+    _finish_engine(db);
+    _record_table_stats(db);
+    return db;
+}
+
+/*
+    De-replicates the files read by read_inputs, without gathering the
+    results
+
+    Inputs:
+        read_inputs: function that reads the files of this process
+        fasta_fps: list of fasta filepaths
+        num_files: the number of fasta filepaths
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+
+    Returns a pointer to the local de-replication database
+*/
+derep_db* _local_dereplication(input_reader read_inputs, char** fasta_fps, int num_files, int my_rank, int comm_sz){
+    // Create the sequence DB
+    derep_db* db = create_derep_db();
+    if(PRESIZE)
+        _presize_pass(read_inputs, fasta_fps, num_files, my_rank, comm_sz, db);
+    // De-replication
+    _start_engine(db);
+    read_inputs(fasta_fps, num_files, my_rank, comm_sz, db);
+    _finish_engine(db);
+    _record_table_stats(db);
+    // Return the local de-replicated database
+    return db;
+}
+
+/*
+    Gathers the local de-replication databases in the process with rank 0,
+    with the method of the engine in use
+
+    Inputs:
+        db: pointer to the local de-replication database
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+*/
+void _gather_dereplication(derep_db* db, int my_rank, int comm_sz){
+    // With a single process there is nothing to gather, and the
+    // distributed output works on the local databases
+    if(comm_sz == 1 || DISTRIBUTED_OUTPUT)
+        return;
+    STATS_TIC(t_gather);
+    if(PRESIZE){
+        if(ENGINE != DEREP_ENGINE_HASH && my_rank == 0)
+            presize_derep_db(db, GLOBAL_UNIQUE);
+        else if(ENGINE == DEREP_ENGINE_HASH)
+            _presize_for_gather(db, my_rank, comm_sz);
+    }
+    if(ENGINE == DEREP_ENGINE_SORT)
+        sample_sort_derep_db(db, my_rank, comm_sz);
+    else if(ENGINE == DEREP_ENGINE_RMA)
+        rma_derep_db(db, my_rank, comm_sz);
+    else if(NODE_GATHER)
+        node_gather_derep_db(db, my_rank, comm_sz);
+    else
+        gather_derep_db(db, my_rank, comm_sz);
+    STATS_TOC(PHASE_GATHER, t_gather);
+    if(gather_compression_enabled())
+        report_gather_compression(my_rank);
+    if(fingerprint_gather_enabled())
+        report_fingerprint_gather(my_rank);
+}
+
+/*
+    De-replicates the share of the list of files fasta_fps that corresponds
+    to the process my_rank, without gathering the results.
+
+    Inputs:
+        fasta_fps: list of fasta filepaths
+        num_files: the number of fasta filepaths
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+
+    Returns a pointer to the local de-replication database
+*/
+derep_db* local_dereplication(char** fasta_fps, int num_files, int my_rank, int comm_sz){
+    return _local_dereplication(_read_my_share, fasta_fps, num_files, my_rank, comm_sz);
+}
+
+/*
+    De-replicates the list of files fasta_fps in parallel.
+
+    Inputs:
+        fasta_fps: list of fasta filepaths
+        num_files: the number of fasta filepaths
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+
+    Returns a pointer to the de-replication database
+*/
+derep_db* parallel_dereplication(char** fasta_fps, int num_files, int my_rank, int comm_sz){
+    // De-replicate my share of the files
+    derep_db* db = local_dereplication(fasta_fps, num_files, my_rank, comm_sz);
     // Gather results in a single process (rank=0)
-    gather_derep_db(db, my_rank, comm_sz);
+    _gather_dereplication(db, my_rank, comm_sz);
     // Return the de-replicated database
     return db;
+}
+
+/*
+    De-replicates the files listed in the manifest file in parallel. Rank 0
+    reads the manifest and plans the bundle of files of each process by
+    file size.
+
+    Inputs:
+        manifest: path of the manifest, one input file per line
+        my_rank: the MPI rank of the current process
+        comm_sz: the number of processes launched
+
+    Returns a pointer to the de-replication database
+*/
+derep_db* manifest_dereplication(char* manifest, int my_rank, int comm_sz){
+    int num_files;
+    // Get my bundle of files
+    char** bundle = scatter_manifest(manifest, my_rank, comm_sz, &num_files);
+    // De-replicate them and gather the results in rank 0
+    derep_db* db = _local_dereplication(_read_bundle, bundle, num_files, my_rank, comm_sz);
+    _gather_dereplication(db, my_rank, comm_sz);
+    free_bundle(bundle);
+    return db;
 }
\ No newline at end of file
@@ -0,0 +1,330 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ref_index.h"
+#include "sequence.h"
+#include "util.h"
+
+/*
+    Rounds size up to a multiple of 8 bytes
+*/
+size_t _align8(size_t size){
+    return (size + 7) & ~(size_t) 7;
+}
+
+/*
+    Computes the offsets of the sections of an index file with the given
+    header, and its total size
+
+    Inputs:
+        header: pointer to the header of the index
+        offsets: output parameter - the offsets of the name offsets, sequence
+            offsets, k-mer offsets, postings, names and sequences sections
+
+    Returns the size of the index file
+*/
+size_t _ref_index_layout(ref_index_header* header, size_t* offsets){
+    offsets[0] = _align8(sizeof(ref_index_header));
+    offsets[1] = offsets[0] + sizeof(uint64_t) * (header->num_refs + 1);
+    offsets[2] = offsets[1] + sizeof(uint64_t) * (header->num_refs + 1);
+    offsets[3] = offsets[2] + sizeof(uint64_t) * (REF_INDEX_NUM_KMERS + 1);
+    offsets[4] = _align8(offsets[3] + sizeof(uint32_t) * header->num_postings);
+    offsets[5] = _align8(offsets[4] + header->names_bytes);
+    return offsets[5] + header->seqs_bytes;
+}
+
+/*
+    Pads a section of size bytes with zeros up to a multiple of 8 bytes
+*/
+void _write_padding(FILE* fd, size_t size){
+    static const char zeros[8] = {0};
+    if(_align8(size) > size)
+        fwrite(zeros, 1, _align8(size) - size, fd);
+}
+
+/*
+    Writes the section of size bytes data to fd, with its padding
+*/
+void _write_section(FILE* fd, void* data, size_t size){
+    if(size && fwrite(data, 1, size, fd) != size)
+        error_handler(FATAL_ERROR, "Error writing the reference index");
+    _write_padding(fd, size);
+}
+
+/*
+    Builds the reference index of the (single line) FASTA file fasta and
+    writes it to the file index
+
+    Inputs:
+        fasta: path to the reference FASTA file
+        index: path to the index file to write
+*/
+void build_ref_index(char* fasta, char* index){
+    int i;
+    int j;
+    int num_refs = 0;
+    int capacity = 1024;
+    char** names = (char**) malloc(sizeof(char*) * capacity);
+    char** seqs = (char**) malloc(sizeof(char*) * capacity);
+    ref_index_header header;
+    memset(&header, 0, sizeof(ref_index_header));
+    // Read all the references
+    FILE* fd = fopen(fasta, "r");
+    if(fd == NULL)
+        error_handler(FATAL_ERROR, "Error opening file %s", fasta);
+    sequence* seq;
+    while((seq = read_sequence(fd)) != NULL){
+        if(num_refs == capacity){
+            capacity *= 2;
+            names = (char**) realloc(names, sizeof(char*) * capacity);
+            seqs = (char**) realloc(seqs, sizeof(char*) * capacity);
+        }
+        names[num_refs] = seq->label;
+        seqs[num_refs] = seq->sequence;
+        header.names_bytes += seq->label_length + 1;
+        header.seqs_bytes += seq->seq_length + 1;
+        ++num_refs;
+        free(seq);
+    }
+    fclose(fd);
+    header.num_refs = num_refs;
+    // Count the references holding each k-mer
+    kmer_index* seed = create_kmer_index(REF_INDEX_SEED);
+    int* kmers = NULL;
+    int kmers_capacity = 0;
+    uint64_t* kmer_offsets = (uint64_t*) calloc(REF_INDEX_NUM_KMERS + 1, sizeof(uint64_t));
+    for(i = 0; i < num_refs; i++){
+        int n = sequence_kmers(seed, seqs[i], &kmers, &kmers_capacity);
+        for(j = 0; j < n; j++)
+            ++kmer_offsets[kmers[j] + 1];
+    }
+    for(i = 0; i < REF_INDEX_NUM_KMERS; i++)
+        kmer_offsets[i+1] += kmer_offsets[i];
+    header.num_postings = kmer_offsets[REF_INDEX_NUM_KMERS];
+    // Fill the posting lists, in reference order
+    uint64_t* next = (uint64_t*) malloc(sizeof(uint64_t) * REF_INDEX_NUM_KMERS);
+    memcpy(next, kmer_offsets, sizeof(uint64_t) * REF_INDEX_NUM_KMERS);
+    uint32_t* postings = (uint32_t*) malloc(sizeof(uint32_t) * (header.num_postings + 1));
+    for(i = 0; i < num_refs; i++){
+        int n = sequence_kmers(seed, seqs[i], &kmers, &kmers_capacity);
+        for(j = 0; j < n; j++)
+            postings[next[kmers[j]]++] = i;
+    }
+    free(next);
+    free(kmers);
+    destroy_kmer_index(seed);
+    // Offsets of the names and sequences
+    uint64_t* name_offsets = (uint64_t*) malloc(sizeof(uint64_t) * (num_refs + 1));
+    uint64_t* seq_offsets = (uint64_t*) malloc(sizeof(uint64_t) * (num_refs + 1));
+    name_offsets[0] = 0;
+    seq_offsets[0] = 0;
+    for(i = 0; i < num_refs; i++){
+        name_offsets[i+1] = name_offsets[i] + strlen(names[i]) + 1;
+        seq_offsets[i+1] = seq_offsets[i] + strlen(seqs[i]) + 1;
+    }
+    // Write the index file
+    memcpy(header.magic, REF_INDEX_MAGIC, 8);
+    header.version = REF_INDEX_VERSION;
+    header.k = REF_INDEX_K;
+    fd = fopen(index, "w");
+    if(fd == NULL)
+        error_handler(FATAL_ERROR, "Error opening file %s", index);
+    _write_section(fd, &header, sizeof(ref_index_header));
+    _write_section(fd, name_offsets, sizeof(uint64_t) * (num_refs + 1));
+    _write_section(fd, seq_offsets, sizeof(uint64_t) * (num_refs + 1));
+    _write_section(fd, kmer_offsets, sizeof(uint64_t) * (REF_INDEX_NUM_KMERS + 1));
+    _write_section(fd, postings, sizeof(uint32_t) * header.num_postings);
+    for(i = 0; i < num_refs; i++)
+        fwrite(names[i], 1, name_offsets[i+1] - name_offsets[i], fd);
+    _write_padding(fd, header.names_bytes);
+    for(i = 0; i < num_refs; i++)
+        fwrite(seqs[i], 1, seq_offsets[i+1] - seq_offsets[i], fd);
+    if(fclose(fd) != 0)
+        error_handler(FATAL_ERROR, "Error writing the reference index %s", index);
+    error_handler(INFO_MSG, "Reference index %s: %d references, %lu k-mer postings",
+                  index, num_refs, (unsigned long) header.num_postings);
+    // Free up the memory
+    for(i = 0; i < num_refs; i++){
+        free(names[i]);
+        free(seqs[i]);
+    }
+    free(names);
+    free(seqs);
+    free(name_offsets);
+    free(seq_offsets);
+    free(kmer_offsets);
+    free(postings);
+}
+
+/*
+    Maps the reference index file index in memory, read-only and shared
+
+    Inputs:
+        index: path to the index file
+
+    Returns:
+        the new ref_index structure
+*/
+ref_index* open_ref_index(char* index){
+    size_t offsets[6];
+    struct stat st;
+    int fd = open(index, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0)
+        error_handler(FATAL_ERROR, "Error opening the reference index %s", index);
+    if((size_t) st.st_size < sizeof(ref_index_header))
+        error_handler(FATAL_ERROR, "%s is not a reference index", index);
+    ref_index* idx = (ref_index*) malloc(sizeof(ref_index));
+    idx->map_size = st.st_size;
+    idx->map = mmap(NULL, idx->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping outlives the descriptor
+    close(fd);
+    if(idx->map == MAP_FAILED)
+        error_handler(FATAL_ERROR, "Error mapping the reference index %s", index);
+    idx->header = (ref_index_header*) idx->map;
+    if(memcmp(idx->header->magic, REF_INDEX_MAGIC, 8) != 0 ||
+       idx->header->version != REF_INDEX_VERSION || idx->header->k != REF_INDEX_K)
+        error_handler(FATAL_ERROR, "%s is not a reference index of this version", index);
+    if(_ref_index_layout(idx->header, offsets) != idx->map_size)
+        error_handler(FATAL_ERROR, "The reference index %s is truncated", index);
+    char* base = (char*) idx->map;
+    idx->name_offsets = (uint64_t*) (base + offsets[0]);
+    idx->seq_offsets = (uint64_t*) (base + offsets[1]);
+    idx->kmer_offsets = (uint64_t*) (base + offsets[2]);
+    idx->postings = (uint32_t*) (base + offsets[3]);
+    idx->names = base + offsets[4];
+    idx->seqs = base + offsets[5];
+    return idx;
+}
+
+/*
+    Unmaps the reference index idx
+
+    Inputs:
+        idx: pointer to the ref_index structure
+*/
+void close_ref_index(ref_index* idx){
+    munmap(idx->map, idx->map_size);
+    free(idx);
+}
+
+/*
+    Returns the label of the reference ref of the index idx
+*/
+char* ref_name(ref_index* idx, int ref){
+    return idx->names + idx->name_offsets[ref];
+}
+
+/*
+    Returns the sequence of the reference ref of the index idx
+*/
+char* ref_sequence(ref_index* idx, int ref){
+    return idx->seqs + idx->seq_offsets[ref];
+}
+
+/*
+    Returns the length of the sequence of the reference ref of the index idx
+*/
+int ref_length(ref_index* idx, int ref){
+    return idx->seq_offsets[ref+1] - idx->seq_offsets[ref] - 1;
+}
+
+/*
+    Creates the scratch space needed to query the reference index idx
+
+    Inputs:
+        idx: pointer to the ref_index structure
+
+    Returns:
+        the new ref_search structure
+*/
+ref_search* create_ref_search(ref_index* idx){
+    ref_search* search = (ref_search*) malloc(sizeof(ref_search));
+    search->seed = create_kmer_index(REF_INDEX_SEED);
+    search->shared = (int*) calloc(idx->header->num_refs + 1, sizeof(int));
+    search->touched = (int*) malloc(sizeof(int) * (idx->header->num_refs + 1));
+    search->kmers = NULL;
+    search->kmers_capacity = 0;
+    return search;
+}
+
+/*
+    Destroys the ref_search structure search
+
+    Inputs:
+        search: pointer to the ref_search structure
+*/
+void destroy_ref_search(ref_search* search){
+    destroy_kmer_index(search->seed);
+    free(search->shared);
+    free(search->touched);
+    free(search->kmers);
+    free(search);
+}
+
+/*
+    Returns whether the hit a goes before the hit b: more shared k-mers
+    first, then the lowest reference index
+*/
+int _ref_hit_before(ref_hit* a, ref_hit* b){
+    if(a->shared != b->shared)
+        return a->shared > b->shared;
+    return a->ref < b->ref;
+}
+
+/*
+    Looks for the references that share the most distinct k-mers with
+    sequence, among those that may hold it with at most max_edits edits
+
+    Inputs:
+        idx: pointer to the ref_index structure
+        search: pointer to the ref_search scratch space
+        sequence: the query sequence
+        max_edits: the largest edit distance of interest
+        n: the maximum number of candidates to return
+        hits: output parameter - array of at least n ref_hit structures
+
+    Returns:
+        the number of candidates stored in hits
+*/
+int ref_index_query(ref_index* idx, ref_search* search, char* sequence, int max_edits, int n, ref_hit* hits){
+    int i;
+    int j;
+    uint64_t p;
+    int num_touched = 0;
+    int num_hits = 0;
+    // Count the shared k-mers walking the posting lists
+    int num_kmers = sequence_kmers(search->seed, sequence, &search->kmers, &search->kmers_capacity);
+    int min_shared = num_kmers - REF_INDEX_K * max_edits;
+    if(min_shared < 1)
+        min_shared = 1;
+    for(i = 0; i < num_kmers; i++){
+        int kmer = search->kmers[i];
+        for(p = idx->kmer_offsets[kmer]; p < idx->kmer_offsets[kmer+1]; p++){
+            int ref = idx->postings[p];
+            if(search->shared[ref]++ == 0)
+                search->touched[num_touched++] = ref;
+        }
+    }
+    // Keep the n best candidates, using insertion into the sorted hits array
+    for(i = 0; i < num_touched; i++){
+        ref_hit hit;
+        hit.ref = search->touched[i];
+        hit.shared = search->shared[hit.ref];
+        // Reset the scratch counter for the next query
+        search->shared[hit.ref] = 0;
+        if(hit.shared < min_shared)
+            continue;
+        if(num_hits == n && (n == 0 || !_ref_hit_before(&hit, &hits[n-1])))
+            continue;
+        j = (num_hits < n) ? num_hits++ : n - 1;
+        while(j > 0 && _ref_hit_before(&hit, &hits[j-1])){
+            hits[j] = hits[j-1];
+            --j;
+        }
+        hits[j] = hit;
+    }
+    return num_hits;
+}
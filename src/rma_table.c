@@ -0,0 +1,404 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "mpi.h"
+#include "rma_table.h"
+#include "hash.h"
+#include "stats.h"
+#include "util.h"
+
+// Seeds of the fingerprints of the distributed table and of the check
+// fingerprints that tell apart the sequences of a chain
+#define RMA_SEED 0x7d4a3e1bULL
+#define RMA_CHECK_SEED 0x2c9f5b17ULL
+// Fields of a slot of the table, in 64-bit words
+#define SLOT_KEY 0
+#define SLOT_HEAD 1
+#define SLOT_WORDS 2
+// Bits of the offset inside an arena in a chain pointer
+#define OFFSET_BITS 40
+#define OFFSET_MASK (((int64_t) 1 << OFFSET_BITS) - 1)
+
+// Header of a block of an arena, followed by its labels (the length and
+// the characters of each one) and then its sequence
+typedef struct rma_block_str {
+    // Chain pointer of the next block with the same fingerprint
+    int64_t next;
+    uint64_t check;
+    int length;
+    int num_labels;
+    int64_t labels_bytes;
+} rma_block;
+
+// Chain of a claimed slot being walked by rank 0
+typedef struct rma_chain_str {
+    int64_t pointer;
+    // Unique of the last block read, and its check fingerprint
+    seq_replicas* r;
+    uint64_t check;
+    int length;
+} rma_chain;
+
+typedef struct rma_pending_str {
+    uint64_t key;
+    int64_t block;
+    int64_t head;
+    int target;
+    long slot;
+    long probes;
+} rma_pending;
+
+/*
+    Returns the fingerprint of the sequence - 0 marks the empty slots
+*/
+uint64_t _rma_key(char* sequence){
+    uint64_t key = hash_bytes64(sequence, strlen(sequence), RMA_SEED);
+    return key ? key : 1;
+}
+
+/*
+    Encodes the position of the block at `offset` of the arena of `rank`
+    as a chain pointer - 0 is the end of the chain
+*/
+int64_t _chain_pointer(int rank, size_t offset){
+    return (((int64_t) rank << OFFSET_BITS) | (int64_t) offset) + 1;
+}
+
+/*
+    Serializes the local uniques of db as blocks in an arena and empties db.
+    A block holds an rma_block header, the labels and the sequence of a
+    unique.
+
+    Inputs:
+        db: the local derep_db
+        arena: output parameter - the arena
+        pending: output parameter - one entry per block, to publish
+
+    Returns the number of blocks
+*/
+long _build_arena(derep_db* db, byte_buffer* arena, rma_pending* pending){
+    long n = 0;
+    int length;
+    char** label;
+    rma_block header;
+    seq_replicas* current;
+    seq_replicas* tmp;
+    HASH_ITER(hh, db->seqs, current, tmp){
+        pending[n].key = _rma_key(current->sequence);
+        pending[n].block = arena->size;
+        pending[n].probes = 0;
+        // The next pointer is filled when the block is pushed onto its chain
+        memset(&header, 0, sizeof(rma_block));
+        header.length = strlen(current->sequence);
+        header.check = hash_bytes64(current->sequence, header.length, RMA_CHECK_SEED);
+        header.num_labels = utarray_len(current->labels);
+        label = NULL;
+        while((label=(char**)utarray_next(current->labels, label)))
+            header.labels_bytes += sizeof(int) + strlen(*label);
+        buffer_append(arena, &header, sizeof(rma_block));
+        label = NULL;
+        while((label=(char**)utarray_next(current->labels, label))){
+            length = strlen(*label);
+            buffer_append(arena, &length, sizeof(int));
+            buffer_append(arena, *label, length);
+        }
+        buffer_append(arena, current->sequence, header.length);
+        HASH_DEL(db->seqs, current);
+        destroy_seq_replica(current);
+        ++n;
+    }
+    db->unique = 0;
+    db->bytes = 0;
+    return n;
+}
+
+/*
+    Publishes the blocks of `pending` in the distributed table, RMA_BATCH
+    at a time. For each batch, the fingerprints are compared-and-swapped
+    into their slots; those that found an empty slot or their own
+    fingerprint swap themselves in as the head of the chain, the rest probe
+    the next slot in the following round.
+
+    Inputs:
+        win: the window of the table, in a passive target epoch
+        slots_per_rank: the number of slots hosted by each process
+        pending: the blocks to publish
+        n: the number of blocks
+        arena: the local arena - the next pointers are filled in
+        my_rank, comm_sz: rank and number of processes
+*/
+void _publish_blocks(MPI_Win win, long slots_per_rank, rma_pending* pending, long n,
+                     byte_buffer* arena, int my_rank, int comm_sz){
+    long i;
+    long first;
+    uint64_t zero = 0;
+    uint64_t* found = (uint64_t*) malloc(sizeof(uint64_t) * RMA_BATCH);
+    int64_t* old_heads = (int64_t*) malloc(sizeof(int64_t) * RMA_BATCH);
+    rma_pending** batch = (rma_pending**) malloc(sizeof(rma_pending*) * RMA_BATCH);
+    // Home slot of each fingerprint, in the process its target
+    for(i = 0; i < n; i++)
+        pending[i].slot = (pending[i].key / comm_sz) % slots_per_rank;
+    for(first = 0; first < n; first += RMA_BATCH){
+        long size = (n - first < RMA_BATCH) ? n - first : RMA_BATCH;
+        long unresolved = size;
+        for(i = 0; i < size; i++)
+            batch[i] = &pending[first + i];
+        while(unresolved > 0){
+            long resolved = 0;
+            // Try to claim the current slot of every unresolved block
+            for(i = 0; i < unresolved; i++)
+                MPI_Compare_and_swap(&batch[i]->key, &zero, &found[i], MPI_UINT64_T, batch[i]->target,
+                                     batch[i]->slot * SLOT_WORDS + SLOT_KEY, win);
+            MPI_Win_flush_all(win);
+            STATS_ADD(hash_probes, unresolved);
+            for(i = 0; i < unresolved; i++){
+                rma_pending* p = batch[i];
+                if(found[i] == 0 || found[i] == p->key){
+                    // My slot - push the block onto the chain
+                    p->head = _chain_pointer(my_rank, p->block);
+                    MPI_Fetch_and_op(&p->head, &old_heads[resolved], MPI_INT64_T, p->target,
+                                     p->slot * SLOT_WORDS + SLOT_HEAD, MPI_REPLACE, win);
+                    batch[i] = batch[resolved];
+                    batch[resolved++] = p;
+                }
+                else{
+                    // Taken by another sequence - linear probing
+                    p->slot = (p->slot + 1) % slots_per_rank;
+                    if(++p->probes == slots_per_rank)
+                        error_handler(FATAL_ERROR, "The distributed de-replication table is full");
+                }
+            }
+            MPI_Win_flush_all(win);
+            // Link the blocks to the previous heads of their chains
+            for(i = 0; i < resolved; i++)
+                memcpy(arena->data + batch[i]->block, &old_heads[i], sizeof(int64_t));
+            // Keep the unresolved blocks at the front of the batch
+            for(i = 0; i < unresolved - resolved; i++)
+                batch[i] = batch[resolved + i];
+            unresolved -= resolved;
+        }
+    }
+    free(found);
+    free(old_heads);
+    free(batch);
+}
+
+/*
+    Adds to db the labels of the block body of the chain c, and the
+    sequence if it was read
+
+    Inputs:
+        db: the derep_db of rank 0
+        c: the chain the block belongs to
+        header: the header of the block
+        body: the labels of the block, followed by its sequence if read
+        with_sequence: whether the sequence was read
+*/
+void _add_block(derep_db* db, rma_chain* c, rma_block* header, char* body, int with_sequence){
+    int j;
+    int length;
+    char* cursor = body;
+    char* label = NULL;
+    if(with_sequence){
+        char* sequence = body + header->labels_bytes;
+        sequence[header->length] = '\0';
+        HASH_FIND(hh, db->seqs, sequence, header->length, c->r);
+        STATS_ADD(hash_probes, 1);
+        if(!c->r){
+            c->r = create_empty_seq_replica(sequence, header->length);
+            insert_seq_replica(db, c->r);
+        }
+        c->check = header->check;
+        c->length = header->length;
+    }
+    for(j = 0; j < header->num_labels; j++){
+        memcpy(&length, cursor, sizeof(int));
+        cursor += sizeof(int);
+        label = (char*) realloc(label, length + 1);
+        memcpy(label, cursor, length);
+        label[length] = '\0';
+        cursor += length;
+        add_replica(c->r, label);
+        db->bytes += LABEL_BYTES(length);
+    }
+    free(label);
+}
+
+/*
+    Rebuilds in db the unique sequences of the slots hosted by process
+    owner, RMA_BATCH slots at a time. The chains of a batch are walked
+    together, with a round of header reads and a round of body reads per
+    block. The sequence of a block is only read when its check fingerprint
+    differs from the one of the previous block of the chain, so a unique
+    sequence crosses the network once (twice or more only on a fingerprint
+    collision) and only the blocks of a batch are held at a time.
+
+    Inputs:
+        db: the derep_db of rank 0
+        owner: the process hosting the slots
+        slots_per_rank: the number of slots hosted by each process
+        table_win: the window of the table, in a passive target epoch
+        arena_win: the window of the arenas, in a passive target epoch
+        my_rank: process rank
+*/
+void _materialize_slots(derep_db* db, int owner, long slots_per_rank, MPI_Win table_win,
+                        MPI_Win arena_win, int my_rank){
+    long i;
+    long first;
+    int64_t* slots = (int64_t*) malloc(sizeof(int64_t) * SLOT_WORDS * RMA_BATCH);
+    rma_chain* chains = (rma_chain*) malloc(sizeof(rma_chain) * RMA_BATCH);
+    rma_block* headers = (rma_block*) malloc(sizeof(rma_block) * RMA_BATCH);
+    char** bodies = (char**) calloc(RMA_BATCH, sizeof(char*));
+    int* with_sequence = (int*) malloc(sizeof(int) * RMA_BATCH);
+    for(first = 0; first < slots_per_rank; first += RMA_BATCH){
+        long size = (slots_per_rank - first < RMA_BATCH) ? slots_per_rank - first : RMA_BATCH;
+        long active = 0;
+        MPI_Get(slots, size * SLOT_WORDS, MPI_INT64_T, owner, first * SLOT_WORDS,
+                size * SLOT_WORDS, MPI_INT64_T, table_win);
+        MPI_Win_flush(owner, table_win);
+        if(owner != my_rank)
+            STATS_ADD(bytes_recv, sizeof(int64_t) * SLOT_WORDS * size);
+        // A chain per claimed slot
+        for(i = 0; i < size; i++){
+            if(slots[i * SLOT_WORDS + SLOT_KEY] == 0)
+                continue;
+            chains[active].pointer = slots[i * SLOT_WORDS + SLOT_HEAD];
+            chains[active].r = NULL;
+            ++active;
+        }
+        while(active > 0){
+            long done = 0;
+            // Read the headers of the current blocks
+            for(i = 0; i < active; i++){
+                int64_t pointer = chains[i].pointer - 1;
+                MPI_Get(&headers[i], sizeof(rma_block), MPI_BYTE, pointer >> OFFSET_BITS,
+                        pointer & OFFSET_MASK, sizeof(rma_block), MPI_BYTE, arena_win);
+            }
+            MPI_Win_flush_all(arena_win);
+            // Read their labels, and their sequence if the chain changes
+            for(i = 0; i < active; i++){
+                int64_t pointer = chains[i].pointer - 1;
+                int rank = pointer >> OFFSET_BITS;
+                rma_block* h = &headers[i];
+                with_sequence[i] = chains[i].r == NULL || h->check != chains[i].check || h->length != chains[i].length;
+                int bytes = h->labels_bytes + (with_sequence[i] ? h->length : 0);
+                bodies[i] = (char*) realloc(bodies[i], bytes + 1);
+                if(bytes > 0)
+                    MPI_Get(bodies[i], bytes, MPI_BYTE, rank, (pointer & OFFSET_MASK) + sizeof(rma_block),
+                            bytes, MPI_BYTE, arena_win);
+                if(rank != my_rank)
+                    STATS_ADD(bytes_recv, sizeof(rma_block) + bytes);
+            }
+            MPI_Win_flush_all(arena_win);
+            for(i = 0; i < active; i++){
+                _add_block(db, &chains[i], &headers[i], bodies[i], with_sequence[i]);
+                chains[i].pointer = headers[i].next;
+            }
+            // Keep the unfinished chains at the front, with their buffers
+            for(i = 0; i < active; i++){
+                if(chains[i].pointer == 0)
+                    continue;
+                char* body = bodies[done];
+                bodies[done] = bodies[i];
+                bodies[i] = body;
+                chains[done++] = chains[i];
+            }
+            active = done;
+        }
+    }
+    for(i = 0; i < RMA_BATCH; i++)
+        free(bodies[i]);
+    free(bodies);
+    free(with_sequence);
+    free(headers);
+    free(chains);
+    free(slots);
+}
+
+/*
+    Builds the global de-replication table with MPI one-sided operations and
+    materializes it in the process with rank 0
+
+    Inputs:
+        db: the local derep_db - will be modified in place
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void rma_derep_db(derep_db* db, int my_rank, int comm_sz){
+    long i;
+    MPI_Win table_win;
+    MPI_Win arena_win;
+    int64_t* table;
+    long local_unique = db->unique;
+    // Move the local uniques to the arena
+    byte_buffer arena = {NULL, 0, 0};
+    rma_pending* pending = (rma_pending*) malloc(sizeof(rma_pending) * (local_unique + 1));
+    long n = _build_arena(db, &arena, pending);
+    // The probes never leave the process a fingerprint targets, so each
+    // slice is sized for the most loaded process, in the worst case: no
+    // sequence shared across processes
+    long* load = (long*) calloc(comm_sz, sizeof(long));
+    long* total_load = (long*) malloc(sizeof(long) * comm_sz);
+    for(i = 0; i < n; i++){
+        pending[i].target = pending[i].key % comm_sz;
+        ++load[pending[i].target];
+    }
+    MPI_Allreduce(load, total_load, comm_sz, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+    long max_load = 0;
+    for(i = 0; i < comm_sz; i++){
+        if(total_load[i] > max_load)
+            max_load = total_load[i];
+    }
+    free(load);
+    free(total_load);
+    long slots_per_rank = RMA_SLOTS_PER_UNIQUE * max_load + 1;
+    MPI_Aint table_size = slots_per_rank * SLOT_WORDS * sizeof(int64_t);
+    // Some Open MPI 4.1 releases crash on the atomics of osc/rdma when it
+    // runs them over the shared memory transport. When all the processes
+    // share a node, a shared window keeps them off that component.
+    int node_sz;
+    MPI_Comm node;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &node);
+    MPI_Comm_size(node, &node_sz);
+    MPI_Comm_free(&node);
+    if(node_sz == comm_sz){
+        MPI_Info info;
+        MPI_Info_create(&info);
+        // Each slice stays in the memory of the process hosting it
+        MPI_Info_set(info, "alloc_shared_noncontig", "true");
+        MPI_Win_allocate_shared(table_size, sizeof(int64_t), info, MPI_COMM_WORLD, &table, &table_win);
+        MPI_Info_free(&info);
+    }
+    else
+        MPI_Win_allocate(table_size, sizeof(int64_t), MPI_INFO_NULL, MPI_COMM_WORLD, &table, &table_win);
+    memset(table, 0, table_size);
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // Publish the blocks
+    MPI_Win_lock_all(0, table_win);
+    _publish_blocks(table_win, slots_per_rank, pending, n, &arena, my_rank, comm_sz);
+    MPI_Win_unlock_all(table_win);
+    free(pending);
+    // The arenas are complete (next pointers included): expose them
+    MPI_Win_create(arena.data, arena.size, 1, MPI_INFO_NULL, MPI_COMM_WORLD, &arena_win);
+    // Every process has published - the global view is complete
+    MPI_Barrier(MPI_COMM_WORLD);
+
+    // Total number of reads, for rank 0
+    int count = db->count;
+    MPI_Reduce(&count, &db->count, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    if(my_rank == 0){
+        // Walk the chains of the slots of every process
+        MPI_Win_lock_all(0, table_win);
+        MPI_Win_lock_all(0, arena_win);
+        for(i = 0; i < comm_sz; i++)
+            _materialize_slots(db, i, slots_per_rank, table_win, arena_win, my_rank);
+        MPI_Win_unlock_all(arena_win);
+        MPI_Win_unlock_all(table_win);
+    }
+    // Rank 0 is done reading the windows
+    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Win_free(&arena_win);
+    MPI_Win_free(&table_win);
+    free(arena.data);
+}
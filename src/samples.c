@@ -0,0 +1,135 @@
+#include <stdlib.h>
+#include <string.h>
+#include "samples.h"
+#include "uthash.h"
+
+typedef struct sample_entry_str {
+    char* name;
+    int id;
+    UT_hash_handle hh;
+} sample_entry;
+
+UT_icd sample_count_icd = {sizeof(sample_count), NULL, NULL, NULL};
+
+// Separator between the sample id and the read id ('\0' if unused)
+static char SAMPLE_SEP = '\0';
+// Interned sample names - by name and by id
+static sample_entry* SAMPLES_BY_NAME = NULL;
+static char** SAMPLE_NAMES = NULL;
+static int NUM_SAMPLES = 0;
+static int SAMPLES_CAPACITY = 0;
+
+/*
+    Sets the separator between the sample id and the read id in the
+    sequence labels
+
+    Inputs:
+        sep: the separator character - '\0' keeps all the labels
+*/
+void set_sample_separator(char sep){
+    SAMPLE_SEP = sep;
+}
+
+/*
+    Returns the current sample separator, '\0' if labels are kept
+*/
+char get_sample_separator(void){
+    return SAMPLE_SEP;
+}
+
+/*
+    Returns the integer id of the sample name, interning it if it has not
+    been seen before
+
+    Inputs:
+        name: the sample name
+        length: the length of the sample name
+*/
+int intern_sample(char* name, int length){
+    sample_entry* e;
+    HASH_FIND(hh, SAMPLES_BY_NAME, name, length, e);
+    if(e)
+        return e->id;
+    // New sample - add it to both indices
+    e = (sample_entry*) malloc(sizeof(sample_entry));
+    e->name = (char*) malloc(sizeof(char) * (length+1));
+    memcpy(e->name, name, length);
+    e->name[length] = '\0';
+    e->id = NUM_SAMPLES;
+    HASH_ADD_KEYPTR(hh, SAMPLES_BY_NAME, e->name, length, e);
+    if(NUM_SAMPLES == SAMPLES_CAPACITY){
+        SAMPLES_CAPACITY = SAMPLES_CAPACITY ? 2 * SAMPLES_CAPACITY : 64;
+        SAMPLE_NAMES = (char**) realloc(SAMPLE_NAMES, sizeof(char*) * SAMPLES_CAPACITY);
+    }
+    SAMPLE_NAMES[NUM_SAMPLES] = e->name;
+    return NUM_SAMPLES++;
+}
+
+/*
+    Returns the integer id of the sample of label, interning the sample name
+    if it has not been seen before
+
+    Inputs:
+        label: the sequence label
+*/
+int intern_sample_label(char* label){
+    char* sep = strrchr(label, SAMPLE_SEP);
+    int length = sep ? (int)(sep - label) : (int) strlen(label);
+    return intern_sample(label, length);
+}
+
+/*
+    Returns the name of the sample with id `id`
+*/
+char* get_sample_name(int id){
+    return SAMPLE_NAMES[id];
+}
+
+/*
+    Returns the number of samples interned by this process
+*/
+int get_num_samples(void){
+    return NUM_SAMPLES;
+}
+
+/*
+    Adds `count` reads of sample `sample` to the sparse list samples
+
+    Inputs:
+        samples: utarray of sample_count
+        sample: the sample id
+        count: the number of reads to add
+
+    Returns 1 if a new pair was added to the list, 0 otherwise
+*/
+int add_sample_count(UT_array* samples, int sample, int count){
+    int lo = 0;
+    int hi = utarray_len(samples);
+    sample_count* pairs = (sample_count*) samples->d;
+    // Reads of a sample usually come together - check the last pair first
+    if(hi > 0 && pairs[hi-1].sample == sample){
+        pairs[hi-1].count += count;
+        return 0;
+    }
+    // Binary search of the sample
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(pairs[mid].sample < sample)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo < (int) utarray_len(samples) && pairs[lo].sample == sample){
+        pairs[lo].count += count;
+        return 0;
+    }
+    // New sample for this sequence - keep the list sorted
+    sample_count pair;
+    pair.sample = sample;
+    pair.count = count;
+    if(lo == (int) utarray_len(samples))
+        utarray_push_back(samples, &pair);
+    else
+        utarray_insert(samples, &pair, lo);
+    return 1;
+}
@@ -1,13 +1,110 @@
 #include "sequence.h"
 #include "util.h"
+#include "stats.h"
 #include <stdlib.h>
 #include <string.h>
+#include <emmintrin.h>
 
 #define BUFFER_SIZE 2000 * sizeof(char)
 
 // Global variable used to read by idx
 int CURR_SEQ = 0;
 
+// Whether the sequences are normalized while reading
+static int NORMALIZE = 1;
+// Whether the non-IUPAC characters are rejected
+static int STRICT_IUPAC = 0;
+
+/*
+    Sets whether the sequences are normalized while reading
+
+    Inputs:
+        normalize: 1 to normalize the sequences, 0 to keep them as they are
+*/
+void set_normalize(int normalize){
+    NORMALIZE = normalize;
+}
+
+/*
+    Sets whether the normalized sequences are also checked against the
+    IUPAC codes
+
+    Inputs:
+        strict: 1 to reject the non-IUPAC characters, 0 to keep them
+*/
+void set_strict_iupac(int strict){
+    STRICT_IUPAC = strict;
+}
+
+/*
+    Returns 1 if c is an (uppercase) IUPAC nucleotide code, 0 otherwise
+*/
+int _is_iupac(char c){
+    return c != '\0' && strchr("ACGTNRYKMSWBDHV", c) != NULL;
+}
+
+/*
+    Normalizes the `length` characters of sequence in place: lowercase
+    letters are uppercased and 'U' is mapped to 'T'. Each block of 16
+    characters is processed with SSE2 instructions; when strict, blocks
+    with anything other than A, C, G, T or N are checked against the IUPAC
+    codes one by one.
+
+    Inputs:
+        sequence: the sequence string
+        length: the number of characters of the sequence
+        strict: 1 to check the characters, 0 to keep them as they are
+
+    Returns the position of the first invalid character, or -1 if all the
+    characters are valid or the sequence is not checked
+*/
+int normalize_sequence(char* sequence, int length, int strict){
+    int i;
+    int j;
+    const __m128i before_a = _mm_set1_epi8('a' - 1);
+    const __m128i after_z = _mm_set1_epi8('z' + 1);
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i u = _mm_set1_epi8('U');
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i a = _mm_set1_epi8('A');
+    const __m128i c = _mm_set1_epi8('C');
+    const __m128i g = _mm_set1_epi8('G');
+    const __m128i t = _mm_set1_epi8('T');
+    const __m128i n = _mm_set1_epi8('N');
+    for(i = 0; i + 16 <= length; i += 16){
+        __m128i v = _mm_loadu_si128((__m128i*) (sequence + i));
+        // Uppercase: clear the case bit of a-z
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmplt_epi8(v, after_z));
+        v = _mm_sub_epi8(v, _mm_and_si128(lower, case_bit));
+        // U -> T
+        v = _mm_sub_epi8(v, _mm_and_si128(_mm_cmpeq_epi8(v, u), one));
+        _mm_storeu_si128((__m128i*) (sequence + i), v);
+        if(!strict)
+            continue;
+        // Fast check for the usual alphabet
+        __m128i valid = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, a), _mm_cmpeq_epi8(v, c)),
+                                     _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, g), _mm_cmpeq_epi8(v, t)),
+                                                  _mm_cmpeq_epi8(v, n)));
+        if(_mm_movemask_epi8(valid) != 0xFFFF){
+            // Ambiguity codes are fine, anything else is an error
+            for(j = i; j < i + 16; j++){
+                if(!_is_iupac(sequence[j]))
+                    return j;
+            }
+        }
+    }
+    // Remaining characters
+    for(; i < length; i++){
+        if(sequence[i] >= 'a' && sequence[i] <= 'z')
+            sequence[i] -= 0x20;
+        if(sequence[i] == 'U')
+            sequence[i] = 'T';
+        if(strict && !_is_iupac(sequence[i]))
+            return i;
+    }
+    return -1;
+}
+
 /*
     Allocates the memory for a new sequence structure
 
@@ -19,6 +116,7 @@ sequence* new_sequence(){
     // Initialize all pointers to NULL
     seq->label = NULL;
     seq->sequence = NULL;
+    seq->quality = NULL;
     // Initialize all lengths to 0
     seq->label_length = 0;
     seq->seq_length = 0;
@@ -26,35 +124,75 @@ sequence* new_sequence(){
 }
 
 /*
-    Reads the next sequence present in the file pointed by fd
+    Line reader of the FILE* inputs: reads the next line of the file
+    `source` into buffer
+
+    Returns buffer or NULL at the end of the file
+*/
+char* _file_line(void* source, char* buffer){
+    FILE* fd = (FILE*) source;
+    char* ret = fgets(buffer, BUFFER_SIZE, fd);
+    // Check if there has been an error while reading the file
+    // or we simply have reach the end of the file
+    if(ret == NULL && ferror(fd))
+        error_handler(FATAL_ERROR, "Error reading the FASTA file");
+    return ret;
+}
+
+/*
+    Line reader of the streamed inputs: copies the next line of the stream
+    `source` into buffer, as fgets would
+
+    Returns buffer or NULL at the end of the stream
+*/
+char* _stream_line(void* source, char* buffer){
+    size_t length;
+    char* line = stream_getline((stream*) source, &length);
+    if(line == NULL)
+        return NULL;
+    if(length >= BUFFER_SIZE)
+        error_handler(FATAL_ERROR, "Line longer than %d characters in the input", (int) BUFFER_SIZE - 1);
+    memcpy(buffer, line, length);
+    buffer[length] = '\0';
+    return buffer;
+}
+
+/*
+    Reads the next FASTA or FASTQ record from source, whose lines are read
+    with next_line
+
+    Inputs:
+        source: the input the lines are read from
+        next_line: function that reads the next line of source into a
+            buffer of BUFFER_SIZE characters, returning NULL at its end
 
     Returns a pointer to the read sequence structure or NULL if no
-    more sequences are present on the file
+    more sequences are present on the input
 */
-sequence* read_sequence(FILE *fd){
+sequence* _read_record(void* source, char* (*next_line)(void*, char*)){
     char* ret;
     // Allocate memory for reading buffer
     char* buffer = (char*) malloc(BUFFER_SIZE);
     
     // Read sequence label
-    ret = fgets(buffer, BUFFER_SIZE, fd);
+    ret = next_line(source, buffer);
     if(ret == NULL){
         // Free allocated memory
         free(buffer);
-        // Check if there has been an error while reading the FASTA
-        // file or we simply have reach the end of the file
-        if(feof(fd) == 0)
-            // An error occurred, terminate execution
-            error_handler(FATAL_ERROR, "Error reading the FASTA file");
+        // We simply have reached the end of the input
         return NULL;
     }
     
+    // Account for the label line
+    STATS_ADD(bytes_read, strlen(buffer));
     // Allocate memory for sequence
     sequence* seq = (sequence*) malloc(sizeof(sequence));
     // Allocate memory for label scanning
     char* label_buffer = (char*) malloc(BUFFER_SIZE);
+    // FASTQ records start with '@', FASTA records with '>'
+    bool fastq = (buffer[0] == '@');
     // Scan the label
-    if(sscanf(buffer, ">%s%*s", label_buffer) != 1){
+    if((buffer[0] != '>' && !fastq) || sscanf(buffer + 1, "%s%*s", label_buffer) != 1){
         // Free allocated memory
         free(buffer);
         free(label_buffer);
@@ -71,7 +209,7 @@ sequence* read_sequence(FILE *fd){
     free(label_buffer);
 
     // Read sequence
-    ret = fgets(buffer, BUFFER_SIZE, fd);
+    ret = next_line(source, buffer);
     if(ret == NULL){
         // Free allocated memory
         free(buffer);
@@ -85,12 +223,42 @@ sequence* read_sequence(FILE *fd){
     // Set the sequence info in the sequence struct
     // fgets puts the \n character also in the buffer,
     // so the real sequence length is strlen(buffer) - 1
-    seq->seq_length = strlen(buffer) - 1;
+    int line_length = strlen(buffer);
+    seq->seq_length = line_length - 1;
+    // Lines edited on Windows end in \r\n
+    if(NORMALIZE && seq->seq_length > 0 && buffer[seq->seq_length - 1] == '\r')
+        --seq->seq_length;
+    if(NORMALIZE){
+        int invalid = normalize_sequence(buffer, seq->seq_length, STRICT_IUPAC);
+        if(invalid >= 0)
+            error_handler(FATAL_ERROR, "Invalid character '%c' at position %d of sequence %s", buffer[invalid], invalid, seq->label);
+    }
     // seq->sequence = (char*) malloc(sizeof(char) * (seq->seq_length+1));
     posix_memalign((void **) &seq->sequence, 16, sizeof(char) * (seq->seq_length+1));
     memcpy(seq->sequence, buffer, seq->seq_length);
     seq->sequence[seq->seq_length] = '\0';
+    // Account for the sequence line
+    STATS_ADD(bytes_read, line_length);
 
+    seq->quality = NULL;
+    if(fastq){
+        // Skip the '+' separator line
+        ret = next_line(source, buffer);
+        if(ret == NULL || buffer[0] != '+')
+            error_handler(FATAL_ERROR, "Error reading the separator of sequence %d from the FASTQ file", CURR_SEQ);
+        STATS_ADD(bytes_read, strlen(buffer));
+        // Read the quality string, one character per base
+        ret = next_line(source, buffer);
+        if(ret == NULL || (int) strcspn(buffer, NORMALIZE ? "\r\n" : "\n") != seq->seq_length)
+            error_handler(FATAL_ERROR, "Error reading the quality of sequence %d from the FASTQ file", CURR_SEQ);
+        seq->quality = (char*) malloc(sizeof(char) * (seq->seq_length+1));
+        memcpy(seq->quality, buffer, seq->seq_length);
+        seq->quality[seq->seq_length] = '\0';
+        STATS_ADD(bytes_read, strlen(buffer));
+    }
+
+    // Account for the record
+    STATS_ADD(reads, 1);
     // Free reading buffer memory
     free(buffer);
     // Update CURR_SEQ, as we have read a sequence
@@ -99,6 +267,27 @@ sequence* read_sequence(FILE *fd){
     return seq;
 }
 
+/*
+    Reads the next sequence present in the file pointed by fd. Both FASTA
+    and FASTQ records are accepted.
+
+    Returns a pointer to the read sequence structure or NULL if no
+    more sequences are present on the file
+*/
+sequence* read_sequence(FILE *fd){
+    return _read_record(fd, _file_line);
+}
+
+/*
+    Reads the next sequence present in the stream s
+
+    Returns a pointer to the read sequence structure or NULL if no
+    more sequences are present on the stream
+*/
+sequence* read_stream_sequence(stream* s){
+    return _read_record(s, _stream_line);
+}
+
 /*
     Reads the sequence number `idx` present in the file pointed by fd
 
@@ -113,6 +302,9 @@ sequence* read_sequence_by_idx(FILE *fd, int idx){
     sequence* seq;
     do{
         seq = read_sequence(fd);
+        // Sequences before idx are skipped
+        if(CURR_SEQ <= idx && seq != NULL)
+            free_sequence(seq);
     } while(CURR_SEQ <= idx && seq != NULL);
     // Return the sequence to read
     return seq;
@@ -132,6 +324,7 @@ void write_sequence(sequence* seq, FILE* fd){
 void free_sequence(sequence* seq){
     free(seq->label);
     free(seq->sequence);
+    free(seq->quality);
     free(seq);
 }
 
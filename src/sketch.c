@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include <emmintrin.h>
+#include <math.h>
+#include "mpi.h"
+#include "sketch.h"
+#include "hash.h"
+
+// Seed of the k-mer hash function
+#define SKETCH_SEED 0x5eed5eed5eed5eedULL
+
+// Nucleotide codes - anything that is not ACGT(U) breaks the k-mers
+static const unsigned char SKETCH_CODE[256] = {
+    ['A'] = 1, ['C'] = 2, ['G'] = 3, ['T'] = 4, ['U'] = 4,
+    ['a'] = 1, ['c'] = 2, ['g'] = 3, ['t'] = 4, ['u'] = 4
+};
+
+/*
+    Computes the one-permutation MinHash sketch of sequence
+
+    Inputs:
+        sequence: the sequence string
+        sketch: output parameter - array of SKETCH_SIZE values, 16-byte aligned
+*/
+void compute_sketch(char* sequence, uint16_t* sketch){
+    int i;
+    int valid = 0;
+    uint64_t kmer = 0;
+    uint64_t mask = (1ULL << (2 * SKETCH_K)) - 1;
+    // All the bins start empty
+    for(i = 0; i < SKETCH_SIZE; i++)
+        sketch[i] = SKETCH_EMPTY;
+    // Roll the k-mer through the sequence
+    for(i = 0; sequence[i] != '\0'; i++){
+        unsigned char code = SKETCH_CODE[(unsigned char)sequence[i]];
+        if(!code){
+            // Unknown base - start over after it
+            valid = 0;
+            kmer = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | (code - 1)) & mask;
+        if(++valid < SKETCH_K)
+            continue;
+        // The high bits of the hash choose the bin, the low bits are the value
+        uint64_t h = mix64(kmer ^ SKETCH_SEED);
+        int bin = (int)((h >> 32) % SKETCH_SIZE);
+        uint16_t value = (uint16_t)h;
+        if(value == SKETCH_EMPTY)
+            --value;
+        if(value < sketch[bin])
+            sketch[bin] = value;
+    }
+}
+
+/*
+    Estimates the Jaccard similarity between the k-mer sets of two sequences
+    from their sketches
+
+    Inputs:
+        a, b: the sketches to compare, 16-byte aligned
+
+    Returns the estimated Jaccard similarity, in [0, 1]
+*/
+float sketch_jaccard(uint16_t* a, uint16_t* b){
+    int i;
+    int matches = 0;
+    int both_empty = 0;
+    __m128i empty = _mm_set1_epi16((short)SKETCH_EMPTY);
+    for(i = 0; i < SKETCH_SIZE; i += 8){
+        __m128i va = _mm_load_si128((__m128i*) &a[i]);
+        __m128i vb = _mm_load_si128((__m128i*) &b[i]);
+        __m128i empty_a = _mm_cmpeq_epi16(va, empty);
+        __m128i empty_b = _mm_cmpeq_epi16(vb, empty);
+        // Bins holding the same minimum in both sketches
+        __m128i equal = _mm_andnot_si128(empty_a, _mm_cmpeq_epi16(va, vb));
+        // movemask gives 2 bits per 16-bit lane
+        matches += __builtin_popcount(_mm_movemask_epi8(equal));
+        both_empty += __builtin_popcount(_mm_movemask_epi8(_mm_and_si128(empty_a, empty_b)));
+    }
+    int used = SKETCH_SIZE - both_empty / 2;
+    if(used == 0)
+        return 0.0f;
+    return (float)(matches / 2) / used;
+}
+
+/*
+    Computes the Jaccard similarity expected between the k-mer sets of two
+    sequences with the given identity
+
+    Inputs:
+        identity: the sequence identity, in [0, 1]
+
+    Returns the expected Jaccard similarity
+*/
+float sketch_jaccard_threshold(float identity){
+    // Probability of a k-mer not being hit by any difference
+    float shared = powf(identity, SKETCH_K);
+    return shared / (2.0f - shared);
+}
+
+/*
+    Collects the sketches of the uniques in a contiguous array
+
+    Inputs:
+        uniques: array of pointers to the seq_replicas structures
+        n: the number of uniques
+
+    Returns a pointer to an array of n * SKETCH_SIZE values
+*/
+uint16_t* collect_sketches(seq_replicas** uniques, int n){
+    int i;
+    uint16_t* sketches = NULL;
+    posix_memalign((void **) &sketches, 16, sizeof(uint16_t) * SKETCH_SIZE * ((size_t) n + 1));
+    for(i = 0; i < n; i++){
+        if(!uniques[i]->sketch)
+            sketch_seq_replica(uniques[i]);
+        memcpy(&sketches[(size_t) i * SKETCH_SIZE], uniques[i]->sketch, sizeof(uint16_t) * SKETCH_SIZE);
+    }
+    return sketches;
+}
+
+/*
+    Broadcasts an array of sketches from process root to all the processes
+
+    Inputs:
+        sketches: in/out parameter - the array of sketches
+        num_sketches: in/out parameter - the number of sketches in the array
+        root: the rank of the process that holds the sketches
+*/
+void bcast_sketches(uint16_t** sketches, int* num_sketches, int root){
+    int my_rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+    // Let everybody know how many sketches are coming
+    MPI_Bcast(num_sketches, 1, MPI_INT, root, MPI_COMM_WORLD);
+    if(my_rank != root)
+        posix_memalign((void **) sketches, 16, sizeof(uint16_t) * SKETCH_SIZE * ((size_t) *num_sketches + 1));
+    // In pieces, as the MPI counts are ints
+    int first;
+    for(first = 0; first < *num_sketches; first += SKETCH_BCAST_PIECE){
+        int piece = (*num_sketches - first < SKETCH_BCAST_PIECE) ? *num_sketches - first : SKETCH_BCAST_PIECE;
+        MPI_Bcast(*sketches + (size_t) first * SKETCH_SIZE, piece * SKETCH_SIZE, MPI_UNSIGNED_SHORT,
+                  root, MPI_COMM_WORLD);
+    }
+}
@@ -0,0 +1,619 @@
+#include <stdlib.h>
+#include <string.h>
+#include "mpi.h"
+#include "sort_derep.h"
+#include "hash.h"
+#include "stats.h"
+#include "util.h"
+
+// Seed of the sort key fingerprint
+#define SORT_SEED 0x50e7ed5eedULL
+// Bits of key consumed per radix pass
+#define RADIX_BITS 16
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+/************************************
+ *     Sorted uniques functions     *
+************************************/
+
+/*
+    Creates a new empty sorted_uniques structure able to hold `capacity`
+    uniques without growing
+*/
+sorted_uniques* _create_sorted_uniques(int capacity){
+    sorted_uniques* u = (sorted_uniques*) malloc(sizeof(sorted_uniques));
+    u->num = 0;
+    u->capacity = capacity > 0 ? capacity : 16;
+    u->keys = (uint64_t*) malloc(sizeof(uint64_t) * u->capacity);
+    u->seqs = (seq_replicas**) malloc(sizeof(seq_replicas*) * u->capacity);
+    return u;
+}
+
+/*
+    Destroys the sorted_uniques structure u - the replicas are not freed
+*/
+void _destroy_sorted_uniques(sorted_uniques* u){
+    free(u->keys);
+    free(u->seqs);
+    free(u);
+}
+
+/*
+    Appends the replica r with key `key` at the end of u
+*/
+void _push_unique(sorted_uniques* u, uint64_t key, seq_replicas* r){
+    if(u->num == u->capacity){
+        u->capacity *= 2;
+        u->keys = (uint64_t*) realloc(u->keys, sizeof(uint64_t) * u->capacity);
+        u->seqs = (seq_replicas**) realloc(u->seqs, sizeof(seq_replicas*) * u->capacity);
+    }
+    u->keys[u->num] = key;
+    u->seqs[u->num] = r;
+    ++u->num;
+}
+
+/*
+    Compares two uniques by (key, sequence)
+
+    Returns:
+        -# if a goes before b
+        0 if a == b
+        +# if a goes after b
+*/
+int _compare_uniques(uint64_t key_a, char* seq_a, uint64_t key_b, char* seq_b){
+    if(key_a != key_b)
+        return key_a < key_b ? -1 : 1;
+    return strcmp(seq_a, seq_b);
+}
+
+/*
+    Moves the labels of the replica from into the replica to and destroys from
+*/
+void _absorb_replica(seq_replicas* to, seq_replicas* from){
+    char** label = NULL;
+    while((label=(char**)utarray_next(from->labels, label)))
+        add_replica(to, *label);
+    destroy_seq_replica(from);
+}
+
+/*
+    Merges the sorted runs `runs` into a single sorted_uniques structure,
+    collapsing the replicas of the same sequence. The runs are destroyed.
+
+    Inputs:
+        runs: array of sorted_uniques structures, each sorted by (key, sequence)
+        num_runs: the number of runs
+
+    Returns the merged sorted_uniques structure
+*/
+sorted_uniques* _merge_runs(sorted_uniques** runs, int num_runs){
+    int i;
+    int total = 0;
+    for(i = 0; i < num_runs; i++)
+        total += runs[i]->num;
+    sorted_uniques* merged = _create_sorted_uniques(total);
+    int* pos = (int*) calloc(num_runs, sizeof(int));
+    // Binary min-heap of run indices, ordered by their current head
+    int* heap = (int*) malloc(sizeof(int) * (num_runs + 1));
+    int heap_size = 0;
+    for(i = 0; i < num_runs; i++){
+        if(runs[i]->num == 0)
+            continue;
+        // Sift up the new run
+        int child = heap_size++;
+        while(child > 0){
+            int parent = (child - 1) / 2;
+            int p = heap[parent];
+            if(_compare_uniques(runs[i]->keys[0], runs[i]->seqs[0]->sequence,
+                                runs[p]->keys[pos[p]], runs[p]->seqs[pos[p]]->sequence) >= 0)
+                break;
+            heap[child] = p;
+            child = parent;
+        }
+        heap[child] = i;
+    }
+    while(heap_size > 0){
+        // Pop the smallest head
+        int r = heap[0];
+        uint64_t key = runs[r]->keys[pos[r]];
+        seq_replicas* head = runs[r]->seqs[pos[r]];
+        ++pos[r];
+        // Collapse it with the last merged unique if it is the same sequence
+        if(merged->num > 0 && merged->keys[merged->num-1] == key &&
+           strcmp(merged->seqs[merged->num-1]->sequence, head->sequence) == 0)
+            _absorb_replica(merged->seqs[merged->num-1], head);
+        else
+            _push_unique(merged, key, head);
+        // Put the run back in the heap if it still has uniques
+        if(pos[r] == runs[r]->num)
+            r = heap[--heap_size];
+        if(heap_size == 0)
+            break;
+        // Sift down
+        int parent = 0;
+        while(1){
+            int child = 2 * parent + 1;
+            if(child >= heap_size)
+                break;
+            if(child + 1 < heap_size &&
+               _compare_uniques(runs[heap[child+1]]->keys[pos[heap[child+1]]], runs[heap[child+1]]->seqs[pos[heap[child+1]]]->sequence,
+                                runs[heap[child]]->keys[pos[heap[child]]], runs[heap[child]]->seqs[pos[heap[child]]]->sequence) < 0)
+                ++child;
+            if(_compare_uniques(runs[heap[child]]->keys[pos[heap[child]]], runs[heap[child]]->seqs[pos[heap[child]]]->sequence,
+                                runs[r]->keys[pos[r]], runs[r]->seqs[pos[r]]->sequence) >= 0)
+                break;
+            heap[parent] = heap[child];
+            parent = child;
+        }
+        heap[parent] = r;
+    }
+    free(heap);
+    free(pos);
+    for(i = 0; i < num_runs; i++)
+        _destroy_sorted_uniques(runs[i]);
+    return merged;
+}
+
+/************************************
+ *      Batch sorting functions     *
+************************************/
+
+/*
+    Sorts the records by key with an LSD radix sort, RADIX_BITS per pass
+
+    Inputs:
+        records: the records to sort
+        scratch: array of at least n records used as temporary storage
+        n: the number of records
+
+    Returns a pointer to the array holding the sorted records (either
+    records or scratch)
+*/
+sort_record* _radix_sort_records(sort_record* records, sort_record* scratch, int n){
+    int i;
+    int shift;
+    int* counts = (int*) malloc(sizeof(int) * RADIX_SIZE);
+    for(shift = 0; shift < 64; shift += RADIX_BITS){
+        memset(counts, 0, sizeof(int) * RADIX_SIZE);
+        for(i = 0; i < n; i++)
+            ++counts[(records[i].key >> shift) & (RADIX_SIZE - 1)];
+        // Skip the pass if all the records share the digit
+        if(n == 0 || counts[(records[0].key >> shift) & (RADIX_SIZE - 1)] == n)
+            continue;
+        // Exclusive prefix sum
+        int sum = 0;
+        for(i = 0; i < RADIX_SIZE; i++){
+            int c = counts[i];
+            counts[i] = sum;
+            sum += c;
+        }
+        // Scatter - sequential reads, RADIX_SIZE sequential write streams
+        for(i = 0; i < n; i++)
+            scratch[counts[(records[i].key >> shift) & (RADIX_SIZE - 1)]++] = records[i];
+        sort_record* tmp = records;
+        records = scratch;
+        scratch = tmp;
+    }
+    free(counts);
+    return records;
+}
+
+/*
+    Auxiliary function that compares two records by sequence, for qsort
+*/
+int _compare_records(const void* a, const void* b){
+    return strcmp(((sort_record*)a)->sequence, ((sort_record*)b)->sequence);
+}
+
+/*
+    Sorts the buffered records of s and collapses the runs of equal
+    sequences into a sorted run of uniques, that is merged with the uniques
+    of s. The buffer is emptied.
+
+    Inputs:
+        s: pointer to the sort_derep structure
+*/
+void _flush_sort_batch(sort_derep* s){
+    int i;
+    int j;
+    int k;
+    if(s->num_records == 0)
+        return;
+    sort_record* sorted = _radix_sort_records(s->records, s->scratch, s->num_records);
+    sorted_uniques* batch = _create_sorted_uniques(s->num_records / 4);
+    for(i = 0; i < s->num_records; i = j){
+        // Find the run of records sharing the key
+        for(j = i + 1; j < s->num_records && sorted[j].key == sorted[i].key; j++);
+        // Fingerprint collisions are rare, but the sequences must be checked
+        for(k = i + 1; k < j && strcmp(sorted[k].sequence, sorted[i].sequence) == 0; k++);
+        if(k < j)
+            qsort(&sorted[i], j - i, sizeof(sort_record), _compare_records);
+        // Collapse the runs of equal sequences
+        seq_replicas* r = NULL;
+        for(k = i; k < j; k++){
+            if(r == NULL || strcmp(r->sequence, sorted[k].sequence) != 0){
+                r = create_empty_seq_replica(sorted[k].sequence, strlen(sorted[k].sequence));
+                _push_unique(batch, sorted[k].key, r);
+            }
+            add_replica(r, sorted[k].label);
+            free(sorted[k].sequence);
+            free(sorted[k].label);
+        }
+    }
+    s->num_records = 0;
+    // Merge the new run with the uniques found so far
+    sorted_uniques* runs[2] = {s->uniques, batch};
+    s->uniques = _merge_runs(runs, 2);
+}
+
+/************************************
+ *    Serialization of the uniques  *
+************************************/
+
+/*
+    Serializes the uniques of u in positions [first, last) at the end of b
+*/
+void _pack_uniques(sorted_uniques* u, int first, int last, byte_buffer* b){
+    int i;
+    int length;
+    char** label;
+    for(i = first; i < last; i++){
+        seq_replicas* r = u->seqs[i];
+        buffer_append(b, &u->keys[i], sizeof(uint64_t));
+        length = strlen(r->sequence);
+        buffer_append(b, &length, sizeof(int));
+        buffer_append(b, r->sequence, length);
+        buffer_append(b, &r->count, sizeof(int));
+        label = NULL;
+        while((label=(char**)utarray_next(r->labels, label))){
+            length = strlen(*label);
+            buffer_append(b, &length, sizeof(int));
+            buffer_append(b, *label, length);
+        }
+    }
+}
+
+/*
+    Deserializes `size` bytes of data produced by _pack_uniques
+
+    Returns a new sorted_uniques structure with the uniques
+*/
+sorted_uniques* _unpack_uniques(char* data, size_t size){
+    int i;
+    int length;
+    int count;
+    uint64_t key;
+    size_t pos = 0;
+    char* text = NULL;
+    int text_capacity = 0;
+    sorted_uniques* u = _create_sorted_uniques(16);
+    while(pos < size){
+        memcpy(&key, data + pos, sizeof(uint64_t));
+        pos += sizeof(uint64_t);
+        memcpy(&length, data + pos, sizeof(int));
+        pos += sizeof(int);
+        if(length + 1 > text_capacity){
+            text_capacity = 2 * (length + 1);
+            text = (char*) realloc(text, text_capacity);
+        }
+        memcpy(text, data + pos, length);
+        text[length] = '\0';
+        pos += length;
+        seq_replicas* r = create_empty_seq_replica(text, length);
+        memcpy(&count, data + pos, sizeof(int));
+        pos += sizeof(int);
+        for(i = 0; i < count; i++){
+            memcpy(&length, data + pos, sizeof(int));
+            pos += sizeof(int);
+            if(length + 1 > text_capacity){
+                text_capacity = 2 * (length + 1);
+                text = (char*) realloc(text, text_capacity);
+            }
+            memcpy(text, data + pos, length);
+            text[length] = '\0';
+            pos += length;
+            add_replica(r, text);
+        }
+        _push_unique(u, key, r);
+    }
+    free(text);
+    return u;
+}
+
+/*
+    Auxiliary structure and function to sort the uniques of a hash table
+*/
+typedef struct keyed_replica_str {
+    uint64_t key;
+    seq_replicas* r;
+} keyed_replica;
+
+int _compare_keyed(const void* a, const void* b){
+    keyed_replica* x = (keyed_replica*) a;
+    keyed_replica* y = (keyed_replica*) b;
+    return _compare_uniques(x->key, x->r->sequence, y->key, y->r->sequence);
+}
+
+/*
+    Moves the uniques of db into a new sorted_uniques structure sorted by
+    (key, sequence). db is left without uniques.
+*/
+sorted_uniques* _extract_sorted(derep_db* db){
+    int i = 0;
+    seq_replicas* current;
+    seq_replicas* tmp;
+    keyed_replica* keyed = (keyed_replica*) malloc(sizeof(keyed_replica) * (db->unique + 1));
+    HASH_ITER(hh, db->seqs, current, tmp){
+        keyed[i].key = sort_key(current->sequence, strlen(current->sequence));
+        keyed[i].r = current;
+        i++;
+    }
+    HASH_CLEAR(hh, db->seqs);
+    // Databases built by the sort engine are already in order
+    int j;
+    for(j = 1; j < i && _compare_keyed(&keyed[j-1], &keyed[j]) <= 0; j++);
+    if(j < i)
+        qsort(keyed, i, sizeof(keyed_replica), _compare_keyed);
+    sorted_uniques* u = _create_sorted_uniques(i);
+    for(j = 0; j < i; j++)
+        _push_unique(u, keyed[j].key, keyed[j].r);
+    free(keyed);
+    db->unique = 0;
+    db->bytes = 0;
+    return u;
+}
+
+/************************************
+ *         Public functions         *
+************************************/
+
+/*
+    Returns the sort key of sequence: a 64-bit fingerprint of the sequence
+
+    Inputs:
+        sequence: the sequence string
+        length: the length of the sequence
+*/
+uint64_t sort_key(char* sequence, int length){
+    return hash_bytes64(sequence, length, SORT_SEED);
+}
+
+/*
+    Creates a new sort-based de-replication engine
+
+    Returns:
+        the new sort_derep structure
+*/
+sort_derep* create_sort_derep(void){
+    sort_derep* s = (sort_derep*) malloc(sizeof(sort_derep));
+    s->count = 0;
+    s->num_records = 0;
+    s->records = (sort_record*) malloc(sizeof(sort_record) * SORT_BATCH_SIZE);
+    s->scratch = (sort_record*) malloc(sizeof(sort_record) * SORT_BATCH_SIZE);
+    s->uniques = _create_sorted_uniques(16);
+    return s;
+}
+
+/*
+    Adds the sequence seq to the sort-based de-replication engine s. The
+    engine takes ownership of seq.
+
+    Inputs:
+        s: pointer to the sort_derep structure
+        seq: pointer to the sequence structure
+*/
+void sort_derep_add(sort_derep* s, sequence* seq){
+    sort_record* record = &s->records[s->num_records++];
+    record->key = sort_key(seq->sequence, seq->seq_length);
+    // Keep the sequence and label strings, only the structure is freed
+    record->sequence = seq->sequence;
+    record->label = seq->label;
+    free(seq->quality);
+    free(seq);
+    ++s->count;
+    if(s->num_records == SORT_BATCH_SIZE)
+        _flush_sort_batch(s);
+}
+
+/*
+    Sorts the records still buffered in s and moves all the unique sequences
+    into db, in (key, sequence) order. The engine is destroyed.
+
+    Inputs:
+        s: pointer to the sort_derep structure
+        db: pointer to the derep_db structure that receives the uniques
+*/
+void finish_sort_derep(sort_derep* s, derep_db* db){
+    int i;
+    _flush_sort_batch(s);
+    // The hash table preserves the insertion order when iterated
+    for(i = 0; i < s->uniques->num; i++)
+        insert_seq_replica(db, s->uniques->seqs[i]);
+    db->count += s->count;
+    _destroy_sorted_uniques(s->uniques);
+    free(s->records);
+    free(s->scratch);
+    free(s);
+}
+
+/*
+    Sends send_size bytes of send to process dest while receiving recv_size
+    bytes from process source into recv, in pieces of at most SORT_PIECE
+    bytes
+
+    Inputs:
+        send: the bytes to send
+        send_size: the number of bytes to send
+        dest: the receiving process
+        recv: where to store the bytes received
+        recv_size: the number of bytes to receive
+        source: the sending process
+*/
+void _exchange_pieces(char* send, long send_size, int dest, char* recv, long recv_size, int source){
+    long offset;
+    int num_requests = 0;
+    // The two directions may take a different number of pieces
+    MPI_Request* requests = (MPI_Request*) malloc(sizeof(MPI_Request) *
+        ((send_size + SORT_PIECE - 1) / SORT_PIECE + (recv_size + SORT_PIECE - 1) / SORT_PIECE + 1));
+    for(offset = 0; offset < recv_size; offset += SORT_PIECE){
+        int piece = (recv_size - offset < SORT_PIECE) ? recv_size - offset : SORT_PIECE;
+        MPI_Irecv(recv + offset, piece, MPI_BYTE, source, 0, MPI_COMM_WORLD, &requests[num_requests++]);
+    }
+    for(offset = 0; offset < send_size; offset += SORT_PIECE){
+        int piece = (send_size - offset < SORT_PIECE) ? send_size - offset : SORT_PIECE;
+        MPI_Isend(send + offset, piece, MPI_BYTE, dest, 0, MPI_COMM_WORLD, &requests[num_requests++]);
+    }
+    MPI_Waitall(num_requests, requests, MPI_STATUSES_IGNORE);
+    free(requests);
+}
+
+/*
+    Collects the de-replication databases of all the processes in the
+    process with rank 0 using a parallel sample sort
+
+    Inputs:
+        db: the local derep_db - will be modified in place
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void sample_sort_derep_db(derep_db* db, int my_rank, int comm_sz){
+    int i;
+    int j;
+    if(comm_sz == 1)
+        return;
+    sorted_uniques* local = _extract_sorted(db);
+
+    // Regular sampling: comm_sz - 1 evenly spaced keys from every process
+    int num_samples = local->num > 0 ? comm_sz - 1 : 0;
+    uint64_t* samples = (uint64_t*) malloc(sizeof(uint64_t) * (comm_sz + 1));
+    for(i = 0; i < num_samples; i++)
+        samples[i] = local->keys[(long)(i + 1) * local->num / comm_sz];
+    int* sample_counts = (int*) malloc(sizeof(int) * comm_sz);
+    int* sample_displs = (int*) malloc(sizeof(int) * comm_sz);
+    MPI_Allgather(&num_samples, 1, MPI_INT, sample_counts, 1, MPI_INT, MPI_COMM_WORLD);
+    int total_samples = 0;
+    for(i = 0; i < comm_sz; i++){
+        sample_displs[i] = total_samples;
+        total_samples += sample_counts[i];
+    }
+    uint64_t* all_samples = (uint64_t*) malloc(sizeof(uint64_t) * (total_samples + 1));
+    MPI_Allgatherv(samples, num_samples, MPI_UINT64_T, all_samples, sample_counts,
+                   sample_displs, MPI_UINT64_T, MPI_COMM_WORLD);
+    // Sort the samples (insertion sort - there are comm_sz^2 at most)
+    for(i = 1; i < total_samples; i++){
+        uint64_t key = all_samples[i];
+        for(j = i; j > 0 && all_samples[j-1] > key; j--)
+            all_samples[j] = all_samples[j-1];
+        all_samples[j] = key;
+    }
+    // Pick the splitters: process p gets the keys in (splitter[p-1], splitter[p]]
+    uint64_t* splitters = (uint64_t*) malloc(sizeof(uint64_t) * comm_sz);
+    for(i = 0; i < comm_sz - 1; i++)
+        splitters[i] = total_samples ? all_samples[(long)(i + 1) * total_samples / comm_sz] : UINT64_MAX;
+    splitters[comm_sz - 1] = UINT64_MAX;
+
+    // Serialize each key range for its owner
+    byte_buffer send = {NULL, 0, 0};
+    long* send_counts = (long*) malloc(sizeof(long) * comm_sz);
+    long* send_displs = (long*) malloc(sizeof(long) * comm_sz);
+    int first = 0;
+    for(i = 0; i < comm_sz; i++){
+        int last = first;
+        while(last < local->num && local->keys[last] <= splitters[i])
+            ++last;
+        send_displs[i] = send.size;
+        _pack_uniques(local, first, last, &send);
+        send_counts[i] = send.size - send_displs[i];
+        for(j = first; j < last; j++)
+            destroy_seq_replica(local->seqs[j]);
+        first = last;
+    }
+    _destroy_sorted_uniques(local);
+
+    // Exchange the ranges. The sizes may pass the int counts and
+    // displacements of MPI_Alltoallv, so each pair of processes exchanges
+    // its ranges in pieces, pairing rank + step with rank - step
+    long* recv_counts = (long*) malloc(sizeof(long) * comm_sz);
+    long* recv_displs = (long*) malloc(sizeof(long) * comm_sz);
+    MPI_Alltoall(send_counts, 1, MPI_LONG, recv_counts, 1, MPI_LONG, MPI_COMM_WORLD);
+    size_t recv_size = 0;
+    for(i = 0; i < comm_sz; i++){
+        recv_displs[i] = recv_size;
+        recv_size += recv_counts[i];
+    }
+    char* recv = (char*) malloc(recv_size + 1);
+    memcpy(recv + recv_displs[my_rank], send.data + send_displs[my_rank], send_counts[my_rank]);
+    for(i = 1; i < comm_sz; i++){
+        int dest = (my_rank + i) % comm_sz;
+        int source = (my_rank - i + comm_sz) % comm_sz;
+        _exchange_pieces(send.data + send_displs[dest], send_counts[dest], dest,
+                         recv + recv_displs[source], recv_counts[source], source);
+    }
+    STATS_ADD(bytes_sent, send.size - send_counts[my_rank]);
+    STATS_ADD(bytes_recv, recv_size - recv_counts[my_rank]);
+    free(send.data);
+
+    // Merge the sorted runs received from every process
+    sorted_uniques** runs = (sorted_uniques**) malloc(sizeof(sorted_uniques*) * comm_sz);
+    for(i = 0; i < comm_sz; i++)
+        runs[i] = _unpack_uniques(recv + recv_displs[i], recv_counts[i]);
+    free(recv);
+    sorted_uniques* mine = _merge_runs(runs, comm_sz);
+    free(runs);
+
+    // The ranges are disjoint and ordered by rank, so rank 0 only has to
+    // concatenate them
+    send.data = NULL;
+    send.size = 0;
+    send.capacity = 0;
+    _pack_uniques(mine, 0, mine->num, &send);
+    for(i = 0; i < mine->num; i++)
+        destroy_seq_replica(mine->seqs[i]);
+    _destroy_sorted_uniques(mine);
+    long send_size = send.size;
+    MPI_Gather(&send_size, 1, MPI_LONG, recv_counts, 1, MPI_LONG, 0, MPI_COMM_WORLD);
+    recv = NULL;
+    if(my_rank == 0){
+        recv_size = 0;
+        for(i = 0; i < comm_sz; i++){
+            recv_displs[i] = recv_size;
+            recv_size += recv_counts[i];
+        }
+        recv = (char*) malloc(recv_size + 1);
+    }
+    // Past the int displacements of MPI_Gatherv too, so rank 0 receives
+    // each range in pieces
+    if(my_rank == 0){
+        memcpy(recv, send.data, send_size);
+        for(i = 1; i < comm_sz; i++)
+            _exchange_pieces(NULL, 0, 0, recv + recv_displs[i], recv_counts[i], i);
+    }
+    else
+        _exchange_pieces(send.data, send_size, 0, NULL, 0, 0);
+    free(send.data);
+    int count;
+    MPI_Reduce(&db->count, &count, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+    if(my_rank == 0){
+        STATS_ADD(bytes_recv, recv_size - recv_counts[0]);
+        sorted_uniques* all = _unpack_uniques(recv, recv_size);
+        for(i = 0; i < all->num; i++)
+            insert_seq_replica(db, all->seqs[i]);
+        _destroy_sorted_uniques(all);
+        free(recv);
+        db->count = count;
+    }
+    else{
+        STATS_ADD(bytes_sent, send_size);
+        db->count = 0;
+    }
+
+    free(samples);
+    free(sample_counts);
+    free(sample_displs);
+    free(all_samples);
+    free(splitters);
+    free(send_counts);
+    free(send_displs);
+    free(recv_counts);
+    free(recv_displs);
+}
@@ -0,0 +1,288 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "spill.h"
+#include "hash.h"
+#include "util.h"
+
+// Size of the stdio buffers used for the run files
+#define RUN_BUFFER_SIZE (1 << 20)
+
+/*
+    Builds the path of the run file for run `run` and partition `partition`
+
+    Inputs:
+        s: pointer to the spill structure
+        run: the run index
+        partition: the partition index
+        path: output parameter - buffer of at least 4096 chars
+*/
+void _run_path(spill* s, int run, int partition, char* path){
+    snprintf(path, 4096, "%s/pipeclust_spill.%d.%d.%d.%d",
+             s->dir, (int) getpid(), s->my_rank, run, partition);
+}
+
+/*
+    Returns the hash partition of the sequence string
+*/
+int _partition_of(char* sequence){
+    return (int)(hash_bytes64(sequence, strlen(sequence), 0) % SPILL_PARTITIONS);
+}
+
+/*
+    Auxiliary function that compares two seq_replicas pointers by sequence,
+    for qsort
+*/
+int _compare_sequences(const void* a, const void* b){
+    return strcmp((*(seq_replicas**)a)->sequence, (*(seq_replicas**)b)->sequence);
+}
+
+/*
+    Writes the replica r as a record of a run file
+
+    Inputs:
+        fd: the run file
+        r: pointer to the seq_replicas structure
+*/
+void _write_run_record(FILE* fd, seq_replicas* r){
+    char** label = NULL;
+    int length = strlen(r->sequence);
+    // Sequence length and sequence
+    fwrite(&length, sizeof(int), 1, fd);
+    fwrite(r->sequence, sizeof(char), length, fd);
+    // Number of labels and labels
+    fwrite(&r->count, sizeof(int), 1, fd);
+    while((label=(char**)utarray_next(r->labels, label))){
+        length = strlen(*label);
+        fwrite(&length, sizeof(int), 1, fd);
+        fwrite(*label, sizeof(char), length, fd);
+    }
+}
+
+/*
+    Reads the next record of a run file
+
+    Inputs:
+        fd: the run file
+
+    Returns a new seq_replicas structure with the record or NULL if there
+    are no more records in the file
+*/
+seq_replicas* _read_run_record(FILE* fd){
+    int i;
+    int length;
+    int num_labels;
+    if(fread(&length, sizeof(int), 1, fd) != 1)
+        return NULL;
+    char* buffer = (char*) malloc(sizeof(char) * (length+1));
+    if(fread(buffer, sizeof(char), length, fd) != (size_t) length)
+        error_handler(FATAL_ERROR, "Truncated spill run file");
+    buffer[length] = '\0';
+    seq_replicas* r = create_empty_seq_replica(buffer, length);
+    if(fread(&num_labels, sizeof(int), 1, fd) != 1)
+        error_handler(FATAL_ERROR, "Truncated spill run file");
+    for(i = 0; i < num_labels; i++){
+        if(fread(&length, sizeof(int), 1, fd) != 1)
+            error_handler(FATAL_ERROR, "Truncated spill run file");
+        buffer = (char*) realloc(buffer, sizeof(char) * (length+1));
+        if(fread(buffer, sizeof(char), length, fd) != (size_t) length)
+            error_handler(FATAL_ERROR, "Truncated spill run file");
+        buffer[length] = '\0';
+        add_replica(r, buffer);
+    }
+    free(buffer);
+    return r;
+}
+
+/*
+    Moves the labels of the replica from into the replica to and destroys from
+
+    Inputs:
+        to: pointer to the seq_replicas structure that receives the labels
+        from: pointer to the seq_replicas structure to merge
+*/
+void _merge_replicas(seq_replicas* to, seq_replicas* from){
+    char** label = NULL;
+    while((label=(char**)utarray_next(from->labels, label)))
+        add_replica(to, *label);
+    destroy_seq_replica(from);
+}
+
+/*
+    Creates a new spill area for the de-replication tables of this process
+
+    Inputs:
+        dir: directory where the runs are written
+        my_rank: process rank, used to name the run files
+
+    Returns:
+        the new spill structure
+*/
+spill* create_spill(char* dir, int my_rank){
+    spill* s = (spill*) malloc(sizeof(spill));
+    s->dir = dir;
+    s->my_rank = my_rank;
+    s->num_runs = 0;
+    return s;
+}
+
+/*
+    Destroys the spill area s, removing all its run files
+
+    Inputs:
+        s: pointer to the spill structure to destroy
+*/
+void destroy_spill(spill* s){
+    int run;
+    int partition;
+    char path[4096];
+    for(run = 0; run < s->num_runs; run++){
+        for(partition = 0; partition < SPILL_PARTITIONS; partition++){
+            _run_path(s, run, partition, path);
+            unlink(path);
+        }
+    }
+    free(s);
+}
+
+/*
+    Writes the contents of the de-replication database db to disk as a new
+    run of SPILL_PARTITIONS files, one per hash partition, with the records
+    sorted by sequence
+
+    Inputs:
+        s: pointer to the spill structure
+        db: pointer to the derep_db structure to spill
+*/
+void spill_derep_db(spill* s, derep_db* db){
+    int i;
+    int partition;
+    int starts[SPILL_PARTITIONS + 1];
+    char path[4096];
+    seq_replicas* current;
+    seq_replicas* tmp;
+    // Bucket the replicas by partition (counting sort)
+    memset(starts, 0, sizeof(starts));
+    HASH_ITER(hh, db->seqs, current, tmp)
+        ++starts[_partition_of(current->sequence) + 1];
+    for(partition = 0; partition < SPILL_PARTITIONS; partition++)
+        starts[partition+1] += starts[partition];
+    seq_replicas** replicas = (seq_replicas**) malloc(sizeof(seq_replicas*) * (db->unique + 1));
+    int fill[SPILL_PARTITIONS];
+    memcpy(fill, starts, sizeof(fill));
+    HASH_ITER(hh, db->seqs, current, tmp)
+        replicas[fill[_partition_of(current->sequence)]++] = current;
+    // The hash table is no longer needed, the replicas are held in the array
+    HASH_CLEAR(hh, db->seqs);
+    // Write each partition sorted by sequence
+    char* io_buffer = (char*) malloc(RUN_BUFFER_SIZE);
+    for(partition = 0; partition < SPILL_PARTITIONS; partition++){
+        int n = starts[partition+1] - starts[partition];
+        qsort(&replicas[starts[partition]], n, sizeof(seq_replicas*), _compare_sequences);
+        _run_path(s, s->num_runs, partition, path);
+        FILE* fd = fopen(path, "wb");
+        if(fd == NULL)
+            error_handler(FATAL_ERROR, "Error opening spill file %s", path);
+        setvbuf(fd, io_buffer, _IOFBF, RUN_BUFFER_SIZE);
+        for(i = starts[partition]; i < starts[partition+1]; i++){
+            _write_run_record(fd, replicas[i]);
+            destroy_seq_replica(replicas[i]);
+        }
+        if(fclose(fd) != 0)
+            error_handler(FATAL_ERROR, "Error writing spill file %s", path);
+    }
+    free(io_buffer);
+    free(replicas);
+    error_handler(WARN_ERROR, "Spilled %d unique sequences (~%zu bytes) to %s", db->unique, db->bytes, s->dir);
+    // The database is now empty, but keeps counting the sequences read
+    db->unique = 0;
+    db->bytes = 0;
+    ++s->num_runs;
+}
+
+/*
+    Merges all the spilled runs with the contents of the de-replication
+    database db, one partition at a time
+
+    Inputs:
+        s: pointer to the spill structure
+        db: pointer to the derep_db structure
+*/
+void merge_spilled_runs(spill* s, derep_db* db){
+    int i;
+    int run;
+    int partition;
+    char path[4096];
+    if(s->num_runs == 0)
+        return;
+    // The merged database is built aside, the partitions still to merge
+    // stay in db
+    derep_db* merged = create_derep_db();
+    FILE** runs = (FILE**) malloc(sizeof(FILE*) * s->num_runs);
+    // The heads of each source: the runs, followed by the in-memory table
+    seq_replicas** heads = (seq_replicas**) malloc(sizeof(seq_replicas*) * (s->num_runs + 1));
+    seq_replicas** in_memory = (seq_replicas**) malloc(sizeof(seq_replicas*) * (db->unique + 1));
+    for(partition = 0; partition < SPILL_PARTITIONS; partition++){
+        // Pull out of the table the in-memory replicas of this partition
+        int num_in_memory = 0;
+        int next_in_memory = 0;
+        seq_replicas* current;
+        seq_replicas* tmp;
+        HASH_ITER(hh, db->seqs, current, tmp){
+            if(_partition_of(current->sequence) == partition){
+                HASH_DEL(db->seqs, current);
+                in_memory[num_in_memory++] = current;
+            }
+        }
+        qsort(in_memory, num_in_memory, sizeof(seq_replicas*), _compare_sequences);
+        // Open the runs of this partition and read their first record
+        for(run = 0; run < s->num_runs; run++){
+            _run_path(s, run, partition, path);
+            runs[run] = fopen(path, "rb");
+            if(runs[run] == NULL)
+                error_handler(FATAL_ERROR, "Error opening spill file %s", path);
+            heads[run] = _read_run_record(runs[run]);
+        }
+        heads[s->num_runs] = num_in_memory ? in_memory[next_in_memory++] : NULL;
+        // K-way merge of the sorted sources
+        while(1){
+            // Look for the smallest sequence among the heads
+            int min = -1;
+            for(i = 0; i <= s->num_runs; i++){
+                if(heads[i] && (min < 0 || strcmp(heads[i]->sequence, heads[min]->sequence) < 0))
+                    min = i;
+            }
+            if(min < 0)
+                break;
+            seq_replicas* out = heads[min];
+            // Collapse the same sequence coming from the other sources
+            for(i = 0; i <= s->num_runs; i++){
+                if(i != min && heads[i] && strcmp(heads[i]->sequence, out->sequence) == 0){
+                    _merge_replicas(out, heads[i]);
+                    heads[i] = (i < s->num_runs) ? _read_run_record(runs[i]) :
+                               (next_in_memory < num_in_memory ? in_memory[next_in_memory++] : NULL);
+                }
+            }
+            heads[min] = (min < s->num_runs) ? _read_run_record(runs[min]) :
+                         (next_in_memory < num_in_memory ? in_memory[next_in_memory++] : NULL);
+            // Partitions are disjoint, so the sequence is new to merged
+            insert_seq_replica(merged, out);
+        }
+        // This partition is done - release its disk space
+        for(run = 0; run < s->num_runs; run++){
+            fclose(runs[run]);
+            _run_path(s, run, partition, path);
+            unlink(path);
+        }
+    }
+    free(runs);
+    free(heads);
+    free(in_memory);
+    // Move the merged table into db
+    db->seqs = merged->seqs;
+    db->unique = merged->unique;
+    db->bytes = merged->bytes;
+    free(merged);
+    s->num_runs = 0;
+}
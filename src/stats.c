@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+#include <mpi.h>
+#include "stats.h"
+#include "util.h"
+
+// Number of doubles in the run_stats structure
+#define STATS_FIELDS (sizeof(run_stats) / sizeof(double))
+
+int STATS_ENABLED = 0;
+run_stats STATS;
+
+// Names of the phases, as written in the report
+static const char* PHASE_NAMES[NUM_PHASES] = {
+    "read", "dereplicate", "gather", "sort", "write", "presize", "denoise", "closed_ref"
+};
+
+// Names of the counters, in the order they are laid out in run_stats
+static const char* COUNTER_NAMES[] = {
+    "reads", "bytes_read", "hash_probes", "bytes_sent", "bytes_recv",
+    "local_unique", "load_factor", "filtered", "bytes_uncompressed",
+    "huge_page_bytes", "dtlb_load_misses", "tlb_counted", "page_faults",
+    "primers_trimmed", "sketch_rejects"
+};
+
+// Counter of the data TLB load misses of this process, -1 if unavailable
+static int TLB_FD = -1;
+// Minor page faults of this process before the counters were enabled
+static long FAULTS_START = 0;
+
+/*
+    Returns the number of minor page faults of this process so far
+*/
+long _minor_faults(void){
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt;
+}
+
+/*
+    Opens the counter of the data TLB load misses of this process and its
+    future threads, in user space
+*/
+void _open_tlb_counter(void){
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(struct perf_event_attr));
+    attr.size = sizeof(struct perf_event_attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    // Virtual machines and containers often do not expose it
+    TLB_FD = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+    Stores the values of the TLB and page fault counters in STATS
+*/
+void _read_tlb_counters(void){
+    long long misses;
+    if(TLB_FD >= 0 && read(TLB_FD, &misses, sizeof(long long)) == sizeof(long long)){
+        STATS.dtlb_load_misses = misses;
+        STATS.tlb_counted = 1;
+    }
+    STATS.page_faults = _minor_faults() - FAULTS_START;
+}
+
+/*
+    Enables the collection of the performance counters and resets them
+*/
+void enable_stats(void){
+    memset(&STATS, 0, sizeof(run_stats));
+    STATS_ENABLED = 1;
+    if(TLB_FD < 0)
+        _open_tlb_counter();
+    FAULTS_START = _minor_faults();
+}
+
+/*
+    Writes the min/max/mean summary of the metric at offset `field` of the
+    run_stats structures of all processes
+
+    Inputs:
+        fd: the output file
+        all: the run_stats structures of all the processes, flattened
+        comm_sz: the number of processes
+        field: the offset of the metric inside run_stats, in doubles
+*/
+void _write_summary(FILE* fd, double* all, int comm_sz, int field){
+    int i;
+    int max_rank = 0;
+    int min_rank = 0;
+    double sum = 0.0;
+    for(i = 0; i < comm_sz; i++){
+        double value = all[i * STATS_FIELDS + field];
+        sum += value;
+        if(value > all[max_rank * STATS_FIELDS + field])
+            max_rank = i;
+        if(value < all[min_rank * STATS_FIELDS + field])
+            min_rank = i;
+    }
+    fprintf(fd, "{\"min\": %.6f, \"max\": %.6f, \"mean\": %.6f, \"total\": %.6f, \"min_rank\": %d, \"max_rank\": %d}",
+            all[min_rank * STATS_FIELDS + field], all[max_rank * STATS_FIELDS + field],
+            sum / comm_sz, sum, min_rank, max_rank);
+}
+
+/*
+    Collects the performance counters of all the processes in the process
+    with rank 0, which writes them as a JSON report to the file `path`
+
+    Inputs:
+        path: path to the output JSON file
+        my_rank: process rank
+        comm_sz: the number of processes
+*/
+void write_stats_report(char* path, int my_rank, int comm_sz){
+    int i;
+    int j;
+    double* all = NULL;
+    int num_counters = STATS_FIELDS - NUM_PHASES;
+    _read_tlb_counters();
+    // run_stats only holds doubles, so it can travel as a plain array
+    if(my_rank == 0)
+        all = (double*) malloc(sizeof(double) * STATS_FIELDS * comm_sz);
+    MPI_Gather(&STATS, STATS_FIELDS, MPI_DOUBLE, all, STATS_FIELDS, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    if(my_rank != 0)
+        return;
+
+    FILE* fd = fopen(path, "w");
+    if(fd == NULL)
+        error_handler(FATAL_ERROR, "Error opening stats file %s", path);
+    fprintf(fd, "{\n  \"ranks\": %d,\n  \"per_rank\": [\n", comm_sz);
+    for(i = 0; i < comm_sz; i++){
+        double* s = &all[i * STATS_FIELDS];
+        fprintf(fd, "    {\"rank\": %d, \"seconds\": {", i);
+        for(j = 0; j < NUM_PHASES; j++)
+            fprintf(fd, "%s\"%s\": %.6f", j ? ", " : "", PHASE_NAMES[j], s[j]);
+        fprintf(fd, "}");
+        for(j = 0; j < num_counters; j++)
+            fprintf(fd, ", \"%s\": %.15g", COUNTER_NAMES[j], s[NUM_PHASES + j]);
+        fprintf(fd, "}%s\n", (i < comm_sz - 1) ? "," : "");
+    }
+    fprintf(fd, "  ],\n  \"summary\": {\n    \"seconds\": {\n");
+    for(j = 0; j < NUM_PHASES; j++){
+        fprintf(fd, "      \"%s\": ", PHASE_NAMES[j]);
+        _write_summary(fd, all, comm_sz, j);
+        fprintf(fd, "%s\n", (j < NUM_PHASES - 1) ? "," : "");
+    }
+    fprintf(fd, "    },\n");
+    for(j = 0; j < num_counters; j++){
+        fprintf(fd, "    \"%s\": ", COUNTER_NAMES[j]);
+        _write_summary(fd, all, comm_sz, NUM_PHASES + j);
+        fprintf(fd, "%s\n", (j < num_counters - 1) ? "," : "");
+    }
+    fprintf(fd, "  }\n}\n");
+    fclose(fd);
+    free(all);
+}
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "stream.h"
+#include "util.h"
+
+/*
+    Returns 1 if the input path can only be read sequentially, 0 otherwise
+
+    Inputs:
+        path: the input path
+*/
+int is_stream_input(char* path){
+    struct stat st;
+    if(strcmp(path, "-") == 0)
+        return 1;
+    if(stat(path, &st) != 0)
+        return 0;
+    return S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode);
+}
+
+/*
+    Opens the input path for sequential reading in large blocks
+
+    Inputs:
+        path: the input path
+
+    Returns:
+        the new stream structure
+*/
+stream* open_stream(char* path){
+    stream* s = (stream*) malloc(sizeof(stream));
+    s->fd = (strcmp(path, "-") == 0) ? STDIN_FILENO : open(path, O_RDONLY);
+    if(s->fd < 0)
+        error_handler(FATAL_ERROR, "Error opening file %s", path);
+    s->fill = NULL;
+    s->source = NULL;
+    s->path = path;
+    s->buffer = (char*) malloc(STREAM_BUFFER_SIZE);
+    s->start = 0;
+    s->end = 0;
+    s->eof = 0;
+    return s;
+}
+
+/*
+    Opens a stream over the blocks handed by fill
+
+    Inputs:
+        path: the input path, for the error messages
+        fill: the function that hands the blocks of the input
+        source: the first argument of fill
+
+    Returns:
+        the new stream structure
+*/
+stream* open_source_stream(char* path, stream_source fill, void* source){
+    stream* s = (stream*) malloc(sizeof(stream));
+    s->fd = -1;
+    s->fill = fill;
+    s->source = source;
+    s->path = path;
+    s->buffer = (char*) malloc(STREAM_BUFFER_SIZE);
+    s->start = 0;
+    s->end = 0;
+    s->eof = 0;
+    return s;
+}
+
+/*
+    Closes the stream s and frees its memory
+
+    Inputs:
+        s: pointer to the stream structure
+*/
+void close_stream(stream* s){
+    if(s->fd >= 0 && s->fd != STDIN_FILENO)
+        close(s->fd);
+    free(s->buffer);
+    free(s);
+}
+
+/*
+    Refills the buffer of s: the unread bytes are moved to the front and the
+    free space is filled with blocks of up to STREAM_BLOCK_SIZE bytes
+
+    Inputs:
+        s: pointer to the stream structure
+
+    Returns the number of bytes added to the buffer
+*/
+size_t _fill_stream(stream* s){
+    size_t added = 0;
+    // Only the partial line left at the end is moved
+    if(s->start > 0){
+        memmove(s->buffer, s->buffer + s->start, s->end - s->start);
+        s->end -= s->start;
+        s->start = 0;
+    }
+    while(!s->eof && s->end < STREAM_BUFFER_SIZE){
+        size_t block = STREAM_BUFFER_SIZE - s->end;
+        if(block > STREAM_BLOCK_SIZE)
+            block = STREAM_BLOCK_SIZE;
+        // A source hands a block or reports the end of the input
+        if(s->fill){
+            size_t copied = s->fill(s->source, s->buffer + s->end, block);
+            if(copied == 0)
+                s->eof = 1;
+            s->end += copied;
+            added += copied;
+            break;
+        }
+        ssize_t got = read(s->fd, s->buffer + s->end, block);
+        if(got < 0){
+            if(errno == EINTR)
+                continue;
+            error_handler(FATAL_ERROR, "Error reading file %s", s->path);
+        }
+        if(got == 0)
+            s->eof = 1;
+        s->end += got;
+        added += got;
+        // A pipe hands over what it has - do not wait for a full buffer
+        if(added > 0)
+            break;
+    }
+    return added;
+}
+
+/*
+    Returns the next line of the stream s, including its '\n' if present
+
+    Inputs:
+        s: pointer to the stream structure
+        length: output parameter - the length of the line
+
+    Returns a pointer to the line or NULL at the end of the stream
+*/
+char* stream_getline(stream* s, size_t* length){
+    size_t scanned = s->start;
+    while(1){
+        char* newline = memchr(s->buffer + scanned, '\n', s->end - scanned);
+        if(newline){
+            char* line = s->buffer + s->start;
+            *length = newline + 1 - line;
+            s->start += *length;
+            return line;
+        }
+        // The line goes on past the buffered bytes
+        scanned = s->end - s->start;
+        if(s->eof || (s->start == 0 && s->end == STREAM_BUFFER_SIZE)){
+            // Last line without '\n', or a line longer than the buffer
+            if(s->end == s->start)
+                return NULL;
+            if(!s->eof)
+                error_handler(FATAL_ERROR, "Line longer than %d bytes in %s", STREAM_BUFFER_SIZE, s->path);
+            char* line = s->buffer + s->start;
+            *length = s->end - s->start;
+            s->start = s->end;
+            return line;
+        }
+        _fill_stream(s);
+        // After the refill the unread bytes start at the front
+        scanned += s->start;
+    }
+}
@@ -0,0 +1,470 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring_reader.h"
+#include "util.h"
+
+// States of the files
+#define URING_FILE_PENDING 0
+#define URING_FILE_OPENING 1
+#define URING_FILE_OPEN 2
+#define URING_FILE_DONE 3
+#define URING_FILE_CLOSED 4
+
+// States of the buffers
+#define URING_BUFFER_FREE 0
+#define URING_BUFFER_INFLIGHT 1
+#define URING_BUFFER_READY 2
+
+// Operations, in the high half of the user data of the requests
+#define URING_OP_OPEN 1
+#define URING_OP_READ 2
+#define URING_OP_CLOSE 3
+#define URING_OP_STATX 4
+
+/*
+    Sets up the io_uring instance u with `entries` submission entries and
+    maps its rings
+
+    Inputs:
+        u: pointer to the uring structure
+        entries: the number of entries of the submission queue
+
+    Returns 0 on success, -1 if the kernel does not provide io_uring
+*/
+int _uring_setup(uring* u, unsigned entries){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(struct io_uring_params));
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(u->fd < 0)
+        return -1;
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    // Recent kernels map both rings at once
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(u->cq_ring_size > u->sq_ring_size)
+            u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = u->sq_ring_size;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if(u->sq_ring == MAP_FAILED){
+        close(u->fd);
+        return -1;
+    }
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+        u->cq_ring = u->sq_ring;
+    else{
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if(u->cq_ring == MAP_FAILED){
+            munmap(u->sq_ring, u->sq_ring_size);
+            close(u->fd);
+            return -1;
+        }
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe*) mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED){
+        if(u->cq_ring != u->sq_ring)
+            munmap(u->cq_ring, u->cq_ring_size);
+        munmap(u->sq_ring, u->sq_ring_size);
+        close(u->fd);
+        return -1;
+    }
+    char* sq = (char*) u->sq_ring;
+    char* cq = (char*) u->cq_ring;
+    u->sq_head = (unsigned*) (sq + p.sq_off.head);
+    u->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*) (sq + p.sq_off.array);
+    u->cq_head = (unsigned*) (cq + p.cq_off.head);
+    u->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*) (cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+    u->to_submit = 0;
+    u->in_flight = 0;
+    return 0;
+}
+
+/*
+    Unmaps the rings of u and closes it
+
+    Inputs:
+        u: pointer to the uring structure
+*/
+void _uring_teardown(uring* u){
+    munmap(u->sqes, u->sqes_size);
+    if(u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    munmap(u->sq_ring, u->sq_ring_size);
+    close(u->fd);
+}
+
+/*
+    Submits the queued requests of u and, if min_complete > 0, waits for
+    that many completions
+
+    Inputs:
+        u: pointer to the uring structure
+        min_complete: the number of completions to wait for
+*/
+void _uring_enter(uring* u, unsigned min_complete){
+    while(1){
+        int ret = syscall(__NR_io_uring_enter, u->fd, u->to_submit, min_complete,
+                          min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if(ret < 0){
+            if(errno == EINTR)
+                continue;
+            error_handler(FATAL_ERROR, "io_uring_enter failed (errno %d)", errno);
+        }
+        u->to_submit -= ret;
+        return;
+    }
+}
+
+/*
+    Queues a request in the submission queue of u, submitting the queued
+    ones first if it is full
+
+    Inputs:
+        u: pointer to the uring structure
+        opcode: the IORING_OP_* operation
+        fd: the file descriptor (or AT_FDCWD for the opens)
+        addr: the buffer or path of the operation
+        len: the length of the buffer (the statx mask)
+        offset: the file offset of the reads (the statx buffer)
+        user_data: the value identifying its completion
+*/
+void _uring_push(uring* u, int opcode, int fd, void* addr, unsigned len, uint64_t offset, uint64_t user_data){
+    unsigned tail = *u->sq_tail;
+    if(tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > *u->sq_mask)
+        _uring_enter(u, 0);
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe* sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) addr;
+    sqe->len = len;
+    sqe->off = offset;
+    sqe->user_data = user_data;
+    if(opcode == IORING_OP_OPENAT)
+        sqe->open_flags = O_RDONLY;
+    u->sq_array[index] = index;
+    // The entry must be complete before the kernel sees the new tail
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++u->to_submit;
+    ++u->in_flight;
+}
+
+/*
+    Marks the file f as open once its open and its statx have completed,
+    with the number of chunks to read taken from its size
+
+    Inputs:
+        f: pointer to the uring_file structure
+*/
+void _uring_file_opened(uring_file* f){
+    if(--f->opening > 0)
+        return;
+    f->size = f->stx.stx_size;
+    f->eof_chunk = (f->size + URING_CHUNK - 1) / URING_CHUNK;
+    f->state = URING_FILE_OPEN;
+}
+
+/*
+    Handles the completion of a request of the reader r
+
+    Inputs:
+        r: pointer to the uring_reader structure
+        cqe: the completion entry
+*/
+void _uring_complete(uring_reader* r, struct io_uring_cqe* cqe){
+    int op = cqe->user_data >> 32;
+    int index = cqe->user_data & 0xffffffff;
+    if(op == URING_OP_OPEN){
+        uring_file* f = &r->files[index];
+        if(cqe->res < 0)
+            error_handler(FATAL_ERROR, "Error opening file %s", f->path);
+        f->fd = cqe->res;
+        _uring_file_opened(f);
+    }
+    else if(op == URING_OP_STATX){
+        uring_file* f = &r->files[index];
+        if(cqe->res < 0)
+            error_handler(FATAL_ERROR, "Error reading the size of file %s", f->path);
+        _uring_file_opened(f);
+    }
+    else if(op == URING_OP_READ){
+        uring_buffer* b = &r->buffers[index];
+        uring_file* f = &r->files[b->file];
+        long offset = (long) b->chunk * URING_CHUNK;
+        long expected = (f->size - offset < URING_CHUNK) ? f->size - offset : URING_CHUNK;
+        if(cqe->res < 0)
+            error_handler(FATAL_ERROR, "Error reading file %s", f->path);
+        b->length += cqe->res;
+        if(f->state == URING_FILE_DONE){
+            // The file was parsed in the meantime: the read holds nothing
+            b->state = URING_BUFFER_FREE;
+            --f->held;
+            return;
+        }
+        if(cqe->res > 0 && (long) b->length < expected){
+            // Short reads are legal: request the rest of the chunk
+            _uring_push(&r->ring, IORING_OP_READ, f->fd, b->data + b->length, expected - b->length,
+                        offset + b->length, cqe->user_data);
+            return;
+        }
+        if(cqe->res == 0 && (long) b->length < expected){
+            // The file shrank after it was opened: it ends here
+            int eof = (b->length == 0) ? b->chunk : b->chunk + 1;
+            if(eof < f->eof_chunk)
+                f->eof_chunk = eof;
+        }
+        b->consumed = 0;
+        b->state = URING_BUFFER_READY;
+        // The reads past the end hold nothing
+        if(b->chunk >= f->eof_chunk){
+            b->state = URING_BUFFER_FREE;
+            --f->held;
+        }
+    }
+    // The closes need no handling
+}
+
+/*
+    Handles all the completions available in the ring of r, without waiting
+
+    Inputs:
+        r: pointer to the uring_reader structure
+*/
+void _uring_reap(uring_reader* r){
+    uring* u = &r->ring;
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    while(head != tail){
+        // Copied out, as handling it may queue a new request
+        struct io_uring_cqe cqe = u->cqes[head & *u->cq_mask];
+        __atomic_store_n(u->cq_head, ++head, __ATOMIC_RELEASE);
+        --u->in_flight;
+        _uring_complete(r, &cqe);
+    }
+}
+
+/*
+    Submits the opens of the files ahead, the reads for the free buffers
+    (the file being parsed first) and the closes of the files parsed, and
+    handles the completions available
+
+    Inputs:
+        r: pointer to the uring_reader structure
+*/
+void _uring_pump(uring_reader* r){
+    int i;
+    int f;
+    int last = (r->current + URING_FILES_AHEAD < r->num_files) ? r->current + URING_FILES_AHEAD : r->num_files;
+    for(f = r->current; f < last; f++){
+        if(r->files[f].state == URING_FILE_PENDING){
+            // The size comes with the open, so the parser never stats: the
+            // statx takes its mask as the length and its buffer as the offset
+            _uring_push(&r->ring, IORING_OP_OPENAT, AT_FDCWD, r->files[f].path, 0, 0,
+                        ((uint64_t) URING_OP_OPEN << 32) | f);
+            _uring_push(&r->ring, IORING_OP_STATX, AT_FDCWD, r->files[f].path, STATX_SIZE,
+                        (uint64_t) (uintptr_t) &r->files[f].stx, ((uint64_t) URING_OP_STATX << 32) | f);
+            r->files[f].opening = 2;
+            r->files[f].state = URING_FILE_OPENING;
+        }
+    }
+    for(i = 0; i < URING_BUFFERS; i++){
+        if(r->buffers[i].state != URING_BUFFER_FREE)
+            continue;
+        // The earliest file that can take another buffer
+        for(f = r->current; f < last; f++){
+            uring_file* file = &r->files[f];
+            int depth = (f == r->current) ? URING_FILE_DEPTH : 1;
+            if(file->state == URING_FILE_OPEN && file->next_chunk < file->eof_chunk && file->held < depth)
+                break;
+        }
+        if(f == last)
+            break;
+        uring_file* file = &r->files[f];
+        uring_buffer* b = &r->buffers[i];
+        b->state = URING_BUFFER_INFLIGHT;
+        b->file = f;
+        b->chunk = file->next_chunk++;
+        b->length = 0;
+        ++file->held;
+        _uring_push(&r->ring, IORING_OP_READ, file->fd, b->data, URING_CHUNK,
+                    (uint64_t) b->chunk * URING_CHUNK, ((uint64_t) URING_OP_READ << 32) | i);
+    }
+    // Close the parsed files, in order, once their last reads are back
+    while(r->next_close < r->current && r->files[r->next_close].held == 0){
+        uring_file* file = &r->files[r->next_close++];
+        _uring_push(&r->ring, IORING_OP_CLOSE, file->fd, NULL, 0, 0, (uint64_t) URING_OP_CLOSE << 32);
+        file->state = URING_FILE_CLOSED;
+    }
+    if(r->ring.to_submit)
+        _uring_enter(&r->ring, 0);
+    _uring_reap(r);
+}
+
+/*
+    Hands the next bytes of the file being parsed to its stream, waiting on
+    the ring only if its next chunk is not ready
+
+    Inputs:
+        source: pointer to the uring_reader structure
+        dst: the destination of the bytes
+        size: the largest number of bytes to hand
+
+    Returns the number of bytes copied to dst, 0 at the end of the file
+*/
+size_t _uring_fill(void* source, char* dst, size_t size){
+    int i;
+    uring_reader* r = (uring_reader*) source;
+    uring_file* f = &r->files[r->current];
+    while(1){
+        if(f->eof_chunk >= 0 && f->next_consume >= f->eof_chunk)
+            return 0;
+        for(i = 0; i < URING_BUFFERS; i++){
+            uring_buffer* b = &r->buffers[i];
+            if(b->state == URING_BUFFER_READY && b->file == r->current && b->chunk == f->next_consume){
+                size_t n = b->length - b->consumed;
+                if(n > size)
+                    n = size;
+                memcpy(dst, b->data + b->consumed, n);
+                b->consumed += n;
+                if(b->consumed == b->length){
+                    // The buffer goes back to the pool for the next reads
+                    b->state = URING_BUFFER_FREE;
+                    --f->held;
+                    ++f->next_consume;
+                    _uring_pump(r);
+                }
+                return n;
+            }
+        }
+        // Not there yet: make sure it is requested, which may also reap it
+        _uring_pump(r);
+        if(f->eof_chunk >= 0 && f->next_consume >= f->eof_chunk)
+            return 0;
+        for(i = 0; i < URING_BUFFERS; i++){
+            uring_buffer* b = &r->buffers[i];
+            if(b->state == URING_BUFFER_READY && b->file == r->current && b->chunk == f->next_consume)
+                break;
+        }
+        if(i < URING_BUFFERS)
+            continue;
+        // Block until a request completes, which frees or fills a buffer
+        if(r->ring.in_flight == 0)
+            error_handler(FATAL_ERROR, "The io_uring reader of file %s stalled", f->path);
+        _uring_enter(&r->ring, 1);
+        _uring_reap(r);
+    }
+}
+
+/*
+    Creates a reader of the regular files paths, in order, that submits
+    their opens and reads to an io_uring instance ahead of the parser
+
+    Inputs:
+        paths: the list of file paths
+        num_files: the number of file paths
+
+    Returns:
+        the new uring_reader structure, or NULL if the kernel does not
+        provide io_uring
+*/
+uring_reader* create_uring_reader(char** paths, int num_files){
+    int i;
+    uring_reader* r = (uring_reader*) malloc(sizeof(uring_reader));
+    if(_uring_setup(&r->ring, URING_ENTRIES) != 0){
+        free(r);
+        return NULL;
+    }
+    r->num_files = num_files;
+    r->files = (uring_file*) malloc(sizeof(uring_file) * (num_files + 1));
+    for(i = 0; i < num_files; i++){
+        r->files[i].path = paths[i];
+        r->files[i].fd = -1;
+        r->files[i].state = URING_FILE_PENDING;
+        r->files[i].next_chunk = 0;
+        r->files[i].next_consume = 0;
+        r->files[i].held = 0;
+        r->files[i].opening = 0;
+        r->files[i].size = 0;
+        r->files[i].eof_chunk = -1;
+    }
+    for(i = 0; i < URING_BUFFERS; i++){
+        r->buffers[i].data = (char*) malloc(URING_CHUNK);
+        r->buffers[i].state = URING_BUFFER_FREE;
+    }
+    // Nothing is parsed yet: the first call moves to file 0
+    r->current = -1;
+    r->next_close = 0;
+    r->s = NULL;
+    return r;
+}
+
+/*
+    Destroys the reader r, once its requests in flight have completed
+
+    Inputs:
+        r: pointer to the uring_reader structure
+*/
+void destroy_uring_reader(uring_reader* r){
+    int i;
+    if(r->s)
+        close_stream(r->s);
+    // Wait for the requests still in flight, as they write to our memory
+    if(r->ring.to_submit)
+        _uring_enter(&r->ring, 0);
+    while(r->ring.in_flight){
+        _uring_enter(&r->ring, 1);
+        _uring_reap(r);
+    }
+    for(i = 0; i < r->num_files; i++){
+        if(r->files[i].state == URING_FILE_OPEN || r->files[i].state == URING_FILE_DONE)
+            close(r->files[i].fd);
+    }
+    for(i = 0; i < URING_BUFFERS; i++)
+        free(r->buffers[i].data);
+    _uring_teardown(&r->ring);
+    free(r->files);
+    free(r);
+}
+
+/*
+    Returns a stream over the next file of the reader r, valid until the
+    next call, or NULL after the last file
+
+    Inputs:
+        r: pointer to the uring_reader structure
+*/
+stream* uring_next_stream(uring_reader* r){
+    int i;
+    if(r->s){
+        close_stream(r->s);
+        r->s = NULL;
+        // Release what is left of the parsed file
+        for(i = 0; i < URING_BUFFERS; i++){
+            if(r->buffers[i].state == URING_BUFFER_READY && r->buffers[i].file == r->current){
+                r->buffers[i].state = URING_BUFFER_FREE;
+                --r->files[r->current].held;
+            }
+        }
+        r->files[r->current].state = URING_FILE_DONE;
+    }
+    if(++r->current >= r->num_files){
+        r->current = r->num_files;
+        _uring_pump(r);
+        return NULL;
+    }
+    r->s = open_source_stream(r->files[r->current].path, _uring_fill, r);
+    _uring_pump(r);
+    return r->s;
+}
@@ -1,6 +1,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <mpi.h>
 #include "util.h"
 
@@ -18,14 +19,19 @@
             arguments and formatted as requested.
 */
 void error_handler(int level, char* format, ...){
-    int my_rank;
-    int comm_sz;
+    int my_rank = 0;
+    int comm_sz = 1;
+    int mpi_initialized;
     char message[MSG_LEN];
     va_list args;
-    // Get the process rank
-    MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
-    // Get the number of processes
-    MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+    // The library can run in a single process without MPI
+    MPI_Initialized(&mpi_initialized);
+    if(mpi_initialized){
+        // Get the process rank
+        MPI_Comm_rank(MPI_COMM_WORLD, &my_rank);
+        // Get the number of processes
+        MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+    }
     // Turn the parameters into a character string
     va_start(args, format);
     vsnprintf(message, MSG_LEN, format, args);
@@ -50,12 +56,33 @@ void error_handler(int level, char* format, ...){
             fprintf(stderr, "[%d/%d] FATAL ERROR: %s\n", my_rank, comm_sz, message);
             fflush(stderr);
             // Exit with an error
-            MPI_Abort(MPI_COMM_WORLD, -1);
+            if(mpi_initialized)
+                MPI_Abort(MPI_COMM_WORLD, -1);
+            exit(EXIT_FAILURE);
         default:
             // Error level unknown - This is a fatal error
             fprintf(stderr, "[%d/%d] FATAL ERROR: error level unknown\n", my_rank, comm_sz);
             fflush(stderr);
             // Exit with an error
-            MPI_Abort(MPI_COMM_WORLD, -1);
+            if(mpi_initialized)
+                MPI_Abort(MPI_COMM_WORLD, -1);
+            exit(EXIT_FAILURE);
+    }
+}
+
+/*
+    Appends `size` bytes from data to the buffer b, growing it as needed
+
+    Inputs:
+        b: pointer to the byte_buffer structure
+        data: the bytes to append
+        size: the number of bytes to append
+*/
+void buffer_append(byte_buffer* b, void* data, size_t size){
+    if(b->size + size > b->capacity){
+        b->capacity = 2 * (b->size + size);
+        b->data = (char*) realloc(b->data, b->capacity);
     }
-}
\ No newline at end of file
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}